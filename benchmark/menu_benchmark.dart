@@ -0,0 +1,236 @@
+// Measures the Dart side of the hot menu operations: the bookkeeping of
+// Menu.addLabel and Menu.remove against a platform that does nothing, how
+// long finding an activated item by its handle takes as menus grow and nest,
+// and what MethodChannelTrayMenu costs per call against a mock messenger that
+// answers like the native plugin, including the size of each encoded call.
+//
+// Run with:
+//
+//   flutter test --enable-vmservice benchmark/menu_benchmark.dart
+//
+// Each combination is printed as one line of JSON, like the native
+// tray_menu_replay --scale, so results can be collected and compared across
+// versions. Heap allocations are counted with the VM service, and reported as
+// null when it isn't enabled; the few made by asking for them are included.
+import 'dart:async';
+import 'dart:convert';
+import 'dart:developer';
+import 'dart:io';
+import 'dart:isolate';
+
+import 'package:flutter/foundation.dart';
+import 'package:flutter/services.dart';
+import 'package:flutter_test/flutter_test.dart';
+import 'package:tray_menu/tray_menu.dart';
+import 'package:vm_service/vm_service.dart' show ClassHeapStats, VmService;
+import 'package:vm_service/vm_service_io.dart';
+
+const _sizes = [10, 100, 1000];
+const _depths = [1, 2, 4];
+const _lookups = 1000;
+
+// Mirrors the native side, where a handle's upper bits name its tray.
+const _trayHandleShift = 32;
+
+// Answers every call at once, the way the FFI fast path does, so only the
+// Dart side is measured.
+class _FakeTrayMenuPlatform extends TrayMenuPlatform {
+  final eventBatches = StreamController<Object?>.broadcast(sync: true);
+  final _nextHandles = <int, int>{};
+  int lastTray = 0;
+  int lastHandle = -1;
+
+  @override
+  Stream<Object?> get events => eventBatches.stream;
+
+  @override
+  void setCallbackHandler(Future<dynamic> Function(MethodCall) callback) {}
+
+  @override
+  Future<int> init({String? id, bool reattach = false}) =>
+      SynchronousFuture(id == null ? 0 : ++lastTray);
+
+  @override
+  Future<Map<Object?, Object?>> getManifest({int tray = 0}) =>
+      SynchronousFuture(const {});
+
+  @override
+  Future<int> add(Object item, {int tray = 0, int? submenu, int? before}) {
+    final index = submenu != null ? submenu >> _trayHandleShift : tray;
+    final local = _nextHandles[index] = (_nextHandles[index] ?? -1) + 1;
+    return SynchronousFuture(lastHandle = index << _trayHandleShift | local);
+  }
+
+  @override
+  Future<void> remove(int handle) => SynchronousFuture(null);
+}
+
+class _Allocations {
+  _Allocations._(this._service, this._isolateId);
+
+  final VmService _service;
+  final String _isolateId;
+
+  static Future<_Allocations?> connect() async {
+    final uri = (await Service.getInfo()).serverWebSocketUri;
+    final isolateId = Service.getIsolateID(Isolate.current);
+    if (uri == null || isolateId == null) return null;
+    return _Allocations._(await vmServiceConnectUri('$uri'), isolateId);
+  }
+
+  Future<void> reset() =>
+      _service.getAllocationProfile(_isolateId, reset: true);
+
+  // The instances and bytes allocated since the last reset.
+  Future<(int, int)> read() async {
+    final profile = await _service.getAllocationProfile(_isolateId);
+    var instances = 0, bytes = 0;
+    for (final stats in profile.members ?? const <ClassHeapStats>[]) {
+      instances += stats.instancesAccumulated ?? 0;
+      bytes += stats.accumulatedSize ?? 0;
+    }
+    return (instances, bytes);
+  }
+}
+
+_Allocations? _allocations;
+
+Future<void> _measure(
+  Map<String, Object?> combination,
+  int count,
+  FutureOr<void> Function() run, {
+  int Function()? messageBytes,
+}) async {
+  await _allocations?.reset();
+  final bytesBefore = messageBytes?.call() ?? 0;
+  final stopwatch = Stopwatch()..start();
+  await run();
+  stopwatch.stop();
+  final elapsedNs = stopwatch.elapsedTicks * 1000000000 ~/ stopwatch.frequency;
+  final bytes = (messageBytes?.call() ?? 0) - bytesBefore;
+  final allocated = await _allocations?.read();
+  stdout.writeln(jsonEncode({
+    ...combination,
+    'mean_ns': elapsedNs ~/ count,
+    'allocations': allocated == null ? null : allocated.$1 / count,
+    'allocated_bytes': allocated == null ? null : allocated.$2 / count,
+    if (messageBytes != null) 'message_bytes': bytes / count,
+  }));
+}
+
+// Nests the items depth levels deep, each level a submenu of the one above.
+Future<Menu> _nestedMenu(TrayMenu tray, int depth) async {
+  Menu menu = tray;
+  for (var level = 1; level < depth; level++) {
+    menu = await menu.addSubmenu('level$level', label: 'Level $level');
+  }
+  return menu;
+}
+
+Future<void> _addItems(Menu menu, int items) async {
+  for (var i = 0; i < items; i++) {
+    await menu.addLabel('item$i', label: 'Item $i');
+  }
+}
+
+Future<void> _removeItems(Menu menu, int items) async {
+  for (var i = 0; i < items; i++) {
+    await menu.remove('item$i');
+  }
+}
+
+Future<void> _benchmarkMenus(_FakeTrayMenuPlatform platform) async {
+  for (final depth in _depths) {
+    for (final items in _sizes) {
+      final tray = TrayMenu.create('menus-$depth-$items');
+      final menu = await _nestedMenu(tray, depth);
+      final combination = {'items': items, 'depth': depth};
+
+      await _measure(
+        {'operation': 'addLabel', ...combination},
+        items,
+        () => _addItems(menu, items),
+      );
+
+      // Activations find their item by handle; the last item added to the
+      // deepest submenu is the one found last.
+      final batch = {
+        'sequence': 0,
+        'sent': 0,
+        'events': [
+          {
+            'type': 'activated',
+            'time': 0,
+            'tray': platform.lastTray,
+            'handle': platform.lastHandle,
+          },
+        ],
+      };
+      await _measure(
+        {'operation': 'getByHandle', ...combination},
+        _lookups,
+        () {
+          for (var i = 0; i < _lookups; i++) {
+            platform.eventBatches.add(batch);
+          }
+        },
+      );
+
+      await _measure(
+        {'operation': 'remove', ...combination},
+        items,
+        () => _removeItems(menu, items),
+      );
+    }
+  }
+}
+
+Future<void> _benchmarkMethodChannel() async {
+  const codec = StandardMethodCodec();
+  var sentBytes = 0;
+  var nextTray = 1000;
+  var nextHandle = 0;
+  TestDefaultBinaryMessengerBinding.instance.defaultBinaryMessenger
+      .setMockMessageHandler('tray_menu', (message) async {
+    sentBytes += message!.lengthInBytes;
+    final call = codec.decodeMethodCall(message);
+    return codec.encodeSuccessEnvelope(switch (call.method) {
+      'init' => {'engine': 1, 'tray': nextTray++},
+      'getManifest' => const <String, Object?>{},
+      'addMenuItem' => nextHandle++,
+      _ => null,
+    });
+  });
+  TrayMenuPlatform.instance = MethodChannelTrayMenu();
+
+  for (final items in _sizes) {
+    final tray = TrayMenu.create('channel-$items');
+    final combination = {'items': items, 'depth': 1, 'channel': true};
+    await _measure(
+      {'operation': 'addLabel', ...combination},
+      items,
+      () => _addItems(tray, items),
+      messageBytes: () => sentBytes,
+    );
+    await _measure(
+      {'operation': 'remove', ...combination},
+      items,
+      () => _removeItems(tray, items),
+      messageBytes: () => sentBytes,
+    );
+  }
+}
+
+void main() {
+  TestWidgetsFlutterBinding.ensureInitialized();
+
+  test('menu operations', () async {
+    _allocations = await _Allocations.connect();
+    // Trays listen for events on the platform the first one was created
+    // with, so the fake one goes first.
+    final platform = _FakeTrayMenuPlatform();
+    TrayMenuPlatform.instance = platform;
+    await _benchmarkMenus(platform);
+    await _benchmarkMethodChannel();
+  }, timeout: Timeout.none);
+}
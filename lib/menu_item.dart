@@ -1,36 +1,270 @@
 part of 'tray_menu.dart';
 
 abstract class _MenuItem {
-  Map<String, dynamic> toMap() => {'type': '$runtimeType'};
+  // The item's key within its menu, which native menu snapshots keep so that
+  // restored items can be matched to the ones added again.
+  final String key;
+
+  _MenuItem(this.key);
+
+  Map<String, dynamic> toMap() => {'type': '$runtimeType', 'key': key};
 }
 
-class _MenuItemSeparator extends _MenuItem {}
+class _MenuItemSeparator extends _MenuItem {
+  _MenuItemSeparator(super.key);
+}
 
 class _MenuItemLabel extends _MenuItem {
   final String label;
   final bool enabled;
 
-  _MenuItemLabel(this.label, this.enabled);
+  // The id of the entry of the string table the label is bound to, which is
+  // sent instead of the label itself.
+  final int? stringId;
+
+  // The id the icon was registered under with [TrayMenu.registerIcon].
+  final String? icon;
+
+  _MenuItemLabel(
+    super.key,
+    this.label,
+    this.enabled, [
+    this.stringId,
+    this.icon,
+  ]);
 
   @override
   Map<String, dynamic> toMap() => {
         ...super.toMap(),
-        'label': label,
+        if (stringId != null) 'string': stringId else 'label': label,
         'enabled': enabled,
+        if (icon != null) 'icon': icon,
       };
 }
 
 class _MenuItemCheckbox extends _MenuItemLabel {
   bool checked;
 
-  _MenuItemCheckbox(super.label, super.enabled, this.checked);
+  _MenuItemCheckbox(
+    super.key,
+    super.label,
+    super.enabled,
+    this.checked, [
+    super.stringId,
+    super.icon,
+  ]);
 
   @override
   Map<String, dynamic> toMap() => {...super.toMap(), 'checked': checked};
 }
 
 class _MenuItemSubmenu extends _MenuItemLabel {
-  _MenuItemSubmenu(super.label, super.enabled);
+  _MenuItemSubmenu(
+    super.key,
+    super.label,
+    super.enabled, [
+    super.stringId,
+    super.icon,
+  ]);
+}
+
+class _MenuItemRadio extends _MenuItemCheckbox {
+  final String groupName;
+  final _RadioGroup radioGroup;
+
+  int get group => radioGroup.id;
+
+  _MenuItemRadio(
+    super.key,
+    super.label,
+    super.enabled,
+    super.checked,
+    this.groupName, [
+    super.stringId,
+  ]) : radioGroup = _RadioGroup(groupName);
+
+  @override
+  Map<String, dynamic> toMap() => {...super.toMap(), 'group': group};
+}
+
+// An item of a menu restored natively from a snapshot, as listed by
+// getManifest, until an add with its key claims it.
+class _NativeItem {
+  _NativeItem.fromMap(Map<Object?, Object?> map)
+      : handle = map['handle'] as int,
+        type = map['type'] as String,
+        label = map['label'] as String,
+        enabled = map['enabled'] as bool,
+        checked = map['checked'] as bool,
+        group = map['group'] as int,
+        icon = map['icon'] as String?;
+
+  final int handle;
+  final String type;
+  final String label;
+  final bool enabled;
+  final bool checked;
+  final int group;
+  final String? icon;
+
+  // The items of a submenu, by key in menu order.
+  final Map<String, _NativeItem> children = {};
+
+  // Whether the item can be updated into [item] rather than replaced.
+  bool matches(_MenuItem item) =>
+      '${item.runtimeType}' == type &&
+      (item is! _MenuItemRadio || item.group == group);
+
+  // Whether updating the item into [item] changes anything. Labels bound to
+  // the string table are always updated, as restored items aren't bound, and
+  // radio items added without being selected leave the selection alone.
+  bool differsFrom(_MenuItem item) {
+    if (item is! _MenuItemLabel) return false;
+    if (item.stringId != null ||
+        item.label != label ||
+        item.icon != icon ||
+        item.enabled != enabled) {
+      return true;
+    }
+    if (item is _MenuItemRadio) return item.checked && !checked;
+    return item is _MenuItemCheckbox && item.checked != checked;
+  }
+}
+
+// Radio groups are named in Dart and identified natively by an id, which is
+// shared by every tray.
+class _RadioGroup {
+  _RadioGroup._(this.id);
+
+  factory _RadioGroup(String name) =>
+      _byName[name] ??= _RadioGroup._(_byName.length);
+
+  static final Map<String, _RadioGroup> _byName = {};
+
+  final int id;
+  MenuItemRadio? selected;
+}
+
+// Entries of the string table are named in Dart and identified natively by an
+// id, like radio groups. The texts mirror what was last set natively.
+class _Strings {
+  static final Map<String, int> _ids = {};
+  static final Map<int, String> texts = {};
+
+  static int? id(String? name) =>
+      name == null ? null : _ids[name] ??= _ids.length;
+}
+
+/// Describes an item to add with [Menu.replaceChildren]. The named
+/// constructors take the same arguments as the corresponding methods of [Menu].
+class MenuEntry {
+  MenuEntry.label(
+    this.key, {
+    String? label,
+    String? labelId,
+    String? icon,
+    bool enabled = true,
+    this.callback,
+  }) : _item = _MenuItemLabel(
+          key,
+          label ?? '',
+          enabled,
+          _Strings.id(labelId),
+          icon,
+        );
+
+  MenuEntry.separator(this.key)
+      : _item = _MenuItemSeparator(key),
+        callback = null;
+
+  MenuEntry.checkbox(
+    this.key, {
+    String? label,
+    String? labelId,
+    String? icon,
+    bool enabled = true,
+    bool checked = false,
+    this.callback,
+  }) : _item = _MenuItemCheckbox(
+          key,
+          label ?? '',
+          enabled,
+          checked,
+          _Strings.id(labelId),
+          icon,
+        );
+
+  MenuEntry.radio(
+    this.key, {
+    required String group,
+    String? label,
+    String? labelId,
+    bool enabled = true,
+    bool selected = false,
+    this.callback,
+  }) : _item = _MenuItemRadio(
+          key,
+          label ?? '',
+          enabled,
+          selected,
+          group,
+          _Strings.id(labelId),
+        );
+
+  MenuEntry.submenu(
+    this.key, {
+    String? label,
+    String? labelId,
+    String? icon,
+    bool enabled = true,
+  })  : _item = _MenuItemSubmenu(
+          key,
+          label ?? '',
+          enabled,
+          _Strings.id(labelId),
+          icon,
+        ),
+        callback = null;
+
+  final String key;
+  final Function(String, MenuItem)? callback;
+  final _MenuItem _item;
+
+  // Radio items are selected natively when added checked or to a group
+  // without a selection, which the new item mirrors.
+  MenuItem _create(int handle) {
+    final description = _item;
+    final item = switch (description) {
+      _MenuItemSeparator() => MenuItemSeparator._(handle),
+      _MenuItemRadio(
+        :final label,
+        :final enabled,
+        :final checked,
+        :final groupName,
+        :final radioGroup,
+      ) =>
+        MenuItemRadio._(
+          handle,
+          label,
+          enabled,
+          groupName,
+          radioGroup,
+          callback,
+        ).._selectIf(checked || radioGroup.selected == null),
+      _MenuItemCheckbox(:final label, :final enabled, :final checked) =>
+        MenuItemCheckbox._(handle, label, enabled, checked, callback),
+      _MenuItemSubmenu(:final label, :final enabled) =>
+        MenuItemSubmenu._(handle, label, enabled),
+      _MenuItemLabel(:final label, :final enabled) =>
+        MenuItemLabel._(handle, label, enabled, callback),
+      _ => throw ArgumentError.value(_item, 'item', 'Unsupported menu item'),
+    };
+    if (item is MenuItemLabel && description is _MenuItemLabel) {
+      item._stringId = description.stringId;
+      item._icon = description.icon;
+    }
+    return item;
+  }
 }
 
 class MenuItem {
@@ -38,6 +272,10 @@ class MenuItem {
   Function(String, MenuItem)? callback;
 
   MenuItem._(this._handle, [this.callback]);
+
+  /// Identifies the item natively. Unlike the item itself it can be sent to
+  /// another isolate, to update the item from there with a [TrayMenuUpdater].
+  int get handle => _handle;
 }
 
 class MenuItemSeparator extends MenuItem {
@@ -48,10 +286,21 @@ class MenuItemLabel extends MenuItem {
   String _label;
   bool _enabled;
 
-  String get label => _label;
+  // The entry of the string table the label is bound to, until it is set.
+  int? _stringId;
+
+  String? _icon;
+
+  /// The label, which is the current text of its entry of the string table if
+  /// it was added with a `labelId`.
+  String get label => _Strings.texts[_stringId] ?? _label;
 
   bool get enabled => _enabled;
 
+  /// The id of the icon shown next to the label, as registered with
+  /// [TrayMenu.registerIcon].
+  String? get icon => _icon;
+
   MenuItemLabel._(super.handle, this._label, this._enabled, [super.callback])
       : super._();
 
@@ -63,6 +312,7 @@ class MenuItemLabel extends MenuItem {
   Future<void> setLabel(String value) async {
     await TrayMenuPlatform.instance.setMenuItemLabel(_handle, value);
     _label = value;
+    _stringId = null;
   }
 
   Future<bool> getEnabled() async {
@@ -74,6 +324,13 @@ class MenuItemLabel extends MenuItem {
     await TrayMenuPlatform.instance.setMenuItemEnabled(_handle, value);
     _enabled = value;
   }
+
+  /// Shows the icon registered as [value] next to the label, or removes the
+  /// icon if it is null.
+  Future<void> setIcon(String? value) async {
+    await TrayMenuPlatform.instance.setMenuItemIcon(_handle, value);
+    _icon = value;
+  }
 }
 
 class MenuItemCheckbox extends MenuItemLabel {
@@ -100,16 +357,74 @@ class MenuItemCheckbox extends MenuItemLabel {
   }
 }
 
+/// An item of a radio group, of which only one item is selected at a time.
+///
+/// Selecting an item, by clicking it or with [select], deselects the rest of
+/// its group natively in the same operation, and only the newly selected item's
+/// callback is called.
+class MenuItemRadio extends MenuItemLabel {
+  final _RadioGroup _group;
+
+  /// The name of the item's group.
+  final String group;
+
+  bool get selected => identical(_group.selected, this);
+
+  MenuItemRadio._(
+    super.handle,
+    super._label,
+    super._enabled,
+    this.group,
+    this._group,
+    super.callback,
+  ) : super._();
+
+  Future<bool> getSelected() async {
+    if (await TrayMenuPlatform.instance.getMenuItemChecked(_handle)) {
+      _group.selected = this;
+    } else if (selected) {
+      _group.selected = null;
+    }
+    return selected;
+  }
+
+  Future<void> select() async {
+    await TrayMenuPlatform.instance.selectRadio(_group.id, _handle);
+    _group.selected = this;
+  }
+
+  void _selectIf(bool condition) {
+    if (condition) _group.selected = this;
+  }
+}
+
 class MenuItemSubmenu extends MenuItemLabel with Menu {
   MenuItemSubmenu._(super.hadle, super._label, super._enabled) : super._();
 
   @override
-  Future<int> _addItem(_MenuItem item, String? before) {
-    final beforeHandle = _items[before]?._handle;
-    return TrayMenuPlatform.instance.add(
-      item,
-      submenu: _handle,
-      before: beforeHandle,
-    );
-  }
+  Future<int> _addItem(_MenuItem item, int? before) =>
+      TrayMenuPlatform.instance.add(item, submenu: _handle, before: before);
+
+  @override
+  bool _isInTray(int tray) => _handle >> TrayMenu._trayHandleShift == tray;
+
+  @override
+  Future<void> _moveItemHere(int handle, int? before) =>
+      TrayMenuPlatform.instance.moveMenuItem(
+        handle,
+        submenu: _handle,
+        before: before,
+      );
+
+  @override
+  Future<void> _reorderItems(Int64List handles) =>
+      TrayMenuPlatform.instance.reorderChildren(handles, submenu: _handle);
+
+  @override
+  Future<void> _clearItems() =>
+      TrayMenuPlatform.instance.clearChildren(submenu: _handle);
+
+  @override
+  Future<List<int>> _replaceItems(List<_MenuItem> items) =>
+      TrayMenuPlatform.instance.replaceChildren(items, submenu: _handle);
 }
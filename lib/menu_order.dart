@@ -0,0 +1,170 @@
+part of 'tray_menu.dart';
+
+class _OrderNode {
+  final String key;
+
+  // Nodes are heap-ordered by a random priority, which keeps the tree
+  // balanced in expectation whatever order the keys are inserted in.
+  final int priority;
+
+  _OrderNode? left;
+  _OrderNode? right;
+  _OrderNode? parent;
+
+  // The number of nodes in the subtree rooted here, which is what positions
+  // are computed from.
+  int size = 1;
+
+  _OrderNode(this.key, this.priority);
+}
+
+// The keys of a menu in the order its items are shown, kept in a treap keyed
+// implicitly by position, so finding, inserting and removing by key or by
+// position all take O(log n).
+class _MenuOrder {
+  static final _random = Random();
+
+  final Map<String, _OrderNode> _nodes = {};
+  _OrderNode? _root;
+
+  int get length => _nodes.length;
+
+  Iterable<String> get keys => range(0);
+
+  // Returns the position of key, or -1 if it is not in the menu.
+  int indexOf(String key) {
+    var node = _nodes[key];
+    if (node == null) return -1;
+    var index = _sizeOf(node.left);
+    for (var parent = node.parent; parent != null; parent = parent.parent) {
+      if (identical(node, parent.right)) index += _sizeOf(parent.left) + 1;
+      node = parent;
+    }
+    return index;
+  }
+
+  String elementAt(int index) => _nodeAt(index).key;
+
+  // The keys from start up to, but not including, end, walked in order
+  // without copying them.
+  Iterable<String> range(int start, [int? end]) sync* {
+    end ??= length;
+    RangeError.checkValidRange(start, end, length);
+    if (start == end) return;
+    _OrderNode? node = _nodeAt(start);
+    for (var i = start; i < end; i++) {
+      yield node!.key;
+      node = _successor(node);
+    }
+  }
+
+  // Inserts key in front of before, or at the end if before is not in the
+  // menu.
+  void insert(String key, [String? before]) {
+    final index = before == null ? -1 : indexOf(before);
+    insertAt(index < 0 ? length : index, key);
+  }
+
+  void insertAt(int index, String key) {
+    final node = _OrderNode(key, _random.nextInt(1 << 32));
+    _nodes[key] = node;
+    final (left, right) = _split(_root, index);
+    _root = _merge(_merge(left, node), right);
+    _root!.parent = null;
+  }
+
+  void remove(String key) {
+    final index = indexOf(key);
+    if (index < 0) return;
+    _nodes.remove(key);
+    final (left, rest) = _split(_root, index);
+    final (_, right) = _split(rest, 1);
+    _root = _merge(left, right);
+    _root?.parent = null;
+  }
+
+  // Moves keys to the front in that order, as a native reorder does; the
+  // other keys keep their order after them.
+  void moveToFront(List<String> keys) {
+    var index = 0;
+    for (final key in keys) {
+      if (!_nodes.containsKey(key)) continue;
+      remove(key);
+      insertAt(index++, key);
+    }
+  }
+
+  void clear() {
+    _nodes.clear();
+    _root = null;
+  }
+
+  static int _sizeOf(_OrderNode? node) => node?.size ?? 0;
+
+  static _OrderNode _update(_OrderNode node) {
+    node.size = _sizeOf(node.left) + _sizeOf(node.right) + 1;
+    node.left?.parent = node;
+    node.right?.parent = node;
+    return node;
+  }
+
+  _OrderNode _nodeAt(int index) {
+    RangeError.checkValidIndex(index, this, 'index', length);
+    var node = _root!;
+    while (true) {
+      final leftSize = _sizeOf(node.left);
+      if (index < leftSize) {
+        node = node.left!;
+      } else if (index > leftSize) {
+        index -= leftSize + 1;
+        node = node.right!;
+      } else {
+        return node;
+      }
+    }
+  }
+
+  static _OrderNode? _successor(_OrderNode node) {
+    var next = node.right;
+    if (next != null) {
+      while (next!.left != null) {
+        next = next.left;
+      }
+      return next;
+    }
+    var child = node;
+    var parent = node.parent;
+    while (parent != null && identical(child, parent.right)) {
+      child = parent;
+      parent = parent.parent;
+    }
+    return parent;
+  }
+
+  // Splits the subtree into its first count nodes and the rest.
+  static (_OrderNode?, _OrderNode?) _split(_OrderNode? node, int count) {
+    if (node == null) return (null, null);
+    final leftSize = _sizeOf(node.left);
+    if (count <= leftSize) {
+      final (left, right) = _split(node.left, count);
+      node.left = right;
+      left?.parent = null;
+      return (left, _update(node));
+    }
+    final (left, right) = _split(node.right, count - leftSize - 1);
+    node.right = left;
+    right?.parent = null;
+    return (_update(node), right);
+  }
+
+  static _OrderNode? _merge(_OrderNode? left, _OrderNode? right) {
+    if (left == null) return right;
+    if (right == null) return left;
+    if (left.priority > right.priority) {
+      left.right = _merge(left.right, right);
+      return _update(left);
+    }
+    right.left = _merge(left, right.left);
+    return _update(right);
+  }
+}
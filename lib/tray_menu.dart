@@ -1,8 +1,19 @@
+import 'dart:async';
+import 'dart:convert';
+import 'dart:developer' show Timeline;
+import 'dart:ffi';
+import 'dart:io';
+import 'dart:math' show Random;
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart' show malloc;
 import 'package:flutter/foundation.dart';
 import 'package:flutter/services.dart';
 import 'package:plugin_platform_interface/plugin_platform_interface.dart';
 
 part 'menu_item.dart';
+part 'menu_order.dart';
+part 'tray_menu_ffi.dart';
 part 'tray_menu_method_channel.dart';
 part 'tray_menu_platform_interface.dart';
 
@@ -10,75 +21,344 @@ mixin Menu {
   final Map<String, MenuItem> _items = {};
   final Map<int, String> _keysByHandle = {};
 
-  Iterable<String> get keys => _items.keys;
+  // The keys of the items above in the order they are shown natively.
+  final _MenuOrder _order = _MenuOrder();
+
+  // The items of a menu restored natively from a snapshot that no add has
+  // claimed yet, by key in menu order.
+  final Map<String, _NativeItem> _unclaimed = {};
+
+  // Completes once the items restored natively are known.
+  Future<void>? _attaching;
+
+  /// The keys of the items of this menu, in the order they are shown.
+  Iterable<String> get keys => _order.keys;
+
+  /// The number of items in this menu, not counting those nested in them.
+  int get length => _order.length;
+
+  /// The position of the item [key] in this menu, or -1 if there is none.
+  int indexOf(String key) => _order.indexOf(key);
+
+  /// The item at [index] in this menu.
+  MenuItem elementAt(int index) => _items[_order.elementAt(index)]!;
+
+  /// The keys of the items from [start] up to, but not including, [end], in
+  /// the order they are shown. Positions are found in logarithmic time, so
+  /// sorted menus can search for where an item goes without copying [keys].
+  Iterable<String> keysInRange(int start, [int? end]) =>
+      _order.range(start, end);
+
+  Future<int> _addItem(_MenuItem item, int? before) =>
+      TrayMenuPlatform.instance.add(item, before: before);
+
+  Future<void> _moveItemHere(int handle, int? before) =>
+      TrayMenuPlatform.instance.moveMenuItem(handle, before: before);
+
+  Future<void> _reorderItems(Int64List handles) =>
+      TrayMenuPlatform.instance.reorderChildren(handles);
 
-  Future<int> _addItem(_MenuItem item, String? before) {
-    final beforeHandle = _items[before]?._handle;
-    return TrayMenuPlatform.instance.add(item, before: beforeHandle);
+  Future<void> _clearItems() => TrayMenuPlatform.instance.clearChildren();
+
+  Future<List<int>> _replaceItems(List<_MenuItem> items) =>
+      TrayMenuPlatform.instance.replaceChildren(items);
+
+  // Items added without [before] go in front of the unclaimed restored items,
+  // so the menu ends up in the order the items are added in, and a restored
+  // item that is already in place is updated without being moved.
+  Future<T> _add<T extends MenuItem>(MenuEntry entry, String? before) async {
+    if (_items.containsKey(entry.key)) {
+      throw ArgumentError('Key ${entry.key} already in use');
+    }
+    await _attaching;
+    final inPlace = before == null &&
+        _unclaimed.isNotEmpty &&
+        _unclaimed.keys.first == entry.key;
+    final native = _unclaimed.remove(entry.key);
+    final beforeHandle = _items[before]?._handle ??
+        (_unclaimed.isNotEmpty ? _unclaimed.values.first.handle : null);
+    if (native == null) {
+      final handle = await _addItem(entry._item, beforeHandle);
+      return _register(entry, handle, before) as T;
+    }
+    if (!native.matches(entry._item)) {
+      await TrayMenuPlatform.instance.remove(native.handle);
+      final handle = await _addItem(entry._item, beforeHandle);
+      return _register(entry, handle, before) as T;
+    }
+    if (native.differsFrom(entry._item)) {
+      await TrayMenuPlatform.instance.updateMenuItem(
+        native.handle,
+        entry._item,
+      );
+    }
+    if (!inPlace) await _moveItemHere(native.handle, beforeHandle);
+    final item = _register(entry, native.handle, before);
+    if (item is MenuItemRadio && native.checked) item._group.selected = item;
+    if (item is MenuItemSubmenu) item._unclaimed.addAll(native.children);
+    return item as T;
   }
 
+  // Restored items that no add claimed yet follow every other item natively,
+  // so an item added in front of one of them goes last here.
+  MenuItem _register(MenuEntry entry, int handle, [String? before]) {
+    final item = entry._create(handle);
+    _items[entry.key] = item;
+    _keysByHandle[handle] = entry.key;
+    _order.insert(entry.key, before);
+    return item;
+  }
+
+  /// Adds an item showing [label], or the text of the entry [labelId] of the
+  /// string table set with [TrayMenu.setStrings], which it follows as the
+  /// table changes until its label is set. The other add methods label their
+  /// items the same way.
+  ///
+  /// [icon] is the id of an image registered with [TrayMenu.registerIcon],
+  /// shown next to the label. Checkboxes and radio items only show icons in
+  /// hosts that read the menu over dbusmenu.
   Future<MenuItemLabel> addLabel(
     String key, {
     String? before,
-    required String label,
+    String? label,
+    String? labelId,
+    String? icon,
     bool enabled = true,
     Function(String, MenuItem)? callback,
-  }) async {
-    if (_items.containsKey(key)) throw ArgumentError('Key $key already in use');
-    final handle = await _addItem(_MenuItemLabel(label, enabled), before);
-    final item = MenuItemLabel._(handle, label, enabled, callback);
-    _items[key] = item;
-    _keysByHandle[handle] = key;
-    return item;
-  }
+  }) =>
+      _add(
+        MenuEntry.label(
+          key,
+          label: label,
+          labelId: labelId,
+          icon: icon,
+          enabled: enabled,
+          callback: callback,
+        ),
+        before,
+      );
 
-  Future<MenuItemSeparator> addSeparator(String key, {String? before}) async {
-    if (_items.containsKey(key)) throw ArgumentError('Key $key already in use');
-    final handle = await _addItem(_MenuItemSeparator(), before);
-    final item = MenuItemSeparator._(handle);
-    _items[key] = item;
-    _keysByHandle[handle] = key;
-    return item;
-  }
+  Future<MenuItemSeparator> addSeparator(String key, {String? before}) =>
+      _add(MenuEntry.separator(key), before);
 
   Future<MenuItemCheckbox> addCheckbox(
     String key, {
     String? before,
-    required String label,
+    String? label,
+    String? labelId,
+    String? icon,
     bool enabled = true,
     bool checked = false,
     Function(String, MenuItem)? callback,
-  }) async {
-    if (_items.containsKey(key)) throw ArgumentError('Key $key already in use');
-    final handle = await _addItem(
-      _MenuItemCheckbox(label, enabled, checked),
-      before,
-    );
-    final item = MenuItemCheckbox._(handle, label, enabled, checked, callback);
-    _items[key] = item;
-    _keysByHandle[handle] = key;
-    return item;
+  }) =>
+      _add(
+        MenuEntry.checkbox(
+          key,
+          label: label,
+          labelId: labelId,
+          icon: icon,
+          enabled: enabled,
+          checked: checked,
+          callback: callback,
+        ),
+        before,
+      );
+
+  /// Adds an item to the radio group named [group], which may span several
+  /// submenus of a tray. The first item added to a group is selected, as is
+  /// any added with [selected] set. Group names are shared by all trays, so
+  /// each tray needs its own.
+  Future<MenuItemRadio> addRadio(
+    String key, {
+    String? before,
+    required String group,
+    String? label,
+    String? labelId,
+    bool enabled = true,
+    bool selected = false,
+    Function(String, MenuItem)? callback,
+  }) =>
+      _add(
+        MenuEntry.radio(
+          key,
+          group: group,
+          label: label,
+          labelId: labelId,
+          enabled: enabled,
+          selected: selected,
+          callback: callback,
+        ),
+        before,
+      );
+
+  /// Selects the radio item [key] of this menu, which must belong to [group],
+  /// and deselects the rest of the group with a single native call.
+  Future<void> selectRadio(String group, String key) {
+    final item = get<MenuItemRadio>(key);
+    if (item == null || item.group != group) {
+      throw ArgumentError('No radio item $key in group $group');
+    }
+    return item.select();
   }
 
   Future<MenuItemSubmenu> addSubmenu(
     String key, {
     String? before,
-    required String label,
+    String? label,
+    String? labelId,
+    String? icon,
     bool enabled = true,
-  }) async {
-    if (_items.containsKey(key)) throw ArgumentError('Key $key already in use');
-    final handle = await _addItem(_MenuItemSubmenu(label, enabled), before);
-    var item = MenuItemSubmenu._(handle, label, enabled);
-    _items[key] = item;
-    _keysByHandle[handle] = key;
-    return item;
-  }
+  }) =>
+      _add(
+        MenuEntry.submenu(
+          key,
+          label: label,
+          labelId: labelId,
+          icon: icon,
+          enabled: enabled,
+        ),
+        before,
+      );
 
   Future<void> remove(String key) async {
-    final handle = _items.remove(key)?._handle;
-    if (handle == null) return;
-    _keysByHandle.remove(handle);
-    await TrayMenuPlatform.instance.remove(handle);
+    final item = _items.remove(key);
+    if (item == null) return;
+    _keysByHandle.remove(item._handle);
+    _order.remove(key);
+    _forget(item);
+    await TrayMenuPlatform.instance.remove(item._handle);
+  }
+
+  // Removing an item also removes everything nested under it natively, which
+  // leaves any radio group it selected without a selection.
+  static void _forget(MenuItem item) {
+    if (item is MenuItemRadio && item.selected) item._group.selected = null;
+    if (item is MenuItemSubmenu) item._items.values.forEach(_forget);
+  }
+
+  void _forgetAll() {
+    _items.values.forEach(_forget);
+    _items.clear();
+    _keysByHandle.clear();
+    _order.clear();
+    _unclaimed.clear();
+  }
+
+  // Removes the restored items that no add claimed, in this menu and in the
+  // submenus that were claimed.
+  Future<void> _removeUnclaimed() async {
+    final unclaimed = [..._unclaimed.values];
+    _unclaimed.clear();
+    for (final item in unclaimed) {
+      await TrayMenuPlatform.instance.remove(item.handle);
+    }
+    for (final submenu in _items.values.whereType<MenuItemSubmenu>()) {
+      await submenu._removeUnclaimed();
+    }
+  }
+
+  /// Removes every item of this menu, and everything nested in them, with a
+  /// single native call. This includes items other Flutter engines added.
+  Future<void> clear() async {
+    await _attaching;
+    await _clearItems();
+    _forgetAll();
+  }
+
+  /// Replaces every item of this menu, like [clear], with the items described
+  /// by [entries], all in a single native call. Returns the new items in the
+  /// order of [entries]. If the call fails, the menu is left empty.
+  Future<List<MenuItem>> replaceChildren(List<MenuEntry> entries) async {
+    final keys = <String>{};
+    for (final entry in entries) {
+      if (!keys.add(entry.key)) {
+        throw ArgumentError('Key ${entry.key} used more than once');
+      }
+    }
+    await _attaching;
+    final List<int> handles;
+    try {
+      handles = await _replaceItems([
+        for (final entry in entries) entry._item,
+      ]);
+    } finally {
+      // A failed replace leaves the menu empty natively too.
+      _forgetAll();
+    }
+    return [
+      for (var i = 0; i < entries.length; i++) _register(entries[i], handles[i]),
+    ];
+  }
+
+  /// Moves the item [key] in front of [before] in [to], which defaults to this
+  /// menu, or to its end. The item keeps its handle, state and callback, so
+  /// only the affected menus are updated. Items cannot move to another tray,
+  /// or into themselves. If the move fails natively, the menus are left as
+  /// they were.
+  Future<void> move(String key, {Menu? to, String? before}) async {
+    final target = to ?? this;
+    final item = _items[key];
+    if (item == null) throw ArgumentError('No item $key');
+    if (!identical(target, this) && target._items.containsKey(key)) {
+      throw ArgumentError('Key $key already in use');
+    }
+    if (!target._isInTray(item._handle >> TrayMenu._trayHandleShift)) {
+      throw ArgumentError('Cannot move $key to another tray');
+    }
+    if (item is MenuItemSubmenu && item._contains(target)) {
+      throw ArgumentError('Cannot move $key into itself');
+    }
+    final beforeHandle = target._items[before]?._handle;
+    final index = _order.indexOf(key);
+    final next = index + 1 < length ? _order.elementAt(index + 1) : null;
+    _transfer(key, item, target, before);
+    try {
+      await target._moveItemHere(item._handle, beforeHandle);
+    } catch (_) {
+      // Puts the item back where it was, unless it was removed meanwhile.
+      if (identical(target._items[key], item)) {
+        target._transfer(key, item, this, next);
+      }
+      rethrow;
+    }
+  }
+
+  void _transfer(String key, MenuItem item, Menu target, String? before) {
+    _order.remove(key);
+    target._order.insert(key, before);
+    if (identical(target, this)) return;
+    _items.remove(key);
+    _keysByHandle.remove(item._handle);
+    target._items[key] = item;
+    target._keysByHandle[item._handle] = key;
+  }
+
+  // Whether this menu is in the tray [tray] natively, where items cannot
+  // move between trays.
+  bool _isInTray(int tray);
+
+  // Whether [menu] is this menu or nested in it.
+  bool _contains(Menu menu) =>
+      identical(menu, this) ||
+      _items.values.whereType<MenuItemSubmenu>().any((s) => s._contains(menu));
+
+  /// Moves the items [keys] to the front of this menu in that order, with a
+  /// single native call. The remaining items keep their order after them.
+  Future<void> reorder(List<String> keys) async {
+    final handles = Int64List(keys.length);
+    final seen = <String>{};
+    for (var i = 0; i < keys.length; i++) {
+      final item = _items[keys[i]];
+      if (item == null) throw ArgumentError('No item ${keys[i]}');
+      if (!seen.add(keys[i])) {
+        throw ArgumentError('Key ${keys[i]} used more than once');
+      }
+      handles[i] = item._handle;
+    }
+    // Applied before the native call, like the rest of the bookkeeping, so
+    // that calls made while it is underway see the new order.
+    _order.moveToFront(keys);
+    await _reorderItems(handles);
   }
 
   T? get<T extends MenuItem>(String key) {
@@ -95,26 +375,627 @@ mixin Menu {
     }
     return null;
   }
+
+  // Drops the item [handle] without a native call, for adds that reported
+  // success but then failed natively, so its key can be added again.
+  (String, MenuItem)? _forgetByHandle(int handle) {
+    final key = _keysByHandle.remove(handle);
+    if (key != null) {
+      final item = _items.remove(key)!;
+      _order.remove(key);
+      _forget(item);
+      return (key, item);
+    }
+    for (final submenu in _items.values.whereType<MenuItemSubmenu>()) {
+      final item = submenu._forgetByHandle(handle);
+      if (item != null) return item;
+    }
+    return null;
+  }
+}
+
+/// Whether the tray icon has been registered with the desktop.
+enum TrayStatus {
+  /// [TrayMenu.show] has not been called, or registration is still underway.
+  pending,
+
+  /// The icon is registered with a StatusNotifierWatcher.
+  ready,
+
+  /// No StatusNotifierWatcher answered, so the icon fell back to a legacy
+  /// system tray, if the desktop has one.
+  unavailable,
+}
+
+/// The items of each type in part of a tray's menu, and the native memory they
+/// take up.
+class MemoryUsage {
+  MemoryUsage._fromMap(Map<Object?, Object?> map)
+      : items = {
+          for (final MapEntry(:key, :value)
+              in (map['items'] as Map<Object?, Object?>).entries)
+            if (_types[key] case final type?) type: value as int,
+        },
+        modelBytes = map['modelBytes'] as int,
+        stringBytes = map['stringBytes'] as int,
+        objectBytes = map['objectBytes'] as int,
+        signalHandlers = map['signalHandlers'] as int;
+
+  static const _types = {
+    '_MenuItemLabel': MenuItemLabel,
+    '_MenuItemSeparator': MenuItemSeparator,
+    '_MenuItemCheckbox': MenuItemCheckbox,
+    '_MenuItemSubmenu': MenuItemSubmenu,
+    '_MenuItemRadio': MenuItemRadio,
+  };
+
+  /// The number of items of each type, such as [MenuItemLabel].
+  final Map<Type, int> items;
+
+  /// The native bookkeeping of the items.
+  final int modelBytes;
+
+  /// Their keys and labels, apart from texts they share with other items,
+  /// such as the entries of the string table.
+  final int stringBytes;
+
+  /// Their GTK widgets and other GObjects, estimated from the instance size
+  /// of their types.
+  final int objectBytes;
+
+  /// The signal handlers connected to their GObjects.
+  final int signalHandlers;
+
+  int get itemCount => items.values.fold(0, (sum, count) => sum + count);
+
+  int get totalBytes => modelBytes + stringBytes + objectBytes;
+}
+
+/// The native memory taken up by a tray's menu, as reported by
+/// [TrayMenu.getMemoryReport].
+class MemoryReport {
+  MemoryReport._(
+    this.total,
+    this.items,
+    this.submenus,
+    this.stringTableBytes,
+    this.liveObjects,
+    this.liveObjectBytes,
+    this.iconBytes,
+    this.iconDecodes,
+  );
+
+  /// The whole menu, including items other Flutter engines added and what
+  /// the tray takes up apart from its items.
+  final MemoryUsage total;
+
+  /// Each item this menu knows of on its own, without the items nested in it.
+  final Map<MenuItem, MemoryUsage> items;
+
+  /// Each submenu along with every item nested in it.
+  final Map<MenuItemSubmenu, MemoryUsage> submenus;
+
+  /// The string table set with [TrayMenu.setStrings], shared by every tray.
+  final int stringTableBytes;
+
+  /// The GObjects the plugin created that are still alive across every tray,
+  /// and their instance sizes.
+  final int liveObjects;
+  final int liveObjectBytes;
+
+  /// The images registered with [TrayMenu.registerIcon] and the decoded ones
+  /// still cached, shared by every tray.
+  final int iconBytes;
+
+  /// How many times an image was decoded, including again after it was
+  /// dropped from the cache.
+  final int iconDecodes;
+}
+
+/// What a [TrayEvent] reports.
+enum TrayEventType {
+  /// An item was clicked.
+  activated,
+
+  /// The menu, or a submenu, was shown.
+  opened,
+
+  /// The menu, or a submenu, was hidden.
+  closed,
+
+  /// The icon was registered with a StatusNotifierWatcher.
+  ready,
+
+  /// The icon fell back to a legacy system tray, or lost its host.
+  unavailable,
+
+  /// A change made through the FFI fast path off the native main thread
+  /// reported success, but failed once the main loop applied it. An item
+  /// whose add failed is dropped from its menu.
+  failed,
+}
+
+/// Something that happened to a tray natively, as delivered by
+/// [TrayMenu.events].
+class TrayEvent {
+  const TrayEvent._(
+    this.sequence,
+    this.type,
+    this.tray,
+    this.key,
+    this.item,
+    this.checked,
+    this.operation,
+    this.time,
+    this.sent,
+    this.received,
+  );
+
+  /// Counts up by one with every event this Flutter engine receives. A gap
+  /// means events were dropped while nothing listened natively, or went to
+  /// [TrayMenu.stalls] instead.
+  final int sequence;
+
+  final TrayEventType type;
+
+  final TrayMenu tray;
+
+  /// The item clicked, or the submenu shown or hidden, if the tray knows it.
+  /// Both are null for the whole menu and for items other engines added.
+  final String? key;
+  final MenuItem? item;
+
+  /// Whether a checkbox or radio item is checked after the click.
+  final bool? checked;
+
+  /// The method channel call equivalent to the change that failed, such as
+  /// `addMenuItem`, for [TrayEventType.failed].
+  final String? operation;
+
+  /// When the event happened natively, when its batch was sent to Dart and
+  /// when Dart received it, in microseconds of the same monotonic clock as
+  /// [Timeline.now].
+  final int time;
+  final int sent;
+  final int received;
+
+  /// How long the event took to reach Dart, including the time it waited for
+  /// the rest of its batch.
+  Duration get latency => Duration(microseconds: received - time);
+
+  @override
+  String toString() => 'TrayEvent($sequence, ${type.name}, ${key ?? '-'})';
+}
+
+/// An operation of the plugin that blocked the native main loop for longer
+/// than the threshold set with [TrayMenu.setStallThreshold], or a stall of
+/// the main loop itself, as delivered by [TrayMenu.stalls].
+class TrayStall {
+  const TrayStall._(
+    this.operation,
+    this.tray,
+    this.key,
+    this.item,
+    this.duration,
+    this.argumentBytes,
+    this.items,
+    this.depth,
+    this.time,
+  );
+
+  /// The method called on the platform channel, or `activate` for a click,
+  /// or null if the main loop stalled, whatever blocked it. Stalls caused by
+  /// a slow operation are reported along with it.
+  final String? operation;
+
+  /// The tray the operation acted on, if it was one of this engine's.
+  final TrayMenu? tray;
+
+  /// The item clicked, if the tray knows it.
+  final String? key;
+  final MenuItem? item;
+
+  final Duration duration;
+
+  /// The size of the operation's arguments as sent over the platform
+  /// channel, and the number of items of its tray and how deeply they are
+  /// nested when it finished. All three are 0 for stalls of the main loop.
+  final int argumentBytes;
+  final int items;
+  final int depth;
+
+  /// When the operation finished, or the stall was noticed, in microseconds
+  /// of the same monotonic clock as [Timeline.now].
+  final int time;
+
+  @override
+  String toString() =>
+      'TrayStall(${operation ?? 'main loop'}, ${duration.inMicroseconds} us)';
 }
 
 class TrayMenu with Menu {
-  TrayMenu._() {
-    TrayMenuPlatform.instance.init();
+  TrayMenu._([String? id]) {
+    if (id == null) _trays[0] = this;
+    // Listens before init, so no event of the tray is dropped natively.
+    _eventSubscription ??= TrayMenuPlatform.instance.events.listen(
+      _handleEvents,
+      onError: _handleEventError,
+    );
     TrayMenuPlatform.instance.setCallbackHandler(_handleCallbacks);
+    _index = TrayMenuPlatform.instance
+        .init(id: id, reattach: reattach)
+        .then((index) {
+      _tray = index;
+      _trays[index] = this;
+      return index;
+    });
+    _attaching = _index.then((_) => _attach());
   }
 
+  /// The default tray.
   static final instance = TrayMenu._();
 
-  Future<void> show(String iconPath) =>
-      TrayMenuPlatform.instance.show(iconPath);
+  /// Whether trays created from then on take over the items and icon this
+  /// Flutter engine left natively, such as before a hot restart, instead of
+  /// clearing them. Set it before using [instance] or [create].
+  ///
+  /// The adds that follow reuse the items with the same keys and only send
+  /// what changed, and the icon stays up throughout. [commit] removes the
+  /// items that weren't added again. Only supported on Linux.
+  static bool reattach = false;
+
+  /// Returns the tray identified by [id], creating it on first use. Every tray
+  /// has its own icon, menu and item handles, independent of [instance] and of
+  /// each other. Only supported on Linux.
+  factory TrayMenu.create(String id) =>
+      _traysById[id] ??= TrayMenu._(id);
+
+  // Mirrors the native side, where a handle's upper bits name its tray.
+  static const _trayHandleShift = 32;
+  static final Map<int, TrayMenu> _trays = {};
+  static final Map<String, TrayMenu> _traysById = {};
+
+  static StreamSubscription<Object?>? _eventSubscription;
+  static final _events = StreamController<List<TrayEvent>>.broadcast();
+
+  /// What happens natively to every tray, such as clicks and the menu showing
+  /// and hiding, in batches of the events sent together. Only reported on
+  /// Linux, where events are sent at most once per iteration of the native
+  /// main loop, after the callbacks, selection and status changes they cause
+  /// have been applied.
+  static Stream<List<TrayEvent>> get events => _events.stream;
+
+  static final _stalls = StreamController<TrayStall>.broadcast();
+
+  /// The operations that blocked the native main loop for longer than the
+  /// threshold set with [setStallThreshold], and the stalls of the main loop
+  /// however they were caused. They arrive along with [events], so only
+  /// while those are listened to.
+  static Stream<TrayStall> get stalls => _stalls.stream;
+
+  /// Turns on the native watchdog, which times every platform channel call
+  /// and click against [threshold] and checks that the main loop keeps up,
+  /// or turns it off if [threshold] is null. Whatever takes longer is logged
+  /// natively and reported on [stalls]. The main loop is checked twice per
+  /// [threshold], which wakes it up that often. Only supported on Linux.
+  static Future<void> setStallThreshold(Duration? threshold) =>
+      TrayMenuPlatform.instance.setStallThreshold(threshold);
 
+  // The index the native side gave the tray, shared by every Flutter engine
+  // using the same id. Only known once init returns, which calls addressing
+  // the tray wait for, except for the default tray, which is always 0.
+  int _tray = 0;
+  late final Future<int> _index;
+
+  final _status = ValueNotifier(TrayStatus.pending);
+
+  /// The registration status of the tray icon. Only reported on Linux, where
+  /// [show] returns before the icon is registered.
+  ValueListenable<TrayStatus> get status => _status;
+
+  Future<void> show(String iconPath) async =>
+      TrayMenuPlatform.instance.show(iconPath, tray: await _index);
+
+  /// Shows [label] next to the icon, as wide as [guide] at most so the panel
+  /// doesn't shift as the label changes. An empty label removes it.
+  ///
+  /// The label changes at most [setTextRate] times a second, to the label set
+  /// last, so it can be set as often as needed without flooding the session
+  /// bus. Only supported on Linux, by hosts that show labels.
+  Future<void> setLabel(String label, {String? guide}) async =>
+      TrayMenuPlatform.instance.setTrayLabel(
+        label,
+        guide: guide,
+        tray: await _index,
+      );
+
+  /// Sets the name the desktop gives the icon, such as to screen readers,
+  /// rate-limited like [setLabel]. An empty title falls back to the id of the
+  /// tray. Only supported on Linux.
+  Future<void> setTitle(String title) async =>
+      TrayMenuPlatform.instance.setTrayTitle(title, tray: await _index);
+
+  /// Sets how many times a second [setLabel] and [setTitle] change the text at
+  /// most, 4 by default. Zero lets every change through. Only supported on
+  /// Linux.
+  Future<void> setTextRate(double hz) async =>
+      TrayMenuPlatform.instance.setTrayTextRate(hz, tray: await _index);
+
+  // Takes over the items of the menu the plugin restored from the snapshot
+  // saved by the last commit, or kept for [reattach], for the adds that follow
+  // to claim, and the status of the icon if it is still shown.
+  Future<void> _attach() async {
+    final manifest = await TrayMenuPlatform.instance.getManifest(tray: _tray);
+    _status.value = switch (manifest['status']) {
+      'trayReady' => TrayStatus.ready,
+      'trayUnavailable' => TrayStatus.unavailable,
+      _ => _status.value,
+    };
+    final items = manifest['items'] as List<Object?>? ?? const [];
+    final byHandle = <int, _NativeItem>{};
+    for (final map in items.cast<Map<Object?, Object?>>()) {
+      final item = _NativeItem.fromMap(map);
+      final parent = map['parent'] as int?;
+      final siblings = parent == null ? _unclaimed : byHandle[parent]!.children;
+      siblings[map['key'] as String] = item;
+      byHandle[item.handle] = item;
+    }
+  }
+
+  /// Marks the menu as complete, and unless [snapshot] is false saves it
+  /// natively so that the next launch shows it, with the icon last shown, as
+  /// soon as the plugin is registered, before any Dart code runs. Only
+  /// supported on Linux.
+  ///
+  /// Items of the restored menu are reused by the adds with the same keys,
+  /// which only update what changed. Restored items not added again by the
+  /// time of the commit are removed, as are the items kept for [reattach].
+  /// Activations of restored items before the tray is created in Dart are
+  /// dropped.
+  Future<void> commit({bool snapshot = true}) async {
+    await _attaching;
+    await _removeUnclaimed();
+    if (snapshot) await TrayMenuPlatform.instance.commit(tray: _tray);
+  }
+
+  /// Deletes the snapshot saved by [commit], so the next launch starts with
+  /// an empty tray again.
+  Future<void> discardSnapshot() async =>
+      TrayMenuPlatform.instance.discardSnapshot(tray: await _index);
+
+  /// Reports the native memory taken up by this tray's menu, in total and by
+  /// item and submenu. Visits every item, so it is meant for diagnostics
+  /// rather than frequent polling. Only supported on Linux.
+  Future<MemoryReport> getMemoryReport() async {
+    final report =
+        await TrayMenuPlatform.instance.getMemoryReport(tray: await _index);
+    final items = <MenuItem, MemoryUsage>{};
+    final submenus = <MenuItemSubmenu, MemoryUsage>{};
+    for (final entry in report['items'] as List<Object?>) {
+      entry as Map<Object?, Object?>;
+      final item = _getByHandle(entry['handle'] as int)?.$2;
+      if (item == null) continue;
+      items[item] = MemoryUsage._fromMap(entry['own'] as Map<Object?, Object?>);
+      if (item is MenuItemSubmenu) {
+        submenus[item] =
+            MemoryUsage._fromMap(entry['subtree'] as Map<Object?, Object?>);
+      }
+    }
+    return MemoryReport._(
+      MemoryUsage._fromMap(report['total'] as Map<Object?, Object?>),
+      items,
+      submenus,
+      report['stringTableBytes'] as int,
+      report['liveObjects'] as int,
+      report['liveObjectBytes'] as int,
+      report['iconBytes'] as int,
+      report['iconDecodes'] as int,
+    );
+  }
+
+  /// Sets the text of entries of the string table shared by every tray, by
+  /// id. Every label bound to a changed entry is updated in the same native
+  /// call, so switching the language of a whole menu takes one call however
+  /// many items it has, and bound items only send the id of their label.
+  static Future<void> setStrings(Map<String, String> strings) async {
+    final texts = {
+      for (final MapEntry(:key, :value) in strings.entries)
+        _Strings.id(key)!: value,
+    };
+    await TrayMenuPlatform.instance.setStrings(texts);
+    _Strings.texts.addAll(texts);
+  }
+
+  /// Makes entries of the string table, by id, render their text natively
+  /// from a template, until [setStrings] sets them again. Templates show named
+  /// clocks and counters: `{elapsed:name}` is the time since [startClock]
+  /// started the clock name, as in "3h 12m", and `{count:name}` the value of
+  /// the counter name, with grouped digits. `{{` and `}}` stand for braces.
+  ///
+  /// Labels are only rendered again while the menu is visible, so clocks and
+  /// counters can change as often as needed without waking up Dart or the
+  /// desktop. Bound items report their rendered text through
+  /// [MenuItemLabel.getLabel] only. Only supported on Linux.
+  static Future<void> setLabelTemplates(Map<String, String> templates) async {
+    final ids = {
+      for (final MapEntry(:key, :value) in templates.entries)
+        _Strings.id(key)!: value,
+    };
+    await TrayMenuPlatform.instance.setLabelTemplates(ids);
+    for (final id in ids.keys) {
+      _Strings.texts.remove(id);
+    }
+  }
+
+  /// Registers the image [bytes], in any format the platform decodes, as the
+  /// icon [id] items can show. It is decoded once when an item first shows
+  /// it and shared by every item showing it. Registering another image under
+  /// the same id only changes the items whose icon is set after that. Only
+  /// supported on Linux.
+  static Future<void> registerIcon(String id, Uint8List bytes) =>
+      TrayMenuPlatform.instance.registerIcon(id, bytes: bytes);
+
+  /// Registers the image in the file at [path] as the icon [id], like
+  /// [registerIcon]. The file is read when the image is decoded.
+  static Future<void> registerIconFile(String id, String path) =>
+      TrayMenuPlatform.instance.registerIcon(id, path: path);
+
+  /// Forgets the image registered as [id]. Items showing it keep it until
+  /// their icon is set again.
+  static Future<void> unregisterIcon(String id) =>
+      TrayMenuPlatform.instance.registerIcon(id);
+
+  /// Sets how many decoded images are kept for items shown later, 64 by
+  /// default. The one used least recently is dropped first, and decoded again
+  /// when it is shown after that.
+  static Future<void> setIconCacheCapacity(int capacity) =>
+      TrayMenuPlatform.instance.setIconCacheCapacity(capacity);
+
+  /// Sets the counter [name] shown by label templates.
+  static Future<void> setCounter(String name, int value) =>
+      TrayMenuPlatform.instance.setCounter(name, value);
+
+  /// Adds [by] to the counter [name] shown by label templates.
+  static Future<void> incrementCounter(String name, [int by = 1]) =>
+      TrayMenuPlatform.instance.addToCounter(name, by);
+
+  /// Starts the clock [name] shown by label templates, or restarts it, as if
+  /// it had been started [elapsed] ago.
+  static Future<void> startClock(
+    String name, {
+    Duration elapsed = Duration.zero,
+  }) =>
+      TrayMenuPlatform.instance.startClock(name, elapsed);
+
+  @override
+  Future<int> _addItem(_MenuItem item, int? before) =>
+      TrayMenuPlatform.instance.add(item, tray: _tray, before: before);
+
+  @override
+  bool _isInTray(int tray) => identical(_trays[tray], this);
+
+  @override
+  Future<void> _moveItemHere(int handle, int? before) =>
+      TrayMenuPlatform.instance.moveMenuItem(
+        handle,
+        tray: _tray,
+        before: before,
+      );
+
+  @override
+  Future<void> _clearItems() =>
+      TrayMenuPlatform.instance.clearChildren(tray: _tray);
+
+  @override
+  Future<List<int>> _replaceItems(List<_MenuItem> items) =>
+      TrayMenuPlatform.instance.replaceChildren(items, tray: _tray);
+
+  // Only Linux has the event channel; elsewhere, events arrive through
+  // [_handleCallbacks] instead.
+  static void _handleEventError(Object error, StackTrace stack) {
+    if (error is MissingPluginException) return;
+    FlutterError.reportError(FlutterErrorDetails(
+      exception: error,
+      stack: stack,
+      library: 'tray_menu',
+    ));
+  }
+
+  // How platforms without the event channel report clicks and status
+  // changes, one method call each. They are not published on [events].
   static Future<void> _handleCallbacks(MethodCall methodCall) async {
-    if (methodCall.method == 'itemCallback') {
-      final handle = methodCall.arguments as int;
-      final pair = instance._getByHandle(handle);
-      if (pair == null) return;
-      final (key, item) = pair;
-      item.callback?.call(key, item);
+    switch (methodCall.method) {
+      case 'itemCallback':
+        final handle = methodCall.arguments as int;
+        final tray = _trays[handle >> _trayHandleShift];
+        final pair = tray?._getByHandle(handle);
+        if (pair == null) return;
+        final (key, item) = pair;
+        if (item is MenuItemRadio) item._group.selected = item;
+        item.callback?.call(key, item);
+      case 'trayReady':
+        _trays[methodCall.arguments as int? ?? 0]?._status.value =
+            TrayStatus.ready;
+      case 'trayUnavailable':
+        _trays[methodCall.arguments as int? ?? 0]?._status.value =
+            TrayStatus.unavailable;
+    }
+  }
+
+  // Applies a whole batch in one pass, and only then hands it to [events].
+  static void _handleEvents(Object? message) {
+    final received = Timeline.now;
+    final batch = message as Map<Object?, Object?>;
+    final sequence = batch['sequence'] as int;
+    final sent = batch['sent'] as int;
+    final maps = batch['events'] as List<Object?>;
+    final events = <TrayEvent>[];
+    for (final (index, map) in maps.cast<Map<Object?, Object?>>().indexed) {
+      final tray = _trays[map['tray'] as int];
+      if (map['type'] case 'slowOperation' || 'stall') {
+        _stalls.add(_stallFromMap(map, tray));
+        continue;
+      }
+      final type = switch (map['type']) {
+        'activated' => TrayEventType.activated,
+        'opened' => TrayEventType.opened,
+        'closed' => TrayEventType.closed,
+        'trayReady' => TrayEventType.ready,
+        'trayUnavailable' => TrayEventType.unavailable,
+        'operationFailed' => TrayEventType.failed,
+        _ => null,
+      };
+      if (tray == null || type == null) continue;
+      final handle = map['handle'] as int?;
+      final operation = map['operation'] as String?;
+      final pair = handle == null
+          ? null
+          : operation == 'addMenuItem'
+              ? tray._forgetByHandle(handle)
+              : tray._getByHandle(handle);
+      switch (type) {
+        case TrayEventType.activated:
+          if (pair case (final key, final item)?) {
+            if (item is MenuItemRadio) item._group.selected = item;
+            item.callback?.call(key, item);
+          }
+        case TrayEventType.ready:
+          tray._status.value = TrayStatus.ready;
+        case TrayEventType.unavailable:
+          tray._status.value = TrayStatus.unavailable;
+        case TrayEventType.opened ||
+              TrayEventType.closed ||
+              TrayEventType.failed:
+      }
+      events.add(TrayEvent._(
+        sequence + index,
+        type,
+        tray,
+        pair?.$1,
+        pair?.$2,
+        map['checked'] as bool?,
+        operation,
+        map['time'] as int,
+        sent,
+        received,
+      ));
     }
+    if (events.isNotEmpty) _events.add(events);
+  }
+
+  static TrayStall _stallFromMap(Map<Object?, Object?> map, TrayMenu? tray) {
+    final handle = map['handle'] as int?;
+    final pair = handle != null ? tray?._getByHandle(handle) : null;
+    return TrayStall._(
+      map['operation'] as String?,
+      tray,
+      pair?.$1,
+      pair?.$2,
+      Duration(microseconds: map['duration'] as int),
+      map['argsBytes'] as int? ?? 0,
+      map['items'] as int? ?? 0,
+      map['depth'] as int? ?? 0,
+      map['time'] as int,
+    );
   }
 }
@@ -0,0 +1,488 @@
+part of 'tray_menu.dart';
+
+typedef _AddItemNative = Int64 Function(
+  Int64 engine,
+  Int64 tray,
+  Int32 type,
+  Pointer<Uint8> label,
+  IntPtr labelLength,
+  Pointer<Uint8> key,
+  IntPtr keyLength,
+  Int32 enabled,
+  Int32 checked,
+  Int64 group,
+  Int64 stringId,
+  Int64 submenu,
+  Int64 before,
+);
+typedef _AddItem = int Function(
+  int,
+  int,
+  int,
+  Pointer<Uint8>,
+  int,
+  Pointer<Uint8>,
+  int,
+  int,
+  int,
+  int,
+  int,
+  int,
+  int,
+);
+typedef _HandleNative = Int32 Function(Int64 handle);
+typedef _Handle = int Function(int);
+typedef _SetStringNative = Int32 Function(
+  Int64 handle,
+  Pointer<Uint8> value,
+  IntPtr length,
+);
+typedef _SetString = int Function(int, Pointer<Uint8>, int);
+typedef _SetBoolNative = Int32 Function(Int64 handle, Int32 value);
+typedef _SetBool = int Function(int, int);
+typedef _SelectRadioNative = Int32 Function(Int64 group, Int64 handle);
+typedef _SelectRadio = int Function(int, int);
+typedef _ClearChildrenNative = Int32 Function(Int64 tray, Int64 submenu);
+typedef _ClearChildren = int Function(int, int);
+typedef _MoveItemNative = Int32 Function(
+  Int64 handle,
+  Int64 tray,
+  Int64 submenu,
+  Int64 before,
+);
+typedef _MoveItem = int Function(int, int, int, int);
+typedef _ReorderChildrenNative = Int32 Function(
+  Int64 submenu,
+  Pointer<Int64> handles,
+  IntPtr count,
+);
+typedef _ReorderChildren = int Function(int, Pointer<Int64>, int);
+typedef _SetStringsNative = Int32 Function(
+  Pointer<Int64> ids,
+  Pointer<Uint8> texts,
+  Pointer<IntPtr> lengths,
+  IntPtr count,
+);
+typedef _SetStrings = int Function(
+  Pointer<Int64>,
+  Pointer<Uint8>,
+  Pointer<IntPtr>,
+  int,
+);
+typedef _SetCounterNative = Int32 Function(
+  Pointer<Uint8> name,
+  IntPtr nameLength,
+  Int64 value,
+);
+typedef _SetCounter = int Function(Pointer<Uint8>, int, int);
+
+// The C ABI exported by the native plugin library, bound once per isolate.
+class _NativeTrayMenu {
+  _NativeTrayMenu._(DynamicLibrary library)
+      : addItem = library.lookupFunction<_AddItemNative, _AddItem>(
+          'tray_menu_add_item',
+        ),
+        removeItem = library.lookupFunction<_HandleNative, _Handle>(
+          'tray_menu_remove_item',
+        ),
+        clearChildren =
+            library.lookupFunction<_ClearChildrenNative, _ClearChildren>(
+          'tray_menu_clear_children',
+        ),
+        moveItem = library.lookupFunction<_MoveItemNative, _MoveItem>(
+          'tray_menu_move_item',
+        ),
+        reorderChildren =
+            library.lookupFunction<_ReorderChildrenNative, _ReorderChildren>(
+          'tray_menu_reorder_children',
+        ),
+        setLabel = library.lookupFunction<_SetStringNative, _SetString>(
+          'tray_menu_set_label',
+        ),
+        setEnabled = library.lookupFunction<_SetBoolNative, _SetBool>(
+          'tray_menu_set_enabled',
+        ),
+        setChecked = library.lookupFunction<_SetBoolNative, _SetBool>(
+          'tray_menu_set_checked',
+        ),
+        selectRadio = library.lookupFunction<_SelectRadioNative, _SelectRadio>(
+          'tray_menu_select_radio',
+        ),
+        setStrings = library.lookupFunction<_SetStringsNative, _SetStrings>(
+          'tray_menu_set_strings',
+        ),
+        setCounter = library.lookupFunction<_SetCounterNative, _SetCounter>(
+          'tray_menu_set_counter',
+        ),
+        addToCounter = library.lookupFunction<_SetCounterNative, _SetCounter>(
+          'tray_menu_add_to_counter',
+        );
+
+  /// Returns null if the current platform's plugin library does not provide
+  /// the C ABI.
+  static _NativeTrayMenu? tryOpen() {
+    if (!Platform.isLinux) return null;
+    try {
+      return _NativeTrayMenu._(DynamicLibrary.open('libtray_menu_plugin.so'));
+    } on ArgumentError {
+      return null;
+    }
+  }
+
+  final _AddItem addItem;
+  final _Handle removeItem;
+  final _ClearChildren clearChildren;
+  final _MoveItem moveItem;
+  final _ReorderChildren reorderChildren;
+  final _SetString setLabel;
+  final _SetBool setEnabled;
+  final _SetBool setChecked;
+  final _SelectRadio selectRadio;
+  final _SetStrings setStrings;
+  final _SetCounter setCounter;
+  final _SetCounter addToCounter;
+
+  // Reused for every string argument, so steady-state updates don't allocate.
+  Pointer<Uint8> buffer = nullptr;
+  int _bufferCapacity = 0;
+
+  /// Copies [value] into [buffer] at [offset] as UTF-8, keeping the bytes
+  /// before it, and returns its length in bytes.
+  int encode(String value, [int offset = 0]) {
+    final bytes = utf8.encode(value);
+    final end = offset + bytes.length;
+    if (end > _bufferCapacity) {
+      final grown = malloc<Uint8>(end * 2);
+      if (buffer != nullptr) {
+        if (offset > 0) {
+          grown.asTypedList(offset).setAll(0, buffer.asTypedList(offset));
+        }
+        malloc.free(buffer);
+      }
+      _bufferCapacity = end * 2;
+      buffer = grown;
+    }
+    if (bytes.isNotEmpty) buffer.asTypedList(end).setAll(offset, bytes);
+    return bytes.length;
+  }
+}
+
+/// An implementation of [TrayMenuPlatform] that applies the hot menu
+/// operations synchronously through the C ABI exported by the native plugin
+/// library, and uses [MethodChannelTrayMenu] for everything else.
+class FfiTrayMenu extends MethodChannelTrayMenu {
+  FfiTrayMenu._(this._native);
+
+  /// Binds the exported C ABI, or returns null if the current platform's
+  /// plugin library does not provide it.
+  static FfiTrayMenu? tryCreate() {
+    final native = _NativeTrayMenu.tryOpen();
+    return native != null ? FfiTrayMenu._(native) : null;
+  }
+
+  final _NativeTrayMenu _native;
+
+  static Future<void> _check(int success) => success != 0
+      ? SynchronousFuture<void>(null)
+      : Future.error(PlatformException(code: 'Invalid handle'));
+
+  // The id the native side gave this engine, so that the items it adds are
+  // cleaned up with it and their activations are reported back to it.
+  int _engine = 0;
+
+  // init still goes through the method channel and resets the tray's items,
+  // so top-level items added synchronously before it has been handled would
+  // be wiped by it. Such adds wait for the pending init instead. Trays
+  // created by id only learn their index from init, so nothing can be added
+  // to them before it returns anyway.
+  final _pendingInits = <int, Future<void>>{};
+
+  @override
+  Future<int> init({String? id, bool reattach = false}) {
+    late final Future<int> pending;
+    pending = methodChannel
+        .invokeMethod<Map<Object?, Object?>>(
+          'init',
+          MethodChannelTrayMenu._initArguments(id, reattach),
+        )
+        .then((result) {
+      _engine = result!['engine'] as int;
+      return MethodChannelTrayMenu._trayIndex(result);
+    }).whenComplete(() {
+      if (identical(_pendingInits[0], pending)) _pendingInits.remove(0);
+    });
+    if (id == null) _pendingInits[0] = pending;
+    return pending;
+  }
+
+  // The init that changes to the top level of tray have to wait for, if one
+  // is still in flight. Submenus only exist once their tray has been reset.
+  Future<void>? _pendingInit(int tray, int? submenu) =>
+      submenu == null ? _pendingInits[tray] : null;
+
+  // The C entry points take no icons, so items showing one go through the
+  // method channel instead.
+  static bool _hasIcon(_MenuItem item) =>
+      item is _MenuItemLabel && item.icon != null;
+
+  @override
+  Future<int> add(_MenuItem item, {int tray = 0, int? submenu, int? before}) {
+    if (_hasIcon(item)) {
+      return super.add(item, tray: tray, submenu: submenu, before: before);
+    }
+    final pending = _pendingInit(tray, submenu);
+    if (pending != null) {
+      return pending.then(
+        (_) => add(item, tray: tray, submenu: submenu, before: before),
+      );
+    }
+    final handle = _addNow(item, tray, submenu ?? -1, before ?? -1);
+    return handle >= 0
+        ? SynchronousFuture<int>(handle)
+        : Future.error(PlatformException(code: 'Invalid handle'));
+  }
+
+  // Returns the new item's handle, or -1 if submenu or before are invalid.
+  int _addNow(_MenuItem item, int tray, int submenu, int before) {
+    final (type, label, enabled, checked, group) = switch (item) {
+      _MenuItemSeparator() => (1, '', true, false, -1),
+      _MenuItemRadio(
+        :final label,
+        :final enabled,
+        :final checked,
+        :final group,
+      ) =>
+        (4, label, enabled, checked, group),
+      _MenuItemCheckbox(:final label, :final enabled, :final checked) => (
+          2,
+          label,
+          enabled,
+          checked,
+          -1
+        ),
+      _MenuItemSubmenu(:final label, :final enabled) => (
+          3,
+          label,
+          enabled,
+          false,
+          -1
+        ),
+      _MenuItemLabel(:final label, :final enabled) => (
+          0,
+          label,
+          enabled,
+          false,
+          -1
+        ),
+      _ => throw ArgumentError.value(item, 'item', 'Unsupported menu item'),
+    };
+    final stringId = item is _MenuItemLabel ? item.stringId : null;
+    // The key follows the label in the buffer.
+    final length = stringId == null ? _native.encode(label) : 0;
+    final keyLength = _native.encode(item.key, length);
+    return _native.addItem(
+      _engine,
+      tray,
+      type,
+      _native.buffer,
+      length,
+      _native.buffer.elementAt(length),
+      keyLength,
+      enabled ? 1 : 0,
+      checked ? 1 : 0,
+      group,
+      stringId ?? -1,
+      submenu,
+      before,
+    );
+  }
+
+  @override
+  Future<void> clearChildren({int tray = 0, int? submenu}) {
+    final pending = _pendingInit(tray, submenu);
+    if (pending != null) {
+      return pending.then((_) => clearChildren(tray: tray, submenu: submenu));
+    }
+    return _check(_native.clearChildren(tray, submenu ?? -1));
+  }
+
+  // Applied as a clear followed by the adds, which the native side handles
+  // within one main loop iteration, so the menu still changes in one layout
+  // update without a round trip.
+  @override
+  Future<List<int>> replaceChildren(
+    List<_MenuItem> items, {
+    int tray = 0,
+    int? submenu,
+  }) {
+    if (items.any(_hasIcon)) {
+      return super.replaceChildren(items, tray: tray, submenu: submenu);
+    }
+    final pending = _pendingInit(tray, submenu);
+    if (pending != null) {
+      return pending.then(
+        (_) => replaceChildren(items, tray: tray, submenu: submenu),
+      );
+    }
+    if (_native.clearChildren(tray, submenu ?? -1) == 0) {
+      return Future.error(PlatformException(code: 'Invalid handle'));
+    }
+    final handles = Int64List(items.length);
+    for (var i = 0; i < items.length; i++) {
+      handles[i] = _addNow(items[i], tray, submenu ?? -1, -1);
+      if (handles[i] < 0) {
+        // Leaves the menu empty rather than half built, as the native
+        // replaceChildren does.
+        _native.clearChildren(tray, submenu ?? -1);
+        return Future.error(PlatformException(code: 'Invalid handle'));
+      }
+    }
+    return SynchronousFuture<List<int>>(handles);
+  }
+
+  @override
+  Future<void> remove(int handle) => _check(_native.removeItem(handle));
+
+  @override
+  Future<void> moveMenuItem(
+    int handle, {
+    int tray = 0,
+    int? submenu,
+    int? before,
+  }) {
+    final pending = _pendingInit(tray, submenu);
+    if (pending != null) {
+      return pending.then(
+        (_) => moveMenuItem(
+          handle,
+          tray: tray,
+          submenu: submenu,
+          before: before,
+        ),
+      );
+    }
+    return _check(_native.moveItem(handle, tray, submenu ?? -1, before ?? -1));
+  }
+
+  @override
+  Future<void> reorderChildren(Int64List handles, {int? submenu}) {
+    if (handles.isEmpty) return SynchronousFuture<void>(null);
+    final buffer = malloc<Int64>(handles.length);
+    try {
+      buffer.asTypedList(handles.length).setAll(0, handles);
+      return _check(
+        _native.reorderChildren(submenu ?? -1, buffer, handles.length),
+      );
+    } finally {
+      malloc.free(buffer);
+    }
+  }
+
+  @override
+  Future<void> setMenuItemLabel(int handle, String label) {
+    final length = _native.encode(label);
+    return _check(_native.setLabel(handle, _native.buffer, length));
+  }
+
+  @override
+  Future<void> setMenuItemEnabled(int handle, bool enabled) =>
+      _check(_native.setEnabled(handle, enabled ? 1 : 0));
+
+  @override
+  Future<void> setMenuItemChecked(int handle, bool checked) =>
+      _check(_native.setChecked(handle, checked ? 1 : 0));
+
+  @override
+  Future<void> selectRadio(int group, int handle) =>
+      _check(_native.selectRadio(group, handle));
+
+  // The texts are passed back to back in one buffer, along with their lengths.
+  @override
+  Future<void> setStrings(Map<int, String> strings) {
+    if (strings.isEmpty) return SynchronousFuture<void>(null);
+    final texts = [for (final text in strings.values) utf8.encode(text)];
+    final total = texts.fold<int>(0, (sum, bytes) => sum + bytes.length);
+    final ids = malloc<Int64>(strings.length);
+    final lengths = malloc<IntPtr>(strings.length);
+    final buffer = malloc<Uint8>(total > 0 ? total : 1);
+    try {
+      ids.asTypedList(strings.length).setAll(0, strings.keys);
+      var offset = 0;
+      for (var i = 0; i < texts.length; i++) {
+        lengths[i] = texts[i].length;
+        if (total > 0) buffer.asTypedList(total).setAll(offset, texts[i]);
+        offset += texts[i].length;
+      }
+      return _check(
+        _native.setStrings(ids, buffer, lengths, strings.length),
+      );
+    } finally {
+      malloc.free(ids);
+      malloc.free(lengths);
+      malloc.free(buffer);
+    }
+  }
+
+  @override
+  Future<void> setCounter(String name, int value) {
+    final length = _native.encode(name);
+    return _check(_native.setCounter(_native.buffer, length, value));
+  }
+
+  @override
+  Future<void> addToCounter(String name, int delta) {
+    final length = _native.encode(name);
+    return _check(_native.addToCounter(_native.buffer, length, delta));
+  }
+}
+
+/// Updates existing menu items from any isolate, including background
+/// isolates that can't use the plugin's method channel, by calling into the
+/// native plugin directly.
+///
+/// Updates issued off the platform thread are queued natively and applied in
+/// order by the GTK main loop, where repeated updates of the same property of
+/// an item collapse into the last one. They are fire-and-forget: an update
+/// that fails, such as one for an invalid [MenuItem.handle], is reported as a
+/// [TrayEventType.failed] event on [TrayMenu.events], naming the operation and
+/// the handle. The values cached by the [MenuItem]s in the UI isolate are not
+/// updated; use methods such as [MenuItemLabel.getLabel] to read the current
+/// values back.
+class TrayMenuUpdater {
+  TrayMenuUpdater._(this._native);
+
+  /// Returns null on platforms where the plugin has no native fast path, such
+  /// as anywhere but Linux.
+  static TrayMenuUpdater? tryCreate() {
+    final native = _NativeTrayMenu.tryOpen();
+    return native != null ? TrayMenuUpdater._(native) : null;
+  }
+
+  final _NativeTrayMenu _native;
+
+  void setLabel(int handle, String label) {
+    final length = _native.encode(label);
+    _native.setLabel(handle, _native.buffer, length);
+  }
+
+  void setEnabled(int handle, bool enabled) =>
+      _native.setEnabled(handle, enabled ? 1 : 0);
+
+  void setChecked(int handle, bool checked) =>
+      _native.setChecked(handle, checked ? 1 : 0);
+
+  void remove(int handle) => _native.removeItem(handle);
+
+  /// Sets the counter [name] shown by label templates, like
+  /// [TrayMenu.setCounter].
+  void setCounter(String name, int value) {
+    final length = _native.encode(name);
+    _native.setCounter(_native.buffer, length, value);
+  }
+
+  /// Adds [delta] to the counter [name], like [TrayMenu.incrementCounter].
+  void addToCounter(String name, int delta) {
+    final length = _native.encode(name);
+    _native.addToCounter(_native.buffer, length, delta);
+  }
+}
@@ -6,24 +6,75 @@ class MethodChannelTrayMenu extends TrayMenuPlatform {
   @visibleForTesting
   final methodChannel = const MethodChannel('tray_menu');
 
+  /// The event channel native events arrive on, in batches.
+  @visibleForTesting
+  final eventChannel = const EventChannel('tray_menu/events');
+
+  @override
+  Stream<Object?> get events => eventChannel.receiveBroadcastStream();
+
+  // Platforms without the event channel still report clicks as method calls.
   @override
   void setCallbackHandler(Future<dynamic> Function(MethodCall) callback) {
     methodChannel.setMethodCallHandler(callback);
   }
 
+  // The default tray keeps the original argument formats, so platforms that
+  // only support a single tray don't need to know about tray indices.
+  static Object? _initArguments(String? id, bool reattach) =>
+      id == null && !reattach
+          ? null
+          : {if (id != null) 'id': id, if (reattach) 'reattach': true};
+
+  // Platforms that only support a single tray return nothing, which stands for
+  // the default tray.
+  static int _trayIndex(Object? result) =>
+      result is Map ? result['tray'] as int : 0;
+
+  @override
+  Future<int> init({String? id, bool reattach = false}) async {
+    final result = await methodChannel.invokeMethod<Object?>(
+      'init',
+      _initArguments(id, reattach),
+    );
+    return _trayIndex(result);
+  }
+
+  @override
+  Future<void> show(String iconPath, {int tray = 0}) =>
+      methodChannel.invokeMethod(
+        'showTrayIcon',
+        tray == 0 ? iconPath : {'tray': tray, 'icon': iconPath},
+      );
+
   @override
-  Future<void> init() => methodChannel.invokeMethod('init');
+  Future<void> setTrayLabel(String label, {String? guide, int tray = 0}) =>
+      methodChannel.invokeMethod('setTrayLabel', {
+        'tray': tray,
+        'label': label,
+        'guide': guide,
+      });
 
   @override
-  Future<void> show(String iconPath) =>
-      methodChannel.invokeMethod('showTrayIcon', iconPath);
+  Future<void> setTrayTitle(String title, {int tray = 0}) => methodChannel
+      .invokeMethod('setTrayTitle', {'tray': tray, 'title': title});
 
   @override
-  Future<int> add(_MenuItem item, {int? submenu, int? before}) async {
+  Future<void> setTrayTextRate(double hz, {int tray = 0}) =>
+      methodChannel.invokeMethod('setTrayTextRate', {'tray': tray, 'hz': hz});
+
+  @override
+  Future<int> add(
+    _MenuItem item, {
+    int tray = 0,
+    int? submenu,
+    int? before,
+  }) async {
     final handle = await methodChannel.invokeMethod<int>(
       'addMenuItem',
       {
         ...item.toMap(),
+        if (tray != 0) 'tray': tray,
         if (submenu != null) 'submenu': submenu,
         if (before != null) 'before': before,
       },
@@ -36,6 +87,54 @@ class MethodChannelTrayMenu extends TrayMenuPlatform {
     return methodChannel.invokeMethod('removeMenuItem', handle);
   }
 
+  @override
+  Future<void> clearChildren({int tray = 0, int? submenu}) {
+    return methodChannel.invokeMethod('clearChildren', {
+      if (tray != 0) 'tray': tray,
+      if (submenu != null) 'submenu': submenu,
+    });
+  }
+
+  @override
+  Future<List<int>> replaceChildren(
+    List<_MenuItem> items, {
+    int tray = 0,
+    int? submenu,
+  }) async {
+    final handles = await methodChannel.invokeMethod<List<Object?>>(
+      'replaceChildren',
+      {
+        if (tray != 0) 'tray': tray,
+        if (submenu != null) 'submenu': submenu,
+        'items': [for (final item in items) item.toMap()],
+      },
+    );
+    return handles!.cast<int>();
+  }
+
+  @override
+  Future<void> moveMenuItem(
+    int handle, {
+    int tray = 0,
+    int? submenu,
+    int? before,
+  }) {
+    return methodChannel.invokeMethod('moveMenuItem', {
+      'handle': handle,
+      if (tray != 0) 'tray': tray,
+      if (submenu != null) 'submenu': submenu,
+      if (before != null) 'before': before,
+    });
+  }
+
+  @override
+  Future<void> reorderChildren(Int64List handles, {int? submenu}) {
+    return methodChannel.invokeMethod('reorderChildren', {
+      if (submenu != null) 'submenu': submenu,
+      'handles': handles,
+    });
+  }
+
   @override
   Future<String> getMenuItemLabel(int handle) async {
     final label = await methodChannel.invokeMethod<String>(
@@ -86,4 +185,124 @@ class MethodChannelTrayMenu extends TrayMenuPlatform {
       'checked': checked,
     });
   }
+
+  @override
+  Future<void> selectRadio(int group, int handle) {
+    return methodChannel.invokeMethod('selectRadio', {
+      'handle': handle,
+      'group': group,
+    });
+  }
+
+  @override
+  Future<void> setMenuItemIcon(int handle, String? icon) {
+    return methodChannel.invokeMethod('setMenuItemIcon', {
+      'handle': handle,
+      'icon': icon,
+    });
+  }
+
+  @override
+  Future<void> registerIcon(String icon, {Uint8List? bytes, String? path}) {
+    return methodChannel.invokeMethod('registerIcon', {
+      'icon': icon,
+      'bytes': bytes,
+      'path': path,
+    });
+  }
+
+  @override
+  Future<void> setIconCacheCapacity(int capacity) {
+    return methodChannel.invokeMethod('setIconCacheCapacity', capacity);
+  }
+
+  @override
+  Future<void> setStallThreshold(Duration? threshold) {
+    return methodChannel.invokeMethod(
+      'setStallThreshold',
+      threshold?.inMicroseconds ?? 0,
+    );
+  }
+
+  @override
+  Future<void> setStrings(Map<int, String> strings) {
+    return methodChannel.invokeMethod('setStrings', strings);
+  }
+
+  @override
+  Future<void> setLabelTemplates(Map<int, String> templates) {
+    return methodChannel.invokeMethod('setLabelTemplates', templates);
+  }
+
+  @override
+  Future<void> setCounter(String name, int value) {
+    return methodChannel.invokeMethod('setCounter', {
+      'counter': name,
+      'value': value,
+    });
+  }
+
+  @override
+  Future<void> addToCounter(String name, int delta) {
+    return methodChannel.invokeMethod('addToCounter', {
+      'counter': name,
+      'delta': delta,
+    });
+  }
+
+  @override
+  Future<void> startClock(String name, Duration elapsed) {
+    return methodChannel.invokeMethod('startClock', {
+      'clock': name,
+      'elapsed': elapsed.inMilliseconds,
+    });
+  }
+
+  // Platforms without snapshots or reattaching never have a menu to take
+  // over.
+  @override
+  Future<Map<Object?, Object?>> getManifest({int tray = 0}) async {
+    try {
+      final manifest = await methodChannel.invokeMethod<Map<Object?, Object?>>(
+        'getManifest',
+        tray == 0 ? null : {'tray': tray},
+      );
+      return manifest!;
+    } on MissingPluginException {
+      return const {};
+    }
+  }
+
+  @override
+  Future<void> updateMenuItem(int handle, _MenuItem item) {
+    return methodChannel.invokeMethod('updateMenuItem', {
+      ...item.toMap(),
+      'handle': handle,
+    });
+  }
+
+  @override
+  Future<void> commit({int tray = 0}) {
+    return methodChannel.invokeMethod(
+      'commitMenu',
+      tray == 0 ? null : {'tray': tray},
+    );
+  }
+
+  @override
+  Future<void> discardSnapshot({int tray = 0}) {
+    return methodChannel.invokeMethod(
+      'discardSnapshot',
+      tray == 0 ? null : {'tray': tray},
+    );
+  }
+
+  @override
+  Future<Map<Object?, Object?>> getMemoryReport({int tray = 0}) async {
+    final report = await methodChannel.invokeMethod<Map<Object?, Object?>>(
+      'getMemoryReport',
+      tray == 0 ? null : {'tray': tray},
+    );
+    return report!;
+  }
 }
@@ -6,11 +6,13 @@ abstract class TrayMenuPlatform extends PlatformInterface {
 
   static final Object _token = Object();
 
-  static TrayMenuPlatform _instance = MethodChannelTrayMenu();
+  static TrayMenuPlatform _instance =
+      FfiTrayMenu.tryCreate() ?? MethodChannelTrayMenu();
 
   /// The default instance of [TrayMenuPlatform] to use.
   ///
-  /// Defaults to [MethodChannelTrayMenu].
+  /// Defaults to [FfiTrayMenu] where the native plugin exports the FFI fast
+  /// path, and to [MethodChannelTrayMenu] otherwise.
   static TrayMenuPlatform get instance => _instance;
 
   /// Platform-specific implementations should set this with their own
@@ -21,18 +23,54 @@ abstract class TrayMenuPlatform extends PlatformInterface {
     _instance = instance;
   }
 
+  Stream<Object?> get events => throw UnimplementedError();
+
   void setCallbackHandler(Future<dynamic> Function(MethodCall) callback) =>
       throw UnimplementedError();
 
-Future<void> init() => throw UnimplementedError();
+  /// Returns the index of the tray, which trays created by [id] are given
+  /// natively so that every Flutter engine agrees on it.
+  Future<int> init({String? id, bool reattach = false}) =>
+      throw UnimplementedError();
+
+  Future<void> show(String iconPath, {int tray = 0}) =>
+      throw UnimplementedError();
+
+  Future<void> setTrayLabel(String label, {String? guide, int tray = 0}) =>
+      throw UnimplementedError();
+
+  Future<void> setTrayTitle(String title, {int tray = 0}) =>
+      throw UnimplementedError();
 
-  Future<void> show(String iconPath) => throw UnimplementedError();
+  Future<void> setTrayTextRate(double hz, {int tray = 0}) =>
+      throw UnimplementedError();
 
-  Future<int> add(_MenuItem item, {int? submenu, int? before}) =>
+  Future<int> add(_MenuItem item, {int tray = 0, int? submenu, int? before}) =>
       throw UnimplementedError();
 
   Future<void> remove(int handle) => throw UnimplementedError();
 
+  Future<void> clearChildren({int tray = 0, int? submenu}) =>
+      throw UnimplementedError();
+
+  Future<List<int>> replaceChildren(
+    List<_MenuItem> items, {
+    int tray = 0,
+    int? submenu,
+  }) =>
+      throw UnimplementedError();
+
+  Future<void> moveMenuItem(
+    int handle, {
+    int tray = 0,
+    int? submenu,
+    int? before,
+  }) =>
+      throw UnimplementedError();
+
+  Future<void> reorderChildren(Int64List handles, {int? submenu}) =>
+      throw UnimplementedError();
+
   Future<String> getMenuItemLabel(int handle) => throw UnimplementedError();
 
   Future<void> setMenuItemLabel(int handle, String label) =>
@@ -47,4 +85,47 @@ Future<void> init() => throw UnimplementedError();
 
   Future<void> setMenuItemChecked(int handle, bool checked) =>
       throw UnimplementedError();
+
+  Future<void> selectRadio(int group, int handle) =>
+      throw UnimplementedError();
+
+  Future<void> setMenuItemIcon(int handle, String? icon) =>
+      throw UnimplementedError();
+
+  Future<void> registerIcon(String icon, {Uint8List? bytes, String? path}) =>
+      throw UnimplementedError();
+
+  Future<void> setIconCacheCapacity(int capacity) =>
+      throw UnimplementedError();
+
+  Future<void> setStallThreshold(Duration? threshold) =>
+      throw UnimplementedError();
+
+  Future<void> setStrings(Map<int, String> strings) =>
+      throw UnimplementedError();
+
+  Future<void> setLabelTemplates(Map<int, String> templates) =>
+      throw UnimplementedError();
+
+  Future<void> setCounter(String name, int value) =>
+      throw UnimplementedError();
+
+  Future<void> addToCounter(String name, int delta) =>
+      throw UnimplementedError();
+
+  Future<void> startClock(String name, Duration elapsed) =>
+      throw UnimplementedError();
+
+  Future<Map<Object?, Object?>> getManifest({int tray = 0}) =>
+      throw UnimplementedError();
+
+  Future<void> updateMenuItem(int handle, _MenuItem item) =>
+      throw UnimplementedError();
+
+  Future<void> commit({int tray = 0}) => throw UnimplementedError();
+
+  Future<void> discardSnapshot({int tray = 0}) => throw UnimplementedError();
+
+  Future<Map<Object?, Object?>> getMemoryReport({int tray = 0}) =>
+      throw UnimplementedError();
 }
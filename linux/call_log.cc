@@ -0,0 +1,171 @@
+#include "call_log.h"
+
+#include <sys/stat.h>
+
+#include <cstring>
+
+namespace call_log {
+
+static void put_varint(std::vector<uint8_t>& buffer, uint64_t value) {
+    while (value >= 0x80) {
+        buffer.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back(static_cast<uint8_t>(value));
+}
+
+static bool get_varint(FILE* file, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        const auto byte = fgetc(file);
+        if (byte == EOF) {
+            return false;
+        }
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool get_bytes(FILE* file, uint64_t length, void* data) {
+    return length == 0 || fread(data, 1, length, file) == length;
+}
+
+// Whether length bytes are left to read before size, so a corrupt length fails the read instead of being allocated.
+static bool has_bytes(FILE* file, uint64_t size, uint64_t length) {
+    const auto position = ftell(file);
+    return position >= 0 && static_cast<uint64_t>(position) <= size && length <= size - position;
+}
+
+FlValue* Record::decode_args() const {
+    g_autoptr(FlStandardMessageCodec) codec = fl_standard_message_codec_new();
+    g_autoptr(GBytes) bytes                 = g_bytes_new(args.data(), args.size());
+    g_autoptr(GError) error                 = nullptr;
+    auto value = fl_message_codec_decode_message(FL_MESSAGE_CODEC(codec), bytes, &error);
+    if (!value) {
+        g_warning("tray_menu: failed to decode recorded arguments: %s", error->message);
+        return nullptr;
+    }
+    if (fl_value_get_type(value) == FL_VALUE_TYPE_NULL) {
+        fl_value_unref(value);
+        return nullptr;
+    }
+    return value;
+}
+
+Writer::Writer(const gchar* path) : file{fopen(path, "wb")}, codec{FL_MESSAGE_CODEC(fl_standard_message_codec_new())} {
+    if (!file) {
+        g_warning("tray_menu: cannot record to %s", path);
+        return;
+    }
+    fwrite(magic, 1, sizeof(magic), file);
+    fputc(version, file);
+    fflush(file);
+}
+
+Writer::~Writer() {
+    if (file) {
+        fclose(file);
+    }
+    g_object_unref(codec);
+}
+
+void Writer::append(const gchar* method, FlValue* args, int64_t timestamp_us, int64_t duration_ns) {
+    if (!file) {
+        return;
+    }
+    g_autoptr(GError) error = nullptr;
+    g_autoptr(GBytes) bytes = fl_message_codec_encode_message(codec, args, &error);
+    if (!bytes) {
+        g_warning("tray_menu: failed to record %s: %s", method, error->message);
+        return;
+    }
+
+    buffer.clear();
+    put_varint(buffer, static_cast<uint64_t>(timestamp_us - last_timestamp_us));
+    put_varint(buffer, static_cast<uint64_t>(duration_ns));
+    last_timestamp_us = timestamp_us;
+
+    size_t method_id = 0;
+    while (method_id < methods.size() && methods[method_id] != method) {
+        ++method_id;
+    }
+    put_varint(buffer, method_id);
+    if (method_id == methods.size()) {
+        methods.emplace_back(method);
+        put_varint(buffer, methods.back().size());
+        buffer.insert(buffer.end(), methods.back().begin(), methods.back().end());
+    }
+
+    gsize args_size      = 0;
+    const auto args_data = static_cast<const uint8_t*>(g_bytes_get_data(bytes, &args_size));
+    put_varint(buffer, args_size);
+    buffer.insert(buffer.end(), args_data, args_data + args_size);
+
+    // Flushed per record so that a trace survives the crash it is meant to reproduce.
+    fwrite(buffer.data(), 1, buffer.size(), file);
+    fflush(file);
+}
+
+Reader::Reader(const gchar* path) : file{fopen(path, "rb")} {
+    if (!file) {
+        return;
+    }
+    char header[sizeof(magic) + 1];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, magic, sizeof(magic)) != 0 ||
+        static_cast<uint8_t>(header[sizeof(magic)]) != version) {
+        g_warning("tray_menu: %s is not a call log", path);
+        fclose(file);
+        file = nullptr;
+        return;
+    }
+    struct stat status;
+    if (fstat(fileno(file), &status) != 0) {
+        g_warning("tray_menu: failed to read the size of %s", path);
+        fclose(file);
+        file = nullptr;
+        return;
+    }
+    size = static_cast<uint64_t>(status.st_size);
+}
+
+Reader::~Reader() {
+    if (file) {
+        fclose(file);
+    }
+}
+
+bool Reader::next(Record& record) {
+    uint64_t delta_us, duration_ns, method_id, length;
+    if (!file || !get_varint(file, delta_us) || !get_varint(file, duration_ns) || !get_varint(file, method_id)) {
+        return false;
+    }
+    if (method_id == methods.size()) {
+        if (!get_varint(file, length) || !has_bytes(file, size, length)) {
+            return false;
+        }
+        std::string method(length, '\0');
+        if (!get_bytes(file, length, method.data())) {
+            return false;
+        }
+        methods.push_back(std::move(method));
+    } else if (method_id > methods.size()) {
+        return false;
+    }
+    if (!get_varint(file, length) || !has_bytes(file, size, length)) {
+        return false;
+    }
+    record.args.resize(length);
+    if (!get_bytes(file, length, record.args.data())) {
+        return false;
+    }
+    timestamp_us += static_cast<int64_t>(delta_us);
+    record.method       = methods[method_id];
+    record.timestamp_us = timestamp_us;
+    record.duration_ns  = static_cast<int64_t>(duration_ns);
+    return true;
+}
+
+}  // namespace call_log
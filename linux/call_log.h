@@ -0,0 +1,74 @@
+#ifndef FLUTTER_PLUGIN_TRAY_MENU_CALL_LOG_H_
+#define FLUTTER_PLUGIN_TRAY_MENU_CALL_LOG_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// A compact binary log of method channel traffic, written by the plugin when TRAY_MENU_RECORD names a file and read
+// back by the replay tool.
+//
+// The log starts with a 4-byte magic and a version byte. Every record that follows is a sequence of unsigned LEB128
+// varints: the microseconds since the previous record, the call duration in nanoseconds, a method id, and the length
+// of the arguments followed by the arguments themselves, encoded with the standard message codec. Method names are
+// interned: an id equal to the number of names seen so far introduces a new name, stored inline as a length and bytes.
+namespace call_log {
+
+constexpr char magic[4]        = {'T', 'M', 'C', 'L'};
+constexpr uint8_t version      = 1;
+constexpr const gchar* env_var = "TRAY_MENU_RECORD";
+
+struct Record {
+    std::string method;
+    std::vector<uint8_t> args;
+    int64_t timestamp_us;
+    int64_t duration_ns;
+
+    // Decodes the recorded arguments. Returns nullptr for calls that had no arguments.
+    FlValue* decode_args() const;
+};
+
+struct Writer {
+    explicit Writer(const gchar* path);
+    ~Writer();
+
+    Writer(const Writer&)            = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    bool is_open() const { return file != nullptr; }
+
+    void append(const gchar* method, FlValue* args, int64_t timestamp_us, int64_t duration_ns);
+
+private:
+    FILE* file;
+    FlMessageCodec* codec;
+    std::vector<std::string> methods{};
+    std::vector<uint8_t> buffer{};
+    int64_t last_timestamp_us = 0;
+};
+
+struct Reader {
+    explicit Reader(const gchar* path);
+    ~Reader();
+
+    Reader(const Reader&)            = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    bool is_open() const { return file != nullptr; }
+
+    // Reads the next record, returning false at the end of the log or on a truncated or corrupt record.
+    bool next(Record& record);
+
+private:
+    FILE* file;
+    uint64_t size = 0;
+    std::vector<std::string> methods{};
+    int64_t timestamp_us = 0;
+};
+
+}  // namespace call_log
+
+#endif  // FLUTTER_PLUGIN_TRAY_MENU_CALL_LOG_H_
@@ -0,0 +1,1077 @@
+#include "dbus_menu.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "icon_cache.h"
+
+namespace {
+
+constexpr const gchar* item_path      = "/StatusNotifierItem";
+constexpr const gchar* menu_path      = "/MenuBar";
+constexpr const gchar* item_interface = "org.kde.StatusNotifierItem";
+constexpr const gchar* menu_interface = "com.canonical.dbusmenu";
+constexpr const gchar* watcher_name   = "org.kde.StatusNotifierWatcher";
+
+// How long to wait for a StatusNotifierWatcher before reporting the tray as unavailable. Unlike AppIndicator there is
+// no XEmbed fallback, so the icon only appears once a watcher does.
+constexpr guint watcher_timeout_ms = 3000;
+
+constexpr const gchar* introspection_xml = R"(
+<node>
+  <interface name="org.kde.StatusNotifierItem">
+    <method name="ContextMenu"><arg type="i" direction="in"/><arg type="i" direction="in"/></method>
+    <method name="Activate"><arg type="i" direction="in"/><arg type="i" direction="in"/></method>
+    <method name="SecondaryActivate"><arg type="i" direction="in"/><arg type="i" direction="in"/></method>
+    <method name="Scroll"><arg type="i" direction="in"/><arg type="s" direction="in"/></method>
+    <signal name="NewIcon"/>
+    <signal name="NewTitle"/>
+    <signal name="NewStatus"><arg type="s"/></signal>
+    <signal name="XAyatanaNewLabel"><arg type="s"/><arg type="s"/></signal>
+    <property name="Category" type="s" access="read"/>
+    <property name="Id" type="s" access="read"/>
+    <property name="Title" type="s" access="read"/>
+    <property name="Status" type="s" access="read"/>
+    <property name="WindowId" type="i" access="read"/>
+    <property name="IconThemePath" type="s" access="read"/>
+    <property name="IconName" type="s" access="read"/>
+    <property name="IconPixmap" type="a(iiay)" access="read"/>
+    <property name="ToolTip" type="(sa(iiay)ss)" access="read"/>
+    <property name="ItemIsMenu" type="b" access="read"/>
+    <property name="Menu" type="o" access="read"/>
+    <property name="XAyatanaLabel" type="s" access="read"/>
+    <property name="XAyatanaLabelGuide" type="s" access="read"/>
+  </interface>
+  <interface name="com.canonical.dbusmenu">
+    <method name="GetLayout">
+      <arg type="i" name="parentId" direction="in"/>
+      <arg type="i" name="recursionDepth" direction="in"/>
+      <arg type="as" name="propertyNames" direction="in"/>
+      <arg type="u" name="revision" direction="out"/>
+      <arg type="(ia{sv}av)" name="layout" direction="out"/>
+    </method>
+    <method name="GetGroupProperties">
+      <arg type="ai" name="ids" direction="in"/>
+      <arg type="as" name="propertyNames" direction="in"/>
+      <arg type="a(ia{sv})" name="properties" direction="out"/>
+    </method>
+    <method name="GetProperty">
+      <arg type="i" name="id" direction="in"/>
+      <arg type="s" name="name" direction="in"/>
+      <arg type="v" name="value" direction="out"/>
+    </method>
+    <method name="Event">
+      <arg type="i" name="id" direction="in"/>
+      <arg type="s" name="eventId" direction="in"/>
+      <arg type="v" name="data" direction="in"/>
+      <arg type="u" name="timestamp" direction="in"/>
+    </method>
+    <method name="EventGroup">
+      <arg type="a(isvu)" name="events" direction="in"/>
+      <arg type="ai" name="idErrors" direction="out"/>
+    </method>
+    <method name="AboutToShow">
+      <arg type="i" name="id" direction="in"/>
+      <arg type="b" name="needUpdate" direction="out"/>
+    </method>
+    <method name="AboutToShowGroup">
+      <arg type="ai" name="ids" direction="in"/>
+      <arg type="ai" name="updatesNeeded" direction="out"/>
+      <arg type="ai" name="idErrors" direction="out"/>
+    </method>
+    <signal name="ItemsPropertiesUpdated">
+      <arg type="a(ia{sv})" name="updatedProps"/>
+      <arg type="a(ias)" name="removedProps"/>
+    </signal>
+    <signal name="LayoutUpdated">
+      <arg type="u" name="revision"/>
+      <arg type="i" name="parent"/>
+    </signal>
+    <signal name="ItemActivationRequested">
+      <arg type="i" name="id"/>
+      <arg type="u" name="timestamp"/>
+    </signal>
+    <property name="Version" type="u" access="read"/>
+    <property name="TextDirection" type="s" access="read"/>
+    <property name="Status" type="s" access="read"/>
+    <property name="IconThemePath" type="as" access="read"/>
+  </interface>
+</node>
+)";
+
+// Parsed once and kept for the lifetime of the process.
+GDBusNodeInfo* introspection_data() {
+    static GDBusNodeInfo* info = g_dbus_node_info_new_for_xml(introspection_xml, nullptr);
+    return info;
+}
+
+// dbusmenu labels use underscores to mark mnemonics, which the gtkmm backend doesn't, so they are escaped.
+gchar* escape_label(const std::string& label) {
+    GString* escaped = g_string_sized_new(label.size());
+    for (const auto c : label) {
+        if (c == '_') {
+            g_string_append_c(escaped, '_');
+        }
+        g_string_append_c(escaped, c);
+    }
+    return g_string_free(escaped, FALSE);
+}
+
+// Shared by the root and every item without a label, such as separators.
+const SharedString& empty_label() {
+    static const SharedString label = std::make_shared<const std::string>();
+    return label;
+}
+
+// Every tray in the process owns its own well-known name, as the watcher tells items apart by the name they registered.
+gchar* new_bus_name(int64_t index) {
+    return g_strdup_printf("org.kde.StatusNotifierItem-%d-%" G_GINT64_FORMAT, getpid(), index + 1);
+}
+
+// An empty list of property names means all of them.
+bool wanted(const gchar* const* names, const gchar* name) {
+    return !names || !*names || g_strv_contains(names, name);
+}
+
+}  // namespace
+
+const GDBusInterfaceVTable DBusMenuTray::item_vtable = {item_method_call_cb, item_get_property_cb, nullptr, {}};
+
+const GDBusInterfaceVTable DBusMenuTray::menu_vtable = {menu_method_call_cb, menu_get_property_cb, nullptr, {}};
+
+DBusMenuTray::DBusMenuTray(int64_t index, std::string id, Listener& listener)
+    : index{index}, id{std::move(id)}, listener{listener} {
+    reset_nodes();
+}
+
+DBusMenuTray::~DBusMenuTray() {
+    clear();
+}
+
+void DBusMenuTray::reset_nodes() {
+    nodes.clear();
+    labels.clear();
+    nodes.insert(root_id, Node{empty_label(), {}, {}, {}, 0, -1, -1, root_id, MenuItemType::submenu, true, false});
+    selected_radios.clear();
+}
+
+DBusMenuTray::Node* DBusMenuTray::find(int64_t handle) {
+    if (!owns(handle)) {
+        return nullptr;
+    }
+    const auto item_id = to_id(handle);
+    return item_id != root_id ? nodes.find(item_id) : nullptr;
+}
+
+// A parent of -1 means the root.
+DBusMenuTray::Node* DBusMenuTray::find_submenu(int64_t parent) {
+    const auto node = parent >= 0 ? find(parent) : &nodes.at(root_id);
+    return node && node->type == MenuItemType::submenu ? node : nullptr;
+}
+
+void DBusMenuTray::clear() {
+    if (cancellable) {
+        g_cancellable_cancel(cancellable);
+        g_clear_object(&cancellable);
+    }
+    if (watcher_id) {
+        g_bus_unwatch_name(watcher_id);
+        watcher_id = 0;
+    }
+    if (fallback_source_id) {
+        g_source_remove(fallback_source_id);
+        fallback_source_id = 0;
+    }
+    if (flush_source_id) {
+        g_source_remove(flush_source_id);
+        flush_source_id = 0;
+    }
+    if (name_owner_id) {
+        g_bus_unown_name(name_owner_id);
+        name_owner_id = 0;
+    }
+    if (item_registration_id) {
+        g_dbus_connection_unregister_object(connection, item_registration_id);
+        item_registration_id = 0;
+    }
+    if (menu_registration_id) {
+        g_dbus_connection_unregister_object(connection, menu_registration_id);
+        menu_registration_id = 0;
+    }
+    g_clear_object(&connection);
+    icon.clear();
+    label.clear();
+    label_guide.clear();
+    title.clear();
+    ready = false;
+    dirty_items.clear();
+    dirty_layouts.clear();
+    reset_nodes();
+    ++revision;
+}
+
+bool DBusMenuTray::add_item(int64_t handle, int64_t owner, const ItemSpec& spec, int64_t parent, int64_t before) {
+    const auto parent_node = find_submenu(parent);
+    if (!parent_node || (before >= 0 && !owns(before))) {
+        return false;
+    }
+    const auto parent_id = parent >= 0 ? to_id(parent) : root_id;
+    auto& children       = parent_node->children;
+    auto position        = children.end();
+    if (before >= 0) {
+        position = std::find(children.begin(), children.end(), to_id(before));
+        if (position == children.end()) {
+            return false;
+        }
+    }
+
+    const auto item_id = to_id(handle);
+    children.insert(position, item_id);
+    auto label = spec.text;
+    if (!label) {
+        label = spec.label.empty() ? empty_label() : labels.intern(spec.label);
+    }
+    const auto inserted = nodes.insert(item_id,
+                                       Node{std::move(label),
+                                            spec.type != MenuItemType::separator ? spec.image : nullptr,
+                                            spec.key,
+                                            {},
+                                            owner,
+                                            spec.group,
+                                            spec.string_id,
+                                            parent_id,
+                                            spec.type,
+                                            spec.enabled,
+                                            spec.checked});
+    mark_layout_dirty(parent_id);
+    if (spec.type == MenuItemType::radio) {
+        // Radio items are only checked by being selected, which deselects the rest of their group.
+        auto& node   = *inserted;
+        node.checked = false;
+        if (spec.checked || !selected_radios.count({owner, spec.group})) {
+            select(item_id, node);
+        }
+    }
+    return true;
+}
+
+void DBusMenuTray::erase_subtree(gint32 id) {
+    const auto& node = nodes.at(id);
+    for (const auto child : node.children) {
+        erase_subtree(child);
+    }
+    if (node.type == MenuItemType::radio) {
+        const auto selected = selected_radios.find({node.owner, node.group});
+        if (selected != selected_radios.end() && selected->second == id) {
+            selected_radios.erase(selected);
+        }
+    }
+    dirty_items.erase(id);
+    dirty_layouts.erase(id);
+    nodes.erase(id);
+}
+
+bool DBusMenuTray::remove_item(int64_t handle) {
+    const auto node = find(handle);
+    if (!node) {
+        return false;
+    }
+    const auto item_id   = to_id(handle);
+    const auto parent_id = node->parent;
+    auto& siblings       = nodes.at(parent_id).children;
+    siblings.erase(std::find(siblings.begin(), siblings.end(), item_id));
+    erase_subtree(item_id);
+    mark_layout_dirty(parent_id);
+    return true;
+}
+
+void DBusMenuTray::remove_owned_by(int64_t owner) {
+    remove_owned_by(root_id, owner);
+}
+
+void DBusMenuTray::remove_owned_by(gint32 parent_id, int64_t owner) {
+    auto& children = nodes.at(parent_id).children;
+    bool removed   = false;
+    for (auto it = children.begin(); it != children.end();) {
+        if (nodes.at(*it).owner == owner) {
+            erase_subtree(*it);
+            it      = children.erase(it);
+            removed = true;
+        } else {
+            remove_owned_by(*it, owner);
+            ++it;
+        }
+    }
+    if (removed) {
+        mark_layout_dirty(parent_id);
+    }
+}
+
+bool DBusMenuTray::clear_children(int64_t parent) {
+    const auto parent_node = find_submenu(parent);
+    if (!parent_node) {
+        return false;
+    }
+    if (!parent_node->children.empty()) {
+        for (const auto child : parent_node->children) {
+            erase_subtree(child);
+        }
+        parent_node->children.clear();
+        mark_layout_dirty(parent >= 0 ? to_id(parent) : root_id);
+    }
+    return true;
+}
+
+bool DBusMenuTray::move_item(int64_t handle, int64_t parent, int64_t before) {
+    const auto node        = find(handle);
+    const auto parent_node = find_submenu(parent);
+    if (!node || !parent_node || (before >= 0 && (!owns(before) || before == handle))) {
+        return false;
+    }
+    const auto item_id   = to_id(handle);
+    const auto parent_id = parent >= 0 ? to_id(parent) : root_id;
+    for (auto ancestor = parent_id; ancestor != root_id; ancestor = nodes.at(ancestor).parent) {
+        if (ancestor == item_id) {
+            return false;
+        }
+    }
+    auto& children = parent_node->children;
+    if (before >= 0 && std::find(children.begin(), children.end(), to_id(before)) == children.end()) {
+        return false;
+    }
+
+    auto& siblings = nodes.at(node->parent).children;
+    siblings.erase(std::find(siblings.begin(), siblings.end(), item_id));
+    mark_layout_dirty(node->parent);
+    children.insert(before >= 0 ? std::find(children.begin(), children.end(), to_id(before)) : children.end(), item_id);
+    node->parent = parent_id;
+    mark_layout_dirty(parent_id);
+    return true;
+}
+
+// Rebuilds the child list in one pass, so reordering a whole submenu costs one LayoutUpdated however many items move.
+bool DBusMenuTray::reorder_children(int64_t parent, const std::vector<int64_t>& handles) {
+    const auto parent_node = find_submenu(parent);
+    if (!parent_node) {
+        return false;
+    }
+    const auto parent_id = parent >= 0 ? to_id(parent) : root_id;
+    std::vector<gint32> reordered;
+    reordered.reserve(parent_node->children.size());
+    std::set<gint32> moved;
+    for (const auto handle : handles) {
+        const auto node = find(handle);
+        if (!node || node->parent != parent_id || !moved.insert(to_id(handle)).second) {
+            return false;
+        }
+        reordered.push_back(to_id(handle));
+    }
+    for (const auto child : parent_node->children) {
+        if (!moved.count(child)) {
+            reordered.push_back(child);
+        }
+    }
+    if (reordered != parent_node->children) {
+        parent_node->children.swap(reordered);
+        mark_layout_dirty(parent_id);
+    }
+    return true;
+}
+
+bool DBusMenuTray::get_label(int64_t handle, std::string& label) {
+    const auto node = find(handle);
+    if (!node) {
+        return false;
+    }
+    label = *node->label;
+    return true;
+}
+
+bool DBusMenuTray::set_label(int64_t handle, const gchar* label) {
+    const auto node = find(handle);
+    if (!node) {
+        return false;
+    }
+    node->string_id = -1;
+    if (*node->label != label) {
+        node->label = labels.intern(label);
+        mark_item_dirty(to_id(handle));
+    }
+    return true;
+}
+
+void DBusMenuTray::relabel(const std::unordered_map<int64_t, SharedString>& strings) {
+    nodes.for_each([&](gint32 item_id, Node& node) {
+        if (node.string_id < 0) {
+            return;
+        }
+        const auto text = strings.find(node.string_id);
+        if (text == strings.end()) {
+            return;
+        }
+        if (*node.label != *text->second) {
+            mark_item_dirty(item_id);
+        }
+        node.label = text->second;
+    });
+}
+
+bool DBusMenuTray::get_enabled(int64_t handle, bool& enabled) {
+    const auto node = find(handle);
+    if (!node) {
+        return false;
+    }
+    enabled = node->enabled;
+    return true;
+}
+
+bool DBusMenuTray::set_enabled(int64_t handle, bool enabled) {
+    const auto node = find(handle);
+    if (!node) {
+        return false;
+    }
+    if (node->enabled != enabled) {
+        node->enabled = enabled;
+        mark_item_dirty(to_id(handle));
+    }
+    return true;
+}
+
+bool DBusMenuTray::set_icon(int64_t handle, const SharedIcon& icon) {
+    const auto node = find(handle);
+    if (!node || node->type == MenuItemType::separator) {
+        return false;
+    }
+    if (node->icon != icon) {
+        node->icon = icon;
+        mark_item_dirty(to_id(handle));
+    }
+    return true;
+}
+
+bool DBusMenuTray::get_checked(int64_t handle, bool& checked) {
+    const auto node = find(handle);
+    if (!node || (node->type != MenuItemType::checkbox && node->type != MenuItemType::radio)) {
+        return false;
+    }
+    checked = node->checked;
+    return true;
+}
+
+bool DBusMenuTray::set_checked(int64_t handle, bool checked) {
+    const auto node = find(handle);
+    if (!node || node->type != MenuItemType::checkbox) {
+        return false;
+    }
+    if (node->checked != checked) {
+        node->checked = checked;
+        mark_item_dirty(to_id(handle));
+    }
+    return true;
+}
+
+bool DBusMenuTray::select_radio(int64_t group, int64_t handle) {
+    const auto node = find(handle);
+    if (!node || node->type != MenuItemType::radio || node->group != group) {
+        return false;
+    }
+    select(to_id(handle), *node);
+    return true;
+}
+
+bool DBusMenuTray::update_item(int64_t handle, const ItemSpec& spec) {
+    const auto node = find(handle);
+    if (!node || node->type != spec.type || (spec.type == MenuItemType::radio && node->group != spec.group)) {
+        return false;
+    }
+    const auto item_id = to_id(handle);
+    const auto& label  = spec.text ? *spec.text : spec.label;
+    if (*node->label != label || node->icon != spec.image || node->enabled != spec.enabled ||
+        (spec.type == MenuItemType::checkbox && node->checked != spec.checked)) {
+        mark_item_dirty(item_id);
+    }
+    if (spec.text) {
+        node->label = spec.text;
+    } else if (*node->label != label) {
+        node->label = labels.intern(label);
+    }
+    node->icon      = spec.type != MenuItemType::separator ? spec.image : nullptr;
+    node->string_id = spec.string_id;
+    node->enabled   = spec.enabled;
+    if (spec.type == MenuItemType::checkbox) {
+        node->checked = spec.checked;
+    } else if (spec.type == MenuItemType::radio && spec.checked) {
+        select(item_id, *node);
+    }
+    return true;
+}
+
+// A group the new owner already has a selection in keeps it, so the item selected in the group handed over is
+// deselected.
+void DBusMenuTray::reassign(int64_t from, int64_t to) {
+    nodes.for_each([&](gint32 item_id, Node& node) {
+        if (item_id != root_id && node.owner == from) {
+            node.owner = to;
+        }
+    });
+    std::vector<std::pair<int64_t, gint32>> handed_over;
+    for (auto it = selected_radios.begin(); it != selected_radios.end();) {
+        if (it->first.first == from) {
+            handed_over.emplace_back(it->first.second, it->second);
+            it = selected_radios.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (const auto& selection : handed_over) {
+        if (!selected_radios.insert({{to, selection.first}, selection.second}).second) {
+            nodes.at(selection.second).checked = false;
+            mark_item_dirty(selection.second);
+        }
+    }
+}
+
+void DBusMenuTray::walk(const Visitor& visit) {
+    walk(root_id, visit);
+}
+
+void DBusMenuTray::walk(gint32 parent_id, const Visitor& visit) const {
+    for (const auto child : nodes.at(parent_id).children) {
+        const auto& node = nodes.at(child);
+        ItemSpec item;
+        item.type      = node.type;
+        item.key       = node.key;
+        item.label     = *node.label;
+        item.icon      = node.icon ? node.icon->id : std::string();
+        item.enabled   = node.enabled;
+        item.checked   = node.checked;
+        item.group     = node.group;
+        item.string_id = node.string_id;
+        visit(to_handle(child), parent_id != root_id ? to_handle(parent_id) : -1, node.owner, item);
+        walk(child, visit);
+    }
+}
+
+// Nodes live in the arena, so an item's model bytes are only what its node allocates beyond its slot, and the slots
+// count against the tray along with the interned labels. Nothing is a GObject or connects signal handlers.
+DBusMenuTray::Footprint DBusMenuTray::measure(const FootprintVisitor& visit) {
+    measure(root_id, visit);
+    Footprint footprint;
+    footprint.model_bytes = sizeof(*this) + nodes.memory_bytes() +
+                            nodes.at(root_id).children.capacity() * sizeof(gint32) +
+                            (selected_radios.size() + dirty_items.size() + dirty_layouts.size()) * 4 * sizeof(void*);
+    footprint.string_bytes =
+            labels.memory_bytes() + icon.capacity() + label.capacity() + label_guide.capacity() + title.capacity();
+    return footprint;
+}
+
+void DBusMenuTray::measure(gint32 parent_id, const FootprintVisitor& visit) const {
+    for (const auto child : nodes.at(parent_id).children) {
+        const auto& node = nodes.at(child);
+        Footprint footprint;
+        footprint.model_bytes  = node.children.capacity() * sizeof(gint32);
+        footprint.string_bytes = node.key.size();
+        visit(to_handle(child), parent_id != root_id ? to_handle(parent_id) : -1, node.type, footprint);
+        measure(child, visit);
+    }
+}
+
+// Both the deselected and the selected item go out in the same ItemsPropertiesUpdated signal, so hosts never show a
+// group with two or no selected items.
+void DBusMenuTray::select(gint32 item_id, Node& node) {
+    auto& selected = selected_radios[{node.owner, node.group}];
+    if (selected == item_id) {
+        return;
+    }
+    if (selected != root_id) {
+        nodes.at(selected).checked = false;
+        mark_item_dirty(selected);
+    }
+    selected     = item_id;
+    node.checked = true;
+    mark_item_dirty(item_id);
+}
+
+// Hosts announce submenus as they open and close, and the whole menu by the root's events. Not every host sends them,
+// but those that don't call AboutToShow before showing a submenu.
+void DBusMenuTray::track_visibility(gint32 item_id, const gchar* event_id) {
+    const auto submenu = item_id != root_id ? to_handle(item_id) : -1;
+    if (g_strcmp0(event_id, "opened") == 0) {
+        listener.on_menu_visible(submenu, true);
+    } else if (g_strcmp0(event_id, "closed") == 0) {
+        listener.on_menu_visible(submenu, false);
+    }
+}
+
+// Checkboxes toggle themselves when clicked, like Gtk::CheckMenuItem does, and radio items select themselves before the
+// activation is reported.
+void DBusMenuTray::activate(gint32 item_id) {
+    const auto started_at_us = g_get_monotonic_time();
+    const auto found         = nodes.find(item_id);
+    if (!found || item_id == root_id || !found->enabled) {
+        return;
+    }
+    auto& node = *found;
+    if (node.type == MenuItemType::checkbox) {
+        node.checked = !node.checked;
+        mark_item_dirty(item_id);
+    } else if (node.type == MenuItemType::radio) {
+        select(item_id, node);
+    }
+    if (node.type != MenuItemType::separator) {
+        listener.on_activate(to_handle(item_id), node.owner, started_at_us);
+    }
+}
+
+GVariant* DBusMenuTray::properties(gint32 item_id, const gchar* const* names, bool explicit_defaults) const {
+    const auto& node = nodes.at(item_id);
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+    const auto add = [&](const gchar* name, GVariant* value) {
+        if (wanted(names, name)) {
+            g_variant_builder_add(&builder, "{sv}", name, value);
+        } else {
+            g_variant_unref(g_variant_ref_sink(value));
+        }
+    };
+
+    if (node.type == MenuItemType::separator) {
+        add("type", g_variant_new_string("separator"));
+    } else if (item_id != root_id) {
+        add("label", g_variant_new_take_string(escape_label(*node.label)));
+        if (!node.enabled || explicit_defaults) {
+            add("enabled", g_variant_new_boolean(node.enabled));
+        }
+        // The bytes are shared with the icon and every other item showing it, not copied.
+        if (node.icon) {
+            add("icon-data", g_variant_new_from_bytes(G_VARIANT_TYPE_BYTESTRING, node.icon->png, TRUE));
+        } else if (explicit_defaults) {
+            add("icon-data", g_variant_new_array(G_VARIANT_TYPE_BYTE, nullptr, 0));
+        }
+    }
+    if (node.type == MenuItemType::checkbox || node.type == MenuItemType::radio) {
+        add("toggle-type", g_variant_new_string(node.type == MenuItemType::radio ? "radio" : "checkmark"));
+        add("toggle-state", g_variant_new_int32(node.checked ? 1 : 0));
+    }
+    if (node.type == MenuItemType::submenu) {
+        add("children-display", g_variant_new_string("submenu"));
+    }
+    return g_variant_builder_end(&builder);
+}
+
+// A negative depth means the whole subtree.
+GVariant* DBusMenuTray::layout(gint32 item_id, gint32 depth, const gchar* const* names) const {
+    GVariantBuilder children;
+    g_variant_builder_init(&children, G_VARIANT_TYPE("av"));
+    if (depth != 0) {
+        for (const auto child : nodes.at(item_id).children) {
+            g_variant_builder_add(&children, "v", layout(child, depth - 1, names));
+        }
+    }
+    return g_variant_new("(i@a{sv}av)", item_id, properties(item_id, names, false), &children);
+}
+
+// Until the menu is exported the host has nothing to update; it fetches the whole layout once registered.
+void DBusMenuTray::mark_item_dirty(gint32 item_id) {
+    if (!connection) {
+        return;
+    }
+    dirty_items.insert(item_id);
+    if (!flush_source_id) {
+        flush_source_id = g_idle_add(flush_cb, this);
+    }
+}
+
+void DBusMenuTray::mark_layout_dirty(gint32 parent_id) {
+    ++revision;
+    if (!connection) {
+        return;
+    }
+    dirty_layouts.insert(parent_id);
+    if (!flush_source_id) {
+        flush_source_id = g_idle_add(flush_cb, this);
+    }
+}
+
+gboolean DBusMenuTray::flush_cb(gpointer user_data) {
+    auto self             = static_cast<DBusMenuTray*>(user_data);
+    self->flush_source_id = 0;
+    self->flush();
+    return G_SOURCE_REMOVE;
+}
+
+// Items under a submenu whose layout changed are skipped, as the host fetches them again along with the layout. A
+// single LayoutUpdated for the root replaces one per submenu once several submenus changed.
+void DBusMenuTray::flush() {
+    GVariantBuilder updated;
+    g_variant_builder_init(&updated, G_VARIANT_TYPE("a(ia{sv})"));
+    bool has_updates = false;
+    for (const auto item_id : dirty_items) {
+        if (!dirty_layouts.count(nodes.at(item_id).parent)) {
+            g_variant_builder_add(&updated, "(i@a{sv})", item_id, properties(item_id, nullptr, true));
+            has_updates = true;
+        }
+    }
+    if (has_updates) {
+        g_dbus_connection_emit_signal(connection,
+                                      nullptr,
+                                      menu_path,
+                                      menu_interface,
+                                      "ItemsPropertiesUpdated",
+                                      g_variant_new("(a(ia{sv})a(ias))", &updated, nullptr),
+                                      nullptr);
+    } else {
+        g_variant_builder_clear(&updated);
+    }
+
+    const auto emit_layout_updated = [&](gint32 parent_id) {
+        g_dbus_connection_emit_signal(connection,
+                                      nullptr,
+                                      menu_path,
+                                      menu_interface,
+                                      "LayoutUpdated",
+                                      g_variant_new("(ui)", revision, parent_id),
+                                      nullptr);
+    };
+    if (dirty_layouts.size() > 4) {
+        emit_layout_updated(root_id);
+    } else {
+        for (const auto parent_id : dirty_layouts) {
+            emit_layout_updated(parent_id);
+        }
+    }
+
+    dirty_items.clear();
+    dirty_layouts.clear();
+}
+
+// Label and title are read by the host when it picks the icon up; after that, changes are announced as they happen,
+// which is why callers are expected to rate-limit them.
+void DBusMenuTray::set_indicator_label(const gchar* label, const gchar* guide) {
+    if (this->label == label && label_guide == guide) {
+        return;
+    }
+    this->label = label;
+    label_guide = guide;
+    if (item_registration_id) {
+        g_dbus_connection_emit_signal(connection,
+                                      nullptr,
+                                      item_path,
+                                      item_interface,
+                                      "XAyatanaNewLabel",
+                                      g_variant_new("(ss)", label, guide),
+                                      nullptr);
+    }
+}
+
+void DBusMenuTray::set_title(const gchar* title) {
+    if (this->title == title) {
+        return;
+    }
+    this->title = title;
+    if (item_registration_id) {
+        g_dbus_connection_emit_signal(connection, nullptr, item_path, item_interface, "NewTitle", nullptr, nullptr);
+    }
+}
+
+void DBusMenuTray::show(const gchar* icon_path) {
+    if (cancellable) {
+        return;
+    }
+    icon        = icon_path;
+    cancellable = g_cancellable_new();
+    g_bus_get(G_BUS_TYPE_SESSION, cancellable, bus_get_cb, this);
+}
+
+// Cancelled operations still complete, after the tray may have been destroyed, so user_data is only touched once the
+// result is known not to be a cancellation.
+void DBusMenuTray::bus_get_cb(GObject*, GAsyncResult* result, gpointer user_data) {
+    g_autoptr(GError) error = nullptr;
+    auto bus                = g_bus_get_finish(result, &error);
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        return;
+    }
+    auto self = static_cast<DBusMenuTray*>(user_data);
+    if (!bus) {
+        g_warning("tray_menu: cannot connect to the session bus: %s", error->message);
+        self->listener.on_status("trayUnavailable");
+        return;
+    }
+    self->export_objects(bus);
+}
+
+void DBusMenuTray::export_objects(GDBusConnection* bus) {
+    connection = bus;
+
+    const auto info      = introspection_data();
+    item_registration_id = g_dbus_connection_register_object(
+            connection, item_path, g_dbus_node_info_lookup_interface(info, item_interface), &item_vtable, this, nullptr,
+            nullptr);
+    menu_registration_id = g_dbus_connection_register_object(
+            connection, menu_path, g_dbus_node_info_lookup_interface(info, menu_interface), &menu_vtable, this, nullptr,
+            nullptr);
+
+    g_autofree gchar* name = new_bus_name(index);
+    name_owner_id          = g_bus_own_name_on_connection(
+            connection, name, G_BUS_NAME_OWNER_FLAGS_NONE, nullptr, nullptr, nullptr, nullptr);
+    watcher_id = g_bus_watch_name_on_connection(connection,
+                                                watcher_name,
+                                                G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                watcher_appeared_cb,
+                                                watcher_vanished_cb,
+                                                this,
+                                                nullptr);
+}
+
+void DBusMenuTray::register_with_watcher() {
+    g_autofree gchar* name = new_bus_name(index);
+    g_dbus_connection_call(connection,
+                           watcher_name,
+                           "/StatusNotifierWatcher",
+                           watcher_name,
+                           "RegisterStatusNotifierItem",
+                           g_variant_new("(s)", name),
+                           nullptr,
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           cancellable,
+                           register_cb,
+                           this);
+}
+
+void DBusMenuTray::register_cb(GObject* source, GAsyncResult* result, gpointer user_data) {
+    g_autoptr(GError) error  = nullptr;
+    g_autoptr(GVariant) body = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, &error);
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        return;
+    }
+    auto self = static_cast<DBusMenuTray*>(user_data);
+    if (!body) {
+        g_warning("tray_menu: cannot register the tray icon: %s", error->message);
+        self->listener.on_status("trayUnavailable");
+        return;
+    }
+    if (!self->ready) {
+        self->ready = true;
+        self->listener.on_status("trayReady");
+    }
+}
+
+void DBusMenuTray::watcher_appeared_cb(GDBusConnection*, const gchar*, const gchar*, gpointer user_data) {
+    auto self = static_cast<DBusMenuTray*>(user_data);
+    if (self->fallback_source_id) {
+        g_source_remove(self->fallback_source_id);
+        self->fallback_source_id = 0;
+    }
+    self->register_with_watcher();
+}
+
+void DBusMenuTray::watcher_vanished_cb(GDBusConnection*, const gchar*, gpointer user_data) {
+    auto self = static_cast<DBusMenuTray*>(user_data);
+    if (self->ready) {
+        self->ready = false;
+        self->listener.on_status("trayUnavailable");
+    } else if (!self->fallback_source_id) {
+        self->fallback_source_id = g_timeout_add(watcher_timeout_ms, watcher_timeout_cb, self);
+    }
+}
+
+gboolean DBusMenuTray::watcher_timeout_cb(gpointer user_data) {
+    auto self                = static_cast<DBusMenuTray*>(user_data);
+    self->fallback_source_id = 0;
+    self->listener.on_status("trayUnavailable");
+    return G_SOURCE_REMOVE;
+}
+
+void DBusMenuTray::item_method_call_cb(GDBusConnection*,
+                                       const gchar*,
+                                       const gchar*,
+                                       const gchar*,
+                                       const gchar*,
+                                       GVariant*,
+                                       GDBusMethodInvocation* invocation,
+                                       gpointer) {
+    // The icon only carries a menu (ItemIsMenu), so hosts open it themselves and clicks on the icon do nothing else.
+    g_dbus_method_invocation_return_value(invocation, nullptr);
+}
+
+GVariant* DBusMenuTray::item_get_property_cb(
+        GDBusConnection*, const gchar*, const gchar*, const gchar*, const gchar* name, GError**, gpointer user_data) {
+    return static_cast<DBusMenuTray*>(user_data)->get_item_property(name);
+}
+
+GVariant* DBusMenuTray::get_item_property(const gchar* name) const {
+    if (g_strcmp0(name, "Category") == 0) {
+        return g_variant_new_string("ApplicationStatus");
+    }
+    if (g_strcmp0(name, "Id") == 0) {
+        return g_variant_new_string(id.c_str());
+    }
+    if (g_strcmp0(name, "Title") == 0) {
+        return g_variant_new_string(title.empty() ? id.c_str() : title.c_str());
+    }
+    if (g_strcmp0(name, "Status") == 0) {
+        return g_variant_new_string("Active");
+    }
+    if (g_strcmp0(name, "WindowId") == 0) {
+        return g_variant_new_int32(0);
+    }
+    if (g_strcmp0(name, "IconThemePath") == 0) {
+        return g_variant_new_string("");
+    }
+    if (g_strcmp0(name, "IconName") == 0) {
+        return g_variant_new_string(icon.c_str());
+    }
+    if (g_strcmp0(name, "IconPixmap") == 0) {
+        return g_variant_new_array(G_VARIANT_TYPE("(iiay)"), nullptr, 0);
+    }
+    if (g_strcmp0(name, "ToolTip") == 0) {
+        return g_variant_new("(s@a(iiay)ss)", "", g_variant_new_array(G_VARIANT_TYPE("(iiay)"), nullptr, 0), "", "");
+    }
+    if (g_strcmp0(name, "ItemIsMenu") == 0) {
+        return g_variant_new_boolean(TRUE);
+    }
+    if (g_strcmp0(name, "Menu") == 0) {
+        return g_variant_new_object_path(menu_path);
+    }
+    if (g_strcmp0(name, "XAyatanaLabel") == 0) {
+        return g_variant_new_string(label.c_str());
+    }
+    if (g_strcmp0(name, "XAyatanaLabelGuide") == 0) {
+        return g_variant_new_string(label_guide.c_str());
+    }
+    return nullptr;
+}
+
+void DBusMenuTray::menu_method_call_cb(GDBusConnection*,
+                                       const gchar*,
+                                       const gchar*,
+                                       const gchar*,
+                                       const gchar* method,
+                                       GVariant* parameters,
+                                       GDBusMethodInvocation* invocation,
+                                       gpointer user_data) {
+    static_cast<DBusMenuTray*>(user_data)->handle_menu_call(method, parameters, invocation);
+}
+
+GVariant* DBusMenuTray::menu_get_property_cb(
+        GDBusConnection*, const gchar*, const gchar*, const gchar*, const gchar* name, GError**, gpointer) {
+    if (g_strcmp0(name, "Version") == 0) {
+        return g_variant_new_uint32(3);
+    }
+    if (g_strcmp0(name, "TextDirection") == 0) {
+        return g_variant_new_string("ltr");
+    }
+    if (g_strcmp0(name, "Status") == 0) {
+        return g_variant_new_string("normal");
+    }
+    if (g_strcmp0(name, "IconThemePath") == 0) {
+        return g_variant_new_strv(nullptr, 0);
+    }
+    return nullptr;
+}
+
+void DBusMenuTray::handle_menu_call(const gchar* method, GVariant* parameters, GDBusMethodInvocation* invocation) {
+    if (g_strcmp0(method, "GetLayout") == 0) {
+        gint32 parent_id, depth;
+        g_autofree const gchar** names = nullptr;
+        g_variant_get(parameters, "(ii^a&s)", &parent_id, &depth, &names);
+        if (!nodes.count(parent_id)) {
+            g_dbus_method_invocation_return_error(
+                    invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Unknown item %d", parent_id);
+            return;
+        }
+        const auto result = g_variant_new("(u@(ia{sv}av))", revision, layout(parent_id, depth, names));
+        g_dbus_method_invocation_return_value(invocation, result);
+    } else if (g_strcmp0(method, "GetGroupProperties") == 0) {
+        g_autoptr(GVariant) ids        = nullptr;
+        g_autofree const gchar** names = nullptr;
+        g_variant_get(parameters, "(@ai^a&s)", &ids, &names);
+        GVariantBuilder result;
+        g_variant_builder_init(&result, G_VARIANT_TYPE("a(ia{sv})"));
+        gsize count      = 0;
+        const auto items = static_cast<const gint32*>(g_variant_get_fixed_array(ids, &count, sizeof(gint32)));
+        for (gsize i = 0; i < count; ++i) {
+            if (nodes.count(items[i])) {
+                g_variant_builder_add(&result, "(i@a{sv})", items[i], properties(items[i], names, false));
+            }
+        }
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(a(ia{sv}))", &result));
+    } else if (g_strcmp0(method, "GetProperty") == 0) {
+        gint32 item_id;
+        const gchar* name;
+        g_variant_get(parameters, "(i&s)", &item_id, &name);
+        const gchar* names[]      = {name, nullptr};
+        g_autoptr(GVariant) value = nullptr;
+        if (nodes.count(item_id)) {
+            g_autoptr(GVariant) props = g_variant_ref_sink(properties(item_id, names, true));
+            value                     = g_variant_lookup_value(props, name, nullptr);
+        }
+        if (!value) {
+            g_dbus_method_invocation_return_error(invocation,
+                                                  G_DBUS_ERROR,
+                                                  G_DBUS_ERROR_INVALID_ARGS,
+                                                  "Unknown property %s of item %d",
+                                                  name,
+                                                  item_id);
+            return;
+        }
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(v)", value));
+    } else if (g_strcmp0(method, "Event") == 0) {
+        gint32 item_id;
+        const gchar* event_id;
+        g_variant_get(parameters, "(i&svu)", &item_id, &event_id, nullptr, nullptr);
+        g_dbus_method_invocation_return_value(invocation, nullptr);
+        if (g_strcmp0(event_id, "clicked") == 0) {
+            activate(item_id);
+        } else {
+            track_visibility(item_id, event_id);
+        }
+    } else if (g_strcmp0(method, "EventGroup") == 0) {
+        g_autoptr(GVariantIter) events = nullptr;
+        g_variant_get(parameters, "(a(isvu))", &events);
+        GVariantBuilder errors;
+        g_variant_builder_init(&errors, G_VARIANT_TYPE("ai"));
+        std::vector<gint32> clicked;
+        gint32 item_id;
+        const gchar* event_id;
+        while (g_variant_iter_loop(events, "(i&svu)", &item_id, &event_id, nullptr, nullptr)) {
+            if (!nodes.count(item_id)) {
+                g_variant_builder_add(&errors, "i", item_id);
+            } else if (g_strcmp0(event_id, "clicked") == 0) {
+                clicked.push_back(item_id);
+            } else {
+                track_visibility(item_id, event_id);
+            }
+        }
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(ai)", &errors));
+        for (const auto clicked_id : clicked) {
+            activate(clicked_id);
+        }
+    } else if (g_strcmp0(method, "AboutToShow") == 0) {
+        // Labels rendered from templates are brought up to date as the menu shows, in which case the host is asked to
+        // fetch the layout again rather than wait for the signal.
+        listener.on_menu_visible(-1, true);
+        const gboolean update_needed = !dirty_items.empty() || !dirty_layouts.empty();
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(b)", update_needed));
+    } else if (g_strcmp0(method, "AboutToShowGroup") == 0) {
+        listener.on_menu_visible(-1, true);
+        g_autoptr(GVariant) ids = nullptr;
+        g_variant_get(parameters, "(@ai)", &ids);
+        GVariantBuilder errors;
+        g_variant_builder_init(&errors, G_VARIANT_TYPE("ai"));
+        gsize count      = 0;
+        const auto items = static_cast<const gint32*>(g_variant_get_fixed_array(ids, &count, sizeof(gint32)));
+        for (gsize i = 0; i < count; ++i) {
+            if (!nodes.count(items[i])) {
+                g_variant_builder_add(&errors, "i", items[i]);
+            }
+        }
+        // Nothing is built lazily, so no submenu ever needs an update before it is shown.
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(aiai)", nullptr, &errors));
+    } else {
+        g_dbus_method_invocation_return_error(
+                invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD, "Unknown method %s", method);
+    }
+}
@@ -0,0 +1,224 @@
+#ifndef FLUTTER_PLUGIN_TRAY_MENU_DBUS_MENU_H_
+#define FLUTTER_PLUGIN_TRAY_MENU_DBUS_MENU_H_
+
+#include <gio/gio.h>
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "node_arena.h"
+#include "tray_backend.h"
+
+// A tray backend that exports org.kde.StatusNotifierItem and com.canonical.dbusmenu itself over GDBus, serving the menu
+// straight from a compact in-memory model instead of a gtkmm widget tree serialized by libayatana-appindicator.
+//
+// Changes are applied to the model immediately and announced incrementally: property changes are coalesced into one
+// ItemsPropertiesUpdated signal and structural changes into LayoutUpdated signals for the affected submenus, both sent
+// once per main loop iteration. Nothing is sent before the icon has been shown; the host fetches the whole layout when
+// it picks the icon up.
+//
+// It talks to whatever DBUS_SESSION_BUS_ADDRESS points at, so it can be exercised against a private bus started with
+// dbus-run-session or dbus-daemon --session.
+struct DBusMenuTray : TrayBackend {
+    DBusMenuTray(int64_t index, std::string id, Listener& listener);
+
+    ~DBusMenuTray() override;
+
+    DBusMenuTray(const DBusMenuTray&)            = delete;
+    DBusMenuTray& operator=(const DBusMenuTray&) = delete;
+
+    void show(const gchar* icon_path) override;
+
+    bool tracks_visibility() const override { return true; }
+
+    void set_indicator_label(const gchar* label, const gchar* guide) override;
+
+    void set_title(const gchar* title) override;
+
+    void clear() override;
+
+    bool add_item(int64_t handle, int64_t owner, const ItemSpec& spec, int64_t parent, int64_t before) override;
+
+    bool remove_item(int64_t handle) override;
+
+    void remove_owned_by(int64_t owner) override;
+
+    bool clear_children(int64_t parent) override;
+
+    bool move_item(int64_t handle, int64_t parent, int64_t before) override;
+
+    bool reorder_children(int64_t parent, const std::vector<int64_t>& handles) override;
+
+    bool get_label(int64_t handle, std::string& label) override;
+
+    bool set_label(int64_t handle, const gchar* label) override;
+
+    void relabel(const std::unordered_map<int64_t, SharedString>& strings) override;
+
+    bool get_enabled(int64_t handle, bool& enabled) override;
+
+    bool set_enabled(int64_t handle, bool enabled) override;
+
+    bool set_icon(int64_t handle, const SharedIcon& icon) override;
+
+    bool get_checked(int64_t handle, bool& checked) override;
+
+    bool set_checked(int64_t handle, bool checked) override;
+
+    bool select_radio(int64_t group, int64_t handle) override;
+
+    bool update_item(int64_t handle, const ItemSpec& spec) override;
+
+    void reassign(int64_t from, int64_t to) override;
+
+    void walk(const Visitor& visit) override;
+
+    Footprint measure(const FootprintVisitor& visit) override;
+
+private:
+    // Items are identified on the bus by their handle's index within the tray plus one, as dbusmenu reserves 0 for the
+    // root and only has 32-bit ids. Labels bound to the string table share its text, and other labels are interned.
+    struct Node {
+        SharedString label;
+        SharedIcon icon;
+        std::string key;
+        std::vector<gint32> children;
+        int64_t owner;
+        int64_t group;
+        int64_t string_id;
+        gint32 parent;
+        MenuItemType type;
+        bool enabled;
+        bool checked;
+    };
+
+    static constexpr gint32 root_id = 0;
+
+    const int64_t index;
+    const std::string id;
+    Listener& listener;
+
+    NodeArena<Node> nodes{};
+    LabelPool labels{};
+    // The selected item of each radio group, by owner and group id.
+    std::map<std::pair<int64_t, int64_t>, gint32> selected_radios{};
+    guint32 revision = 1;
+
+    std::string icon{};
+    std::string label{};
+    std::string label_guide{};
+    std::string title{};
+    GCancellable* cancellable   = nullptr;
+    GDBusConnection* connection = nullptr;
+    guint item_registration_id  = 0;
+    guint menu_registration_id  = 0;
+    guint name_owner_id         = 0;
+    guint watcher_id            = 0;
+    guint fallback_source_id    = 0;
+    bool ready                  = false;
+
+    std::set<gint32> dirty_items{};
+    std::set<gint32> dirty_layouts{};
+    guint flush_source_id = 0;
+
+    static gint32 to_id(int64_t handle) { return static_cast<gint32>(handle & G_MAXINT32) + 1; }
+
+    // Ids drop the tray index, so handles of other trays have to be rejected before converting them.
+    bool owns(int64_t handle) const { return handle >> tray_handle_shift == index; }
+
+    int64_t to_handle(gint32 id) const { return (index << tray_handle_shift) | (id - 1); }
+
+    Node* find(int64_t handle);
+
+    Node* find_submenu(int64_t parent);
+
+    void reset_nodes();
+
+    void erase_subtree(gint32 id);
+
+    void remove_owned_by(gint32 parent_id, int64_t owner);
+
+    void walk(gint32 parent_id, const Visitor& visit) const;
+
+    void measure(gint32 parent_id, const FootprintVisitor& visit) const;
+
+    void select(gint32 id, Node& node);
+
+    void activate(gint32 id);
+
+    void track_visibility(gint32 item_id, const gchar* event_id);
+
+    GVariant* properties(gint32 id, const gchar* const* names, bool explicit_defaults) const;
+
+    GVariant* layout(gint32 id, gint32 depth, const gchar* const* names) const;
+
+    void mark_item_dirty(gint32 id);
+
+    void mark_layout_dirty(gint32 parent_id);
+
+    void flush();
+
+    void export_objects(GDBusConnection* bus);
+
+    void register_with_watcher();
+
+    void handle_menu_call(const gchar* method, GVariant* parameters, GDBusMethodInvocation* invocation);
+
+    GVariant* get_item_property(const gchar* name) const;
+
+    static void item_method_call_cb(GDBusConnection*,
+                                    const gchar*,
+                                    const gchar*,
+                                    const gchar*,
+                                    const gchar* method,
+                                    GVariant* parameters,
+                                    GDBusMethodInvocation* invocation,
+                                    gpointer user_data);
+
+    static GVariant* item_get_property_cb(GDBusConnection*,
+                                          const gchar*,
+                                          const gchar*,
+                                          const gchar*,
+                                          const gchar* name,
+                                          GError**,
+                                          gpointer user_data);
+
+    static void menu_method_call_cb(GDBusConnection*,
+                                    const gchar*,
+                                    const gchar*,
+                                    const gchar*,
+                                    const gchar* method,
+                                    GVariant* parameters,
+                                    GDBusMethodInvocation* invocation,
+                                    gpointer user_data);
+
+    static GVariant* menu_get_property_cb(GDBusConnection*,
+                                          const gchar*,
+                                          const gchar*,
+                                          const gchar*,
+                                          const gchar* name,
+                                          GError**,
+                                          gpointer user_data);
+
+    static void bus_get_cb(GObject* source, GAsyncResult* result, gpointer user_data);
+
+    static void register_cb(GObject* source, GAsyncResult* result, gpointer user_data);
+
+    static void watcher_appeared_cb(GDBusConnection*, const gchar*, const gchar*, gpointer user_data);
+
+    static void watcher_vanished_cb(GDBusConnection*, const gchar*, gpointer user_data);
+
+    static gboolean watcher_timeout_cb(gpointer user_data);
+
+    static gboolean flush_cb(gpointer user_data);
+
+    static const GDBusInterfaceVTable item_vtable;
+
+    static const GDBusInterfaceVTable menu_vtable;
+};
+
+#endif  // FLUTTER_PLUGIN_TRAY_MENU_DBUS_MENU_H_
@@ -0,0 +1,121 @@
+#include "icon_cache.h"
+
+#include <cstring>
+
+namespace {
+
+constexpr uint8_t png_signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+}  // namespace
+
+void IconCache::set_bytes(const std::string& id, const uint8_t* data, size_t length) {
+    drop(id);
+    sources[id] = {std::string(reinterpret_cast<const char*>(data), length), {}};
+}
+
+void IconCache::set_file(const std::string& id, const std::string& path) {
+    drop(id);
+    sources[id] = {{}, path};
+}
+
+void IconCache::remove(const std::string& id) {
+    drop(id);
+    sources.erase(id);
+}
+
+SharedIcon IconCache::get(const std::string& id) {
+    const auto it = index.find(id);
+    if (it != index.end()) {
+        cached.splice(cached.begin(), cached, it->second);
+        return it->second->second;
+    }
+    const auto source = sources.find(id);
+    if (source == sources.end()) {
+        return nullptr;
+    }
+    auto icon = decode(id, source->second);
+    if (!icon || capacity == 0) {
+        return icon;
+    }
+    while (cached.size() >= capacity) {
+        index.erase(cached.back().first);
+        cached.pop_back();
+    }
+    cached.emplace_front(id, icon);
+    index[id] = cached.begin();
+    return icon;
+}
+
+void IconCache::set_capacity(size_t capacity) {
+    this->capacity = capacity;
+    while (cached.size() > capacity) {
+        index.erase(cached.back().first);
+        cached.pop_back();
+    }
+}
+
+size_t IconCache::memory_bytes() const {
+    size_t bytes = (sources.bucket_count() + index.bucket_count()) * sizeof(void*);
+    for (const auto& it : sources) {
+        bytes += sizeof(it) + it.first.capacity() + it.second.bytes.capacity() + it.second.path.capacity();
+    }
+    for (const auto& entry : cached) {
+        const auto& icon = *entry.second;
+        bytes += sizeof(entry) + sizeof(Icon) + gdk_pixbuf_get_byte_length(icon.pixbuf) + g_bytes_get_size(icon.png);
+    }
+    return bytes;
+}
+
+void IconCache::drop(const std::string& id) {
+    const auto it = index.find(id);
+    if (it != index.end()) {
+        cached.erase(it->second);
+        index.erase(it);
+    }
+}
+
+// Images that are PNG already are served to dbusmenu hosts as they were registered instead of encoded again.
+SharedIcon IconCache::decode(const std::string& id, const Source& source) {
+    g_autoptr(GError) error    = nullptr;
+    g_autofree gchar* contents = nullptr;
+    const guchar* data         = reinterpret_cast<const guchar*>(source.bytes.data());
+    gsize length               = source.bytes.size();
+    if (!source.path.empty()) {
+        if (!g_file_get_contents(source.path.c_str(), &contents, &length, &error)) {
+            g_warning("tray_menu: cannot read icon %s: %s", id.c_str(), error->message);
+            return nullptr;
+        }
+        data = reinterpret_cast<const guchar*>(contents);
+    }
+
+    // The loader has to be closed even when writing fails, or it warns about it as it is finalized.
+    g_autoptr(GdkPixbufLoader) loader = gdk_pixbuf_loader_new();
+    if (!gdk_pixbuf_loader_write(loader, data, length, &error)) {
+        gdk_pixbuf_loader_close(loader, nullptr);
+        g_warning("tray_menu: cannot decode icon %s: %s", id.c_str(), error->message);
+        return nullptr;
+    }
+    if (!gdk_pixbuf_loader_close(loader, &error)) {
+        g_warning("tray_menu: cannot decode icon %s: %s", id.c_str(), error->message);
+        return nullptr;
+    }
+    const auto pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+    if (!pixbuf) {
+        return nullptr;
+    }
+
+    GBytes* png = nullptr;
+    if (length >= sizeof(png_signature) && memcmp(data, png_signature, sizeof(png_signature)) == 0) {
+        png = g_bytes_new(data, length);
+    } else {
+        gchar* buffer = nullptr;
+        gsize size    = 0;
+        if (!gdk_pixbuf_save_to_buffer(pixbuf, &buffer, &size, "png", &error, nullptr)) {
+            g_warning("tray_menu: cannot encode icon %s: %s", id.c_str(), error->message);
+            return nullptr;
+        }
+        png = g_bytes_new_take(buffer, size);
+    }
+    ++decode_count;
+    return std::make_shared<const Icon>(id, GDK_PIXBUF(g_object_ref(pixbuf)), png);
+}
@@ -0,0 +1,85 @@
+#ifndef FLUTTER_PLUGIN_TRAY_MENU_ICON_CACHE_H_
+#define FLUTTER_PLUGIN_TRAY_MENU_ICON_CACHE_H_
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "tray_backend.h"
+
+// A decoded image, shared by every item showing it. Items keep it alive on their own, so it stays valid for them after
+// the cache has dropped it.
+struct Icon {
+    Icon(std::string id, GdkPixbuf* pixbuf, GBytes* png) : id{std::move(id)}, pixbuf{pixbuf}, png{png} {}
+
+    ~Icon() {
+        g_object_unref(pixbuf);
+        g_bytes_unref(png);
+    }
+
+    Icon(const Icon&)            = delete;
+    Icon& operator=(const Icon&) = delete;
+
+    // The id it was registered under.
+    const std::string id;
+    // What the gtk backend draws.
+    GdkPixbuf* const pixbuf;
+    // The image encoded as PNG, which is what dbusmenu hosts expect.
+    GBytes* const png;
+};
+
+// Images items can show as icons, registered once by id from encoded bytes or a file and decoded the first time an
+// item shows them. Decoded images stay cached for the next items showing them, as many as the capacity allows; the one
+// used least recently makes room for the next one decoded, and is decoded again if it is shown after that.
+class IconCache {
+public:
+    static constexpr size_t default_capacity = 64;
+
+    // Registers an image under id, replacing the one registered under it before. Items already showing that one keep
+    // it until their icon is set again.
+    void set_bytes(const std::string& id, const uint8_t* data, size_t length);
+
+    void set_file(const std::string& id, const std::string& path);
+
+    void remove(const std::string& id);
+
+    // Returns the image registered under id, decoding it unless it is cached, or null if there is none or it can't be
+    // decoded.
+    SharedIcon get(const std::string& id);
+
+    void set_capacity(size_t capacity);
+
+    // How many images were decoded so far, including those decoded again after they were dropped.
+    size_t decodes() const { return decode_count; }
+
+    // The memory held by the registered images and the decoded ones still cached.
+    size_t memory_bytes() const;
+
+private:
+    // Either the encoded image or the path of the file holding it.
+    struct Source {
+        std::string bytes;
+        std::string path;
+    };
+
+    using Entry = std::pair<std::string, SharedIcon>;
+
+    std::unordered_map<std::string, Source> sources{};
+    // Most recently used first.
+    std::list<Entry> cached{};
+    std::unordered_map<std::string, std::list<Entry>::iterator> index{};
+    size_t capacity     = default_capacity;
+    size_t decode_count = 0;
+
+    void drop(const std::string& id);
+
+    SharedIcon decode(const std::string& id, const Source& source);
+};
+
+#endif  // FLUTTER_PLUGIN_TRAY_MENU_ICON_CACHE_H_
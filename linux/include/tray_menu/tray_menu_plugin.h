@@ -21,6 +21,109 @@ FLUTTER_PLUGIN_EXPORT GType tray_menu_plugin_get_type();
 FLUTTER_PLUGIN_EXPORT void tray_menu_plugin_register_with_registrar(
     FlPluginRegistrar* registrar);
 
+// Item types accepted by tray_menu_add_item.
+#define TRAY_MENU_ITEM_LABEL 0
+#define TRAY_MENU_ITEM_SEPARATOR 1
+#define TRAY_MENU_ITEM_CHECKBOX 2
+#define TRAY_MENU_ITEM_SUBMENU 3
+#define TRAY_MENU_ITEM_RADIO 4
+
+// Synchronous fast path for the hot menu operations, bound by the Dart FFI
+// platform implementation. Labels are UTF-8 and need not be NUL-terminated.
+// Pass -1 as submenu/before for the top-level menu of tray/appending; tray is
+// ignored when adding to a submenu, whose handle identifies its tray.
+//
+// These functions can be called from any thread. Calls made on the GTK main
+// thread are applied immediately. Calls from any other thread are pushed onto
+// a lock-free queue, applied in order by the main loop in batches where
+// repeated updates of the same property collapse into the last one, and
+// optimistically report success. Those that turn out to fail are reported as
+// an operationFailed event on tray_menu/events, to the engine that added the
+// item or, for the other calls, to every engine using the tray.
+
+// Returns the new item's handle, or -1 if the parent submenu is invalid.
+// engine is the id returned by the calling engine's init method call; the
+// item is removed when that engine is torn down and its activations are only
+// reported to that engine. Pass 0 to report them to every engine.
+// group is only used by radio items, which are grouped by engine and group
+// within their tray; the first one added to a group, or any added checked, is
+// selected. Pass -1 for other items.
+// string_id binds the label to that entry of the string table, in which case
+// label is ignored; pass -1 to use label. key is the item's key within its
+// menu, saved in menu snapshots and listed by getManifest; it may be empty.
+FLUTTER_PLUGIN_EXPORT gint64 tray_menu_add_item(gint64 engine,
+                                                gint64 tray,
+                                                gint32 type,
+                                                const gchar* label,
+                                                gsize label_length,
+                                                const gchar* key,
+                                                gsize key_length,
+                                                gboolean enabled,
+                                                gboolean checked,
+                                                gint64 group,
+                                                gint64 string_id,
+                                                gint64 submenu,
+                                                gint64 before);
+
+// The setters below return FALSE if the handle does not name a suitable item.
+FLUTTER_PLUGIN_EXPORT gboolean tray_menu_remove_item(gint64 handle);
+
+// Removes every item of submenu, or of the top-level menu of tray, along with
+// everything nested in them, in one operation.
+FLUTTER_PLUGIN_EXPORT gboolean tray_menu_clear_children(gint64 tray,
+                                                        gint64 submenu);
+
+// Moves handle in front of before in submenu, or in the top-level menu of
+// tray, keeping its handle, state and activation callback. Items cannot move
+// to another tray, or into themselves.
+FLUTTER_PLUGIN_EXPORT gboolean tray_menu_move_item(gint64 handle,
+                                                   gint64 tray,
+                                                   gint64 submenu,
+                                                   gint64 before);
+
+// Moves the count items in handles, all children of submenu or of the
+// top-level menu of their tray, to its front in that order. The remaining
+// children keep their order after them.
+FLUTTER_PLUGIN_EXPORT gboolean tray_menu_reorder_children(gint64 submenu,
+                                                          const gint64* handles,
+                                                          gsize count);
+
+FLUTTER_PLUGIN_EXPORT gboolean tray_menu_set_label(gint64 handle,
+                                                   const gchar* label,
+                                                   gsize label_length);
+
+FLUTTER_PLUGIN_EXPORT gboolean tray_menu_set_enabled(gint64 handle,
+                                                     gboolean enabled);
+
+FLUTTER_PLUGIN_EXPORT gboolean tray_menu_set_checked(gint64 handle,
+                                                     gboolean checked);
+
+// Selects the radio item handle, which must belong to group, and deselects
+// the rest of its group in the same operation.
+FLUTTER_PLUGIN_EXPORT gboolean tray_menu_select_radio(gint64 group,
+                                                      gint64 handle);
+
+// Sets the text of count entries of the string table shared by every tray.
+// Entry i has id ids[i] and the next lengths[i] bytes of texts, which holds
+// the texts back to back. Every label bound to a changed entry is updated in
+// the same operation, and setting a label directly unbinds it.
+FLUTTER_PLUGIN_EXPORT gboolean tray_menu_set_strings(const gint64* ids,
+                                                     const gchar* texts,
+                                                     const gsize* lengths,
+                                                     gsize count);
+
+// Sets the counter name, or adds delta to it, for the label templates that
+// show it. name is UTF-8 and need not be NUL-terminated. Counters can be
+// updated as often as needed: labels are only rendered again while a menu is
+// visible, at most once per main loop iteration.
+FLUTTER_PLUGIN_EXPORT gboolean tray_menu_set_counter(const gchar* name,
+                                                     gsize name_length,
+                                                     gint64 value);
+
+FLUTTER_PLUGIN_EXPORT gboolean tray_menu_add_to_counter(const gchar* name,
+                                                        gsize name_length,
+                                                        gint64 delta);
+
 G_END_DECLS
 
 #endif  // FLUTTER_PLUGIN_TRAY_MENU_PLUGIN_H_
@@ -0,0 +1,124 @@
+#include "label_template.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace label_template {
+
+namespace {
+
+struct Placeholder {
+    const char* prefix;
+    Template::Segment::Kind kind;
+};
+
+constexpr Placeholder placeholders[] = {
+        {"elapsed:", Template::Segment::Kind::elapsed},
+        {"count:", Template::Segment::Kind::count},
+};
+
+void append_text(Template& parsed, const char* text, size_t length) {
+    auto& segments = parsed.segments;
+    if (segments.empty() || segments.back().kind != Template::Segment::Kind::text) {
+        segments.push_back({Template::Segment::Kind::text, {}});
+    }
+    segments.back().text.append(text, length);
+}
+
+}  // namespace
+
+bool Template::uses_clock() const {
+    return std::any_of(segments.begin(), segments.end(), [](const Segment& segment) {
+        return segment.kind == Segment::Kind::elapsed;
+    });
+}
+
+std::string Template::render(const Sources& sources, gint64 now_us) const {
+    std::string text;
+    for (const auto& segment : segments) {
+        switch (segment.kind) {
+            case Segment::Kind::text:
+                text += segment.text;
+                break;
+            case Segment::Kind::elapsed: {
+                const auto clock = sources.clocks.find(segment.text);
+                if (clock != sources.clocks.end()) {
+                    text += format_elapsed(now_us - clock->second);
+                }
+                break;
+            }
+            case Segment::Kind::count: {
+                const auto counter = sources.counters.find(segment.text);
+                text += format_count(counter != sources.counters.end() ? counter->second : 0);
+                break;
+            }
+        }
+    }
+    return text;
+}
+
+Template parse(const std::string& text) {
+    Template parsed;
+    const auto data   = text.data();
+    const auto length = text.size();
+    size_t i          = 0;
+    while (i < length) {
+        const auto brace = text.find_first_of("{}", i);
+        if (brace == std::string::npos) {
+            append_text(parsed, data + i, length - i);
+            break;
+        }
+        append_text(parsed, data + i, brace - i);
+        if (brace + 1 < length && data[brace + 1] == data[brace]) {
+            append_text(parsed, data + brace, 1);
+            i = brace + 2;
+            continue;
+        }
+        const auto close = data[brace] == '{' ? text.find('}', brace + 1) : std::string::npos;
+        bool matched     = false;
+        if (close != std::string::npos) {
+            for (const auto& placeholder : placeholders) {
+                const auto name = brace + 1 + strlen(placeholder.prefix);
+                if (text.compare(brace + 1, name - brace - 1, placeholder.prefix) == 0 && name < close) {
+                    parsed.segments.push_back({placeholder.kind, text.substr(name, close - name)});
+                    matched = true;
+                    break;
+                }
+            }
+        }
+        if (matched) {
+            i = close + 1;
+        } else {
+            append_text(parsed, data + brace, 1);
+            i = brace + 1;
+        }
+    }
+    return parsed;
+}
+
+std::string format_elapsed(gint64 elapsed_us) {
+    const gint64 seconds = std::max<gint64>(0, elapsed_us / G_USEC_PER_SEC);
+    const gint64 days    = seconds / 86400;
+    const gint64 hours   = seconds / 3600 % 24;
+    const gint64 minutes = seconds / 60 % 60;
+
+    g_autofree gchar* text = nullptr;
+    if (days > 0) {
+        text = g_strdup_printf("%" G_GINT64_FORMAT "d %" G_GINT64_FORMAT "h", days, hours);
+    } else if (hours > 0) {
+        text = g_strdup_printf("%" G_GINT64_FORMAT "h %" G_GINT64_FORMAT "m", hours, minutes);
+    } else if (minutes > 0) {
+        text = g_strdup_printf("%" G_GINT64_FORMAT "m %" G_GINT64_FORMAT "s", minutes, seconds % 60);
+    } else {
+        text = g_strdup_printf("%" G_GINT64_FORMAT "s", seconds);
+    }
+    return text;
+}
+
+// The ' flag groups the digits with the thousands separator of LC_NUMERIC, if it has one.
+std::string format_count(int64_t count) {
+    g_autofree gchar* text = g_strdup_printf("%'" G_GINT64_FORMAT, static_cast<gint64>(count));
+    return text;
+}
+
+}  // namespace label_template
@@ -0,0 +1,51 @@
+#ifndef FLUTTER_PLUGIN_TRAY_MENU_LABEL_TEMPLATE_H_
+#define FLUTTER_PLUGIN_TRAY_MENU_LABEL_TEMPLATE_H_
+
+#include <glib.h>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Label templates render the text of an entry of the string table natively from named sources, so labels such as
+// "Uptime {elapsed:uptime}" or "Queue: {count:jobs} jobs" stay current without Dart setting them over and over.
+//
+// {elapsed:name} is the time since the clock name was started, shown in its two largest units ("5s", "12m 5s",
+// "3h 12m", "2d 3h"). {count:name} is the value of the counter name, with digits grouped as the locale does. Clocks
+// that were never started show no time and counters that were never set show 0. {{ and }} stand for single braces,
+// and anything else between braces is kept as it is.
+namespace label_template {
+
+// The current values of the sources templates refer to, by name.
+struct Sources {
+    std::unordered_map<std::string, int64_t> counters{};
+    // The monotonic time each clock was started at, in microseconds.
+    std::unordered_map<std::string, gint64> clocks{};
+};
+
+struct Template {
+    struct Segment {
+        enum class Kind : uint8_t { text, elapsed, count };
+
+        Kind kind;
+        // The literal text, or the name of the source.
+        std::string text;
+    };
+
+    std::vector<Segment> segments{};
+
+    bool uses_clock() const;
+
+    std::string render(const Sources& sources, gint64 now_us) const;
+};
+
+Template parse(const std::string& text);
+
+std::string format_elapsed(gint64 elapsed_us);
+
+std::string format_count(int64_t count);
+
+}  // namespace label_template
+
+#endif  // FLUTTER_PLUGIN_TRAY_MENU_LABEL_TEMPLATE_H_
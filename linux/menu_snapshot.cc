@@ -0,0 +1,214 @@
+#include "menu_snapshot.h"
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <unordered_map>
+
+namespace menu_snapshot {
+
+namespace {
+
+struct StringRef {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    // The CRC-32 of the header with this field set to zero.
+    uint32_t header_crc;
+    int64_t tray;
+    uint32_t item_count;
+    uint32_t strings_size;
+    // The CRC-32 of the records followed by the string pool.
+    uint32_t body_crc;
+    StringRef id;
+    StringRef icon;
+    uint32_t reserved;
+};
+
+struct Record {
+    int32_t parent;
+    uint8_t type;
+    uint8_t flags;
+    uint16_t reserved;
+    int64_t group;
+    StringRef key;
+    StringRef label;
+};
+
+// Neither struct has implicit padding, so encoded snapshots are fully determined by their contents, and records stay
+// 8-byte aligned in a mapping.
+static_assert(sizeof(Header) == 56, "Header must not have implicit padding");
+static_assert(sizeof(Record) == 32, "Record must not have implicit padding");
+
+constexpr uint8_t flag_enabled = 1 << 0;
+constexpr uint8_t flag_checked = 1 << 1;
+
+// Stores every distinct string once, as labels like "Open" tend to repeat across submenus.
+struct StringPool {
+    std::string bytes{};
+    std::unordered_map<std::string, StringRef> refs{};
+
+    StringRef add(const std::string& value) {
+        const auto it = refs.find(value);
+        if (it != refs.end()) {
+            return it->second;
+        }
+        const StringRef ref{static_cast<uint32_t>(bytes.size()), static_cast<uint32_t>(value.size())};
+        bytes += value;
+        refs.insert({value, ref});
+        return ref;
+    }
+};
+
+}  // namespace
+
+uint32_t crc32(const void* data, size_t length, uint32_t crc) {
+    static const auto table = [] {
+        std::array<uint32_t, 256> entries{};
+        for (uint32_t i = 0; i < entries.size(); ++i) {
+            auto value = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                value = value & 1 ? 0xedb88320u ^ (value >> 1) : value >> 1;
+            }
+            entries[i] = value;
+        }
+        return entries;
+    }();
+
+    const auto bytes = static_cast<const uint8_t*>(data);
+    crc              = ~crc;
+    for (size_t i = 0; i < length; ++i) {
+        crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+std::string directory() {
+    const auto application = g_get_prgname();
+    g_autofree gchar* path =
+            g_build_filename(g_get_user_cache_dir(), "tray_menu", application ? application : "default", nullptr);
+    return path;
+}
+
+std::string path_for(int64_t tray) {
+    g_autofree gchar* name = g_strdup_printf("tray-%" G_GINT64_FORMAT "%s", tray, suffix);
+    g_autofree gchar* path = g_build_filename(directory().c_str(), name, nullptr);
+    return path;
+}
+
+std::string encode(const Snapshot& snapshot) {
+    StringPool strings;
+    Header header{};
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version    = version;
+    header.tray       = snapshot.tray;
+    header.item_count = static_cast<uint32_t>(snapshot.items.size());
+    header.id         = strings.add(snapshot.id);
+    header.icon       = strings.add(snapshot.icon);
+
+    std::vector<Record> records(snapshot.items.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        const auto& item = snapshot.items[i];
+        auto& record     = records[i];
+        record.parent    = item.parent;
+        record.type      = static_cast<uint8_t>(item.type);
+        record.flags     = (item.enabled ? flag_enabled : 0) | (item.checked ? flag_checked : 0);
+        record.group     = item.group;
+        record.key       = strings.add(item.key);
+        record.label     = strings.add(item.label);
+    }
+    const auto records_size = records.size() * sizeof(Record);
+    header.strings_size     = static_cast<uint32_t>(strings.bytes.size());
+    header.body_crc         = crc32(strings.bytes.data(), strings.bytes.size(), crc32(records.data(), records_size));
+    header.header_crc       = crc32(&header, sizeof(header));
+
+    std::string bytes;
+    bytes.reserve(sizeof(header) + records_size + strings.bytes.size());
+    bytes.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    bytes.append(reinterpret_cast<const char*>(records.data()), records_size);
+    bytes += strings.bytes;
+    return bytes;
+}
+
+bool write(const std::string& path, const std::string& bytes) {
+    g_autofree gchar* parent = g_path_get_dirname(path.c_str());
+    if (g_mkdir_with_parents(parent, 0700) != 0) {
+        g_warning("tray_menu: cannot create %s: %s", parent, g_strerror(errno));
+        return false;
+    }
+    g_autoptr(GError) error = nullptr;
+    if (!g_file_set_contents(path.c_str(), bytes.data(), static_cast<gssize>(bytes.size()), &error)) {
+        g_warning("tray_menu: cannot save the menu snapshot: %s", error->message);
+        return false;
+    }
+    return true;
+}
+
+// The records and strings are read in place from the mapping, which is page-aligned.
+bool read(const gchar* path, Snapshot& snapshot) {
+    g_autoptr(GMappedFile) file = g_mapped_file_new(path, FALSE, nullptr);
+    if (!file) {
+        return false;
+    }
+    const auto data = g_mapped_file_get_contents(file);
+    const auto size = g_mapped_file_get_length(file);
+    if (!data || size < sizeof(Header)) {
+        return false;
+    }
+
+    Header header;
+    memcpy(&header, data, sizeof(header));
+    const auto header_crc = header.header_crc;
+    header.header_crc     = 0;
+    if (memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version ||
+        crc32(&header, sizeof(header)) != header_crc) {
+        return false;
+    }
+    const auto records_size = static_cast<uint64_t>(header.item_count) * sizeof(Record);
+    if (sizeof(Header) + records_size + header.strings_size != size ||
+        crc32(data + sizeof(Header), size - sizeof(Header)) != header.body_crc) {
+        return false;
+    }
+
+    const auto records = reinterpret_cast<const Record*>(data + sizeof(Header));
+    const auto strings = data + sizeof(Header) + records_size;
+    const auto get     = [&](const StringRef& ref, std::string& value) {
+        if (static_cast<uint64_t>(ref.offset) + ref.length > header.strings_size ||
+            !g_utf8_validate(strings + ref.offset, ref.length, nullptr)) {
+            return false;
+        }
+        value.assign(strings + ref.offset, ref.length);
+        return true;
+    };
+
+    snapshot.tray = header.tray;
+    if (!get(header.id, snapshot.id) || !get(header.icon, snapshot.icon)) {
+        return false;
+    }
+    snapshot.items.resize(header.item_count);
+    for (uint32_t i = 0; i < header.item_count; ++i) {
+        const auto& record = records[i];
+        auto& item         = snapshot.items[i];
+        // Parents come first and have to be submenus, so the tree can be rebuilt in a single pass.
+        if (record.parent < -1 || record.parent >= static_cast<int32_t>(i) ||
+            (record.parent >= 0 && snapshot.items[record.parent].type != MenuItemType::submenu) ||
+            record.type > TRAY_MENU_ITEM_RADIO) {
+            return false;
+        }
+        item.parent  = record.parent;
+        item.type    = static_cast<MenuItemType>(record.type);
+        item.enabled = record.flags & flag_enabled;
+        item.checked = record.flags & flag_checked;
+        item.group   = record.group;
+        if (!get(record.key, item.key) || !get(record.label, item.label)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace menu_snapshot
@@ -0,0 +1,60 @@
+#ifndef FLUTTER_PLUGIN_TRAY_MENU_MENU_SNAPSHOT_H_
+#define FLUTTER_PLUGIN_TRAY_MENU_MENU_SNAPSHOT_H_
+
+#include <glib.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "tray_backend.h"
+
+// A binary snapshot of a tray's menu, saved when Dart commits the menu and restored when the plugin is registered at
+// the next launch, so the tray shows its last committed menu before Dart has run.
+//
+// The file is laid out to be read in place from a mapping: a fixed-size header, then one fixed-size record per item,
+// parents before their children, then a pool of the strings the header and records refer to by offset and length. The
+// header carries a CRC-32 of itself and one of everything after it, so truncated or corrupted files are rejected as a
+// whole. Integers are in host byte order, as snapshots never leave the machine that wrote them.
+namespace menu_snapshot {
+
+constexpr char magic[8]       = {'T', 'M', 'S', 'N', 'A', 'P', 0, 0};
+constexpr uint32_t version    = 1;
+constexpr const gchar* suffix = ".snapshot";
+
+struct Item {
+    // The index of the parent item, or -1 for the top-level menu.
+    int32_t parent    = -1;
+    MenuItemType type = MenuItemType::label;
+    bool enabled      = true;
+    bool checked      = false;
+    int64_t group     = -1;
+    std::string key{};
+    std::string label{};
+};
+
+struct Snapshot {
+    int64_t tray = 0;
+    std::string id{};
+    std::string icon{};
+    std::vector<Item> items{};
+};
+
+uint32_t crc32(const void* data, size_t length, uint32_t crc = 0);
+
+// The directory this application's snapshots are kept in, under the user's cache directory.
+std::string directory();
+
+std::string path_for(int64_t tray);
+
+std::string encode(const Snapshot& snapshot);
+
+// Writes the encoded snapshot atomically, so a crash mid-write leaves the previous snapshot in place.
+bool write(const std::string& path, const std::string& bytes);
+
+// Returns false, leaving snapshot in an unspecified state, if the file is missing, of another version or invalid.
+bool read(const gchar* path, Snapshot& snapshot);
+
+}  // namespace menu_snapshot
+
+#endif  // FLUTTER_PLUGIN_TRAY_MENU_MENU_SNAPSHOT_H_
@@ -0,0 +1,241 @@
+#ifndef FLUTTER_PLUGIN_TRAY_MENU_NODE_ARENA_H_
+#define FLUTTER_PLUGIN_TRAY_MENU_NODE_ARENA_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "tray_backend.h"
+
+// Stores the nodes of a menu model by id in chunks of slots, which are recycled through a free list and indexed by an
+// open-addressing hash table. Once the arena has grown to the size of the menu, adding and removing nodes allocates
+// nothing of its own, and clearing a large menu frees a handful of chunks instead of every node. A node's address is
+// stable until it is erased. Iteration follows the slots, not the ids.
+template<typename T, size_t chunk_size = 256>
+class NodeArena {
+public:
+    NodeArena() = default;
+
+    ~NodeArena() { clear(); }
+
+    NodeArena(const NodeArena&)            = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    size_t size() const { return live; }
+
+    // The memory held by the arena itself, including the slots of nodes erased or not added yet.
+    size_t memory_bytes() const {
+        return chunks.size() * chunk_size * sizeof(Slot) + chunks.capacity() * sizeof(chunks[0]) +
+               (free_slots.capacity() + table.capacity()) * sizeof(uint32_t);
+    }
+
+    T* find(int32_t id) {
+        const auto position = find_position(id);
+        return position != npos ? &slot_at(table[position] - 1).value : nullptr;
+    }
+
+    const T* find(int32_t id) const { return const_cast<NodeArena*>(this)->find(id); }
+
+    bool count(int32_t id) const { return find(id) != nullptr; }
+
+    // The node has to exist.
+    T& at(int32_t id) { return *find(id); }
+
+    const T& at(int32_t id) const { return *find(id); }
+
+    // Returns null, leaving the arena unchanged, if id is taken.
+    T* insert(int32_t id, T value) {
+        if (find_position(id) != npos) {
+            return nullptr;
+        }
+        if ((occupied + 1) * 2 > table.size()) {
+            rehash(std::max<size_t>(16, (live + 1) * 4));
+        }
+        const auto index = allocate_slot();
+        auto& slot       = slot_at(index);
+        new (&slot.value) T(std::move(value));
+        slot.id   = id;
+        slot.live = true;
+
+        auto position = hash(id) & (table.size() - 1);
+        while (table[position] != empty && table[position] != tombstone) {
+            position = (position + 1) & (table.size() - 1);
+        }
+        occupied += table[position] == empty;
+        table[position] = index + 1;
+        ++live;
+        return &slot.value;
+    }
+
+    bool erase(int32_t id) {
+        const auto position = find_position(id);
+        if (position == npos) {
+            return false;
+        }
+        const auto index = table[position] - 1;
+        table[position]  = tombstone;
+        auto& slot       = slot_at(index);
+        slot.value.~T();
+        slot.live = false;
+        free_slots.push_back(index);
+        --live;
+        return true;
+    }
+
+    void clear() {
+        for (uint32_t i = 0; i < allocated; ++i) {
+            auto& slot = slot_at(i);
+            if (slot.live) {
+                slot.value.~T();
+            }
+        }
+        chunks.clear();
+        free_slots.clear();
+        table.clear();
+        allocated = 0;
+        occupied  = 0;
+        live      = 0;
+    }
+
+    // Calls f(id, node) for every node.
+    template<typename F>
+    void for_each(F&& f) {
+        for (uint32_t i = 0; i < allocated; ++i) {
+            auto& slot = slot_at(i);
+            if (slot.live) {
+                f(slot.id, slot.value);
+            }
+        }
+    }
+
+private:
+    struct Slot {
+        Slot() {}
+
+        ~Slot() {}
+
+        union {
+            T value;
+        };
+        int32_t id = 0;
+        bool live  = false;
+    };
+
+    // Table entries hold a slot index plus one.
+    static constexpr uint32_t empty     = 0;
+    static constexpr uint32_t tombstone = UINT32_MAX;
+    static constexpr size_t npos        = SIZE_MAX;
+
+    std::vector<std::unique_ptr<Slot[]>> chunks{};
+    std::vector<uint32_t> free_slots{};
+    std::vector<uint32_t> table{};
+    uint32_t allocated = 0;
+    // Table entries that are not empty, including tombstones.
+    size_t occupied = 0;
+    size_t live     = 0;
+
+    static size_t hash(int32_t id) { return static_cast<uint32_t>(id) * 2654435761u; }
+
+    Slot& slot_at(uint32_t index) { return chunks[index / chunk_size][index % chunk_size]; }
+
+    const Slot& slot_at(uint32_t index) const { return chunks[index / chunk_size][index % chunk_size]; }
+
+    size_t find_position(int32_t id) const {
+        if (table.empty()) {
+            return npos;
+        }
+        const auto mask = table.size() - 1;
+        for (auto position = hash(id) & mask;; position = (position + 1) & mask) {
+            const auto entry = table[position];
+            if (entry == empty) {
+                return npos;
+            }
+            if (entry != tombstone && slot_at(entry - 1).id == id) {
+                return position;
+            }
+        }
+    }
+
+    uint32_t allocate_slot() {
+        if (!free_slots.empty()) {
+            const auto index = free_slots.back();
+            free_slots.pop_back();
+            return index;
+        }
+        if (allocated % chunk_size == 0) {
+            chunks.emplace_back(new Slot[chunk_size]);
+        }
+        return allocated++;
+    }
+
+    // Rebuilds the table with the given power-of-two size, dropping the tombstones.
+    void rehash(size_t minimum) {
+        size_t size = 16;
+        while (size < minimum) {
+            size *= 2;
+        }
+        table.assign(size, empty);
+        occupied = 0;
+        for (uint32_t i = 0; i < allocated; ++i) {
+            if (!slot_at(i).live) {
+                continue;
+            }
+            auto position = hash(slot_at(i).id) & (size - 1);
+            while (table[position] != empty) {
+                position = (position + 1) & (size - 1);
+            }
+            table[position] = i + 1;
+            ++occupied;
+        }
+    }
+};
+
+// Keeps one copy of every distinct label text, shared by all the items showing it. Texts no item uses anymore are
+// dropped whenever the pool has doubled in size since they were last collected.
+class LabelPool {
+public:
+    SharedString intern(const std::string& text) {
+        const auto it = texts.find(text);
+        if (it != texts.end()) {
+            return it->second;
+        }
+        if (texts.size() >= next_collection) {
+            collect();
+            next_collection = std::max<size_t>(64, texts.size() * 2);
+        }
+        auto shared = std::make_shared<const std::string>(text);
+        texts.insert({*shared, shared});
+        return shared;
+    }
+
+    void clear() { texts.clear(); }
+
+    // The memory held by the texts, which aren't counted against the items showing them.
+    size_t memory_bytes() const {
+        size_t bytes = texts.bucket_count() * sizeof(void*);
+        for (const auto& it : texts) {
+            bytes += sizeof(it) + sizeof(std::string) + it.first.size() + sizeof(void*);
+        }
+        return bytes;
+    }
+
+private:
+    // Keys view the text their value owns.
+    std::unordered_map<std::string_view, SharedString> texts{};
+    size_t next_collection = 64;
+
+    void collect() {
+        for (auto it = texts.begin(); it != texts.end();) {
+            it = it->second.use_count() == 1 ? texts.erase(it) : std::next(it);
+        }
+    }
+};
+
+#endif  // FLUTTER_PLUGIN_TRAY_MENU_NODE_ARENA_H_
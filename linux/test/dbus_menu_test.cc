@@ -0,0 +1,242 @@
+#include <gio/gio.h>
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dbus_menu.h"
+
+// Checks what a host sees of the dbusmenu backend on a private session bus: which signals announce which changes, and
+// that changes made within one main loop iteration are announced together.
+
+namespace tray_menu {
+namespace test {
+
+namespace {
+
+constexpr guint timeout_ms = 5000;
+
+struct NullListener : TrayBackend::Listener {
+    void on_status(const gchar*) override {}
+
+    void on_activate(int64_t, int64_t, gint64) override {}
+
+    void on_menu_visible(int64_t, bool) override {}
+};
+
+// Runs the main loop until done returns true, or until the timeout passes, in which case it returns false.
+template<typename Done>
+bool run_until(Done done, guint timeout = timeout_ms) {
+    bool timed_out        = false;
+    const auto timeout_id = g_timeout_add(
+            timeout,
+            [](gpointer user_data) {
+                *static_cast<bool*>(user_data) = true;
+                return G_SOURCE_REMOVE;
+            },
+            &timed_out);
+    while (!done() && !timed_out) {
+        g_main_context_iteration(nullptr, TRUE);
+    }
+    if (!timed_out) {
+        g_source_remove(timeout_id);
+    }
+    return !timed_out;
+}
+
+ItemSpec label_spec(const gchar* label, MenuItemType type = MenuItemType::label) {
+    ItemSpec spec;
+    spec.type  = type;
+    spec.label = label;
+    return spec;
+}
+
+}  // namespace
+
+class DBusMenuTrayTest : public testing::Test {
+protected:
+    // One bus serves the whole suite: the connection GDBus shares per process exits the process if its bus goes away,
+    // so the bus is only taken down once every tray has let go of it.
+    static void SetUpTestSuite() {
+        g_autofree gchar* daemon = g_find_program_in_path("dbus-daemon");
+        if (daemon) {
+            bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+            g_test_dbus_up(bus);
+        }
+    }
+
+    static void TearDownTestSuite() {
+        if (bus) {
+            g_test_dbus_down(bus);
+            g_clear_object(&bus);
+        }
+    }
+
+    void SetUp() override {
+        if (!bus) {
+            GTEST_SKIP() << "dbus-daemon is needed for a private session bus";
+        }
+        host = g_dbus_connection_new_for_address_sync(
+                g_test_dbus_get_bus_address(bus),
+                static_cast<GDBusConnectionFlags>(G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                  G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+                nullptr,
+                nullptr,
+                nullptr);
+        ASSERT_NE(host, nullptr);
+        subscription = g_dbus_connection_signal_subscribe(host,
+                                                          nullptr,
+                                                          "com.canonical.dbusmenu",
+                                                          nullptr,
+                                                          "/MenuBar",
+                                                          nullptr,
+                                                          G_DBUS_SIGNAL_FLAGS_NONE,
+                                                          signal_cb,
+                                                          this,
+                                                          nullptr);
+        tray = std::make_unique<DBusMenuTray>(0, "test", listener);
+    }
+
+    void TearDown() override {
+        tray.reset();
+        if (host) {
+            g_dbus_connection_signal_unsubscribe(host, subscription);
+            g_clear_object(&host);
+        }
+        clear_signals();
+        // Lets the calls cancelled with the tray complete, so that they release the shared connection.
+        while (g_main_context_iteration(nullptr, FALSE)) {
+        }
+    }
+
+    // Shows the tray and waits until its menu is exported, which is when it starts announcing changes.
+    void show() {
+        tray->show("icon");
+        g_autofree gchar* name = g_strdup_printf("org.kde.StatusNotifierItem-%d-1", getpid());
+        ASSERT_TRUE(run_until([&] {
+            g_autoptr(GVariant) reply = g_dbus_connection_call_sync(host,
+                                                                    "org.freedesktop.DBus",
+                                                                    "/org/freedesktop/DBus",
+                                                                    "org.freedesktop.DBus",
+                                                                    "NameHasOwner",
+                                                                    g_variant_new("(s)", name),
+                                                                    G_VARIANT_TYPE("(b)"),
+                                                                    G_DBUS_CALL_FLAGS_NONE,
+                                                                    -1,
+                                                                    nullptr,
+                                                                    nullptr);
+            gboolean owned = FALSE;
+            if (reply) {
+                g_variant_get(reply, "(b)", &owned);
+            }
+            if (!owned) {
+                g_main_context_iteration(nullptr, FALSE);
+            }
+            return owned;
+        }));
+    }
+
+    // Waits for the first signal, then gives any that follow it as long again to arrive, so that a change announced
+    // more than once shows up as more than one signal.
+    void wait_for_signals() {
+        const auto start = g_get_monotonic_time();
+        ASSERT_TRUE(run_until([&] { return !signals.empty(); }));
+        const auto waited_ms = static_cast<guint>((g_get_monotonic_time() - start) / 1000);
+        run_until([] { return false; }, std::max(100u, waited_ms));
+    }
+
+    void clear_signals() {
+        for (auto& signal : signals) {
+            g_variant_unref(signal.second);
+        }
+        signals.clear();
+    }
+
+    static void signal_cb(GDBusConnection*,
+                          const gchar*,
+                          const gchar*,
+                          const gchar*,
+                          const gchar* name,
+                          GVariant* parameters,
+                          gpointer user_data) {
+        static_cast<DBusMenuTrayTest*>(user_data)->signals.emplace_back(name, g_variant_ref(parameters));
+    }
+
+    static GTestDBus* bus;
+
+    NullListener listener;
+    std::unique_ptr<DBusMenuTray> tray;
+    GDBusConnection* host = nullptr;
+    guint subscription    = 0;
+    std::vector<std::pair<std::string, GVariant*>> signals;
+};
+
+GTestDBus* DBusMenuTrayTest::bus = nullptr;
+
+TEST_F(DBusMenuTrayTest, AnnouncesAddsWithLayoutUpdatedForTheirParent) {
+    show();
+    ASSERT_TRUE(tray->add_item(0, 0, label_spec("Hosts", MenuItemType::submenu), -1, -1));
+    wait_for_signals();
+    ASSERT_EQ(signals.size(), 1u);
+    EXPECT_EQ(signals[0].first, "LayoutUpdated");
+    guint32 revision = 0;
+    gint32 parent    = -1;
+    g_variant_get(signals[0].second, "(ui)", &revision, &parent);
+    EXPECT_EQ(parent, 0);
+
+    clear_signals();
+    ASSERT_TRUE(tray->add_item(1, 0, label_spec("first"), 0, -1));
+    ASSERT_TRUE(tray->add_item(2, 0, label_spec("second"), 0, -1));
+    wait_for_signals();
+    ASSERT_EQ(signals.size(), 1u);
+    EXPECT_EQ(signals[0].first, "LayoutUpdated");
+    guint32 next_revision = 0;
+    g_variant_get(signals[0].second, "(ui)", &next_revision, &parent);
+    // The submenu is item 1 on the bus, as ids are handles plus one.
+    EXPECT_EQ(parent, 1);
+    EXPECT_GT(next_revision, revision);
+}
+
+TEST_F(DBusMenuTrayTest, CoalescesPropertyChangesIntoOneItemsPropertiesUpdated) {
+    show();
+    ASSERT_TRUE(tray->add_item(0, 0, label_spec("original"), -1, -1));
+    wait_for_signals();
+    clear_signals();
+
+    ASSERT_TRUE(tray->set_label(0, "renamed"));
+    ASSERT_TRUE(tray->set_label(0, "renamed again"));
+    ASSERT_TRUE(tray->set_enabled(0, false));
+    wait_for_signals();
+    ASSERT_EQ(signals.size(), 1u);
+    EXPECT_EQ(signals[0].first, "ItemsPropertiesUpdated");
+
+    g_autoptr(GVariant) updated = g_variant_get_child_value(signals[0].second, 0);
+    ASSERT_EQ(g_variant_n_children(updated), 1u);
+    g_autoptr(GVariant) item       = g_variant_get_child_value(updated, 0);
+    g_autoptr(GVariant) id         = g_variant_get_child_value(item, 0);
+    g_autoptr(GVariant) properties = g_variant_get_child_value(item, 1);
+    EXPECT_EQ(g_variant_get_int32(id), 1);
+    const gchar* label = nullptr;
+    ASSERT_TRUE(g_variant_lookup(properties, "label", "&s", &label));
+    EXPECT_STREQ(label, "renamed again");
+    gboolean enabled = TRUE;
+    ASSERT_TRUE(g_variant_lookup(properties, "enabled", "b", &enabled));
+    EXPECT_FALSE(enabled);
+}
+
+TEST_F(DBusMenuTrayTest, AnnouncesPropertiesOfItemsWhoseLayoutChangedOnlyWithTheLayout) {
+    show();
+    ASSERT_TRUE(tray->add_item(0, 0, label_spec("original"), -1, -1));
+    ASSERT_TRUE(tray->set_label(0, "renamed"));
+    wait_for_signals();
+    ASSERT_EQ(signals.size(), 1u);
+    EXPECT_EQ(signals[0].first, "LayoutUpdated");
+}
+
+}  // namespace test
+}  // namespace tray_menu
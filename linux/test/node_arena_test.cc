@@ -0,0 +1,147 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <map>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "node_arena.h"
+
+namespace tray_menu {
+namespace test {
+
+namespace {
+
+// Counts the nodes alive, so that every node the arena constructs is checked to be destroyed exactly once.
+struct Tracked {
+    static int alive;
+
+    int value;
+
+    explicit Tracked(int value) : value(value) { ++alive; }
+
+    Tracked(Tracked&& other) noexcept : value(other.value) { ++alive; }
+
+    Tracked(const Tracked&) = delete;
+
+    ~Tracked() { --alive; }
+};
+
+int Tracked::alive = 0;
+
+// Small chunks, so that churn spreads the nodes over many of them.
+using Arena = NodeArena<Tracked, 4>;
+
+void expect_same(Arena& arena, const std::unordered_map<int32_t, int>& expected) {
+    ASSERT_EQ(arena.size(), expected.size());
+    for (const auto& [id, value] : expected) {
+        const auto node = arena.find(id);
+        ASSERT_NE(node, nullptr) << "id " << id;
+        EXPECT_EQ(node->value, value) << "id " << id;
+    }
+    std::map<int32_t, int> visited;
+    arena.for_each([&](int32_t id, Tracked& node) { EXPECT_TRUE(visited.emplace(id, node.value).second); });
+    EXPECT_EQ(visited.size(), expected.size());
+}
+
+}  // namespace
+
+TEST(NodeArenaTest, InsertRejectsTakenIds) {
+    Arena arena;
+    ASSERT_NE(arena.insert(7, Tracked(1)), nullptr);
+    EXPECT_EQ(arena.insert(7, Tracked(2)), nullptr);
+    EXPECT_EQ(arena.at(7).value, 1);
+    EXPECT_EQ(arena.size(), 1u);
+    EXPECT_FALSE(arena.erase(8));
+    EXPECT_TRUE(arena.erase(7));
+    EXPECT_FALSE(arena.count(7));
+    EXPECT_EQ(Tracked::alive, 0);
+}
+
+// Erasing leaves tombstones that lookups have to probe past, and reinserting the same ids has to reuse both the freed
+// slots and the tombstones without finding stale entries, including after the table has been rebuilt.
+TEST(NodeArenaTest, ErasedIdsCanBeReinsertedAcrossRehashes) {
+    {
+        Arena arena;
+        std::unordered_map<int32_t, int> expected;
+        for (int round = 0; round < 50; ++round) {
+            const int32_t count = 10 + round * 7;
+            for (int32_t id = 0; id < count; ++id) {
+                if (!expected.count(id)) {
+                    ASSERT_NE(arena.insert(id, Tracked(round * 1000 + id)), nullptr);
+                    expected[id] = round * 1000 + id;
+                }
+            }
+            expect_same(arena, expected);
+            for (int32_t id = round % 2; id < count; id += 2) {
+                ASSERT_TRUE(arena.erase(id));
+                expected.erase(id);
+            }
+            expect_same(arena, expected);
+        }
+        EXPECT_EQ(Tracked::alive, static_cast<int>(expected.size()));
+    }
+    EXPECT_EQ(Tracked::alive, 0);
+}
+
+TEST(NodeArenaTest, NodesKeepTheirAddressAsOthersChurn) {
+    Arena arena;
+    const auto kept = arena.insert(-1, Tracked(42));
+    for (int32_t id = 0; id < 2000; ++id) {
+        ASSERT_NE(arena.insert(id, Tracked(id)), nullptr);
+        if (id % 3) {
+            ASSERT_TRUE(arena.erase(id));
+        }
+    }
+    EXPECT_EQ(arena.find(-1), kept);
+    EXPECT_EQ(kept->value, 42);
+}
+
+TEST(NodeArenaTest, RandomChurnMatchesUnorderedMap) {
+    {
+        std::mt19937 random(1234);
+        Arena arena;
+        std::unordered_map<int32_t, int> expected;
+        // Ids drawn from a narrow range collide often, and the occasional wide one lands far away in the table.
+        std::uniform_int_distribution<int32_t> narrow(0, 300);
+        std::uniform_int_distribution<int32_t> wide(INT32_MIN, INT32_MAX);
+        std::uniform_int_distribution<int> operation(0, 9);
+        for (int step = 0; step < 100000; ++step) {
+            const auto id = step % 50 ? narrow(random) : wide(random);
+            const auto op = operation(random);
+            if (op < 5) {
+                const auto inserted = arena.insert(id, Tracked(step));
+                ASSERT_EQ(inserted != nullptr, !expected.count(id)) << "step " << step;
+                if (inserted) {
+                    expected[id] = step;
+                }
+            } else if (op < 9) {
+                ASSERT_EQ(arena.erase(id), expected.erase(id) == 1) << "step " << step;
+            } else {
+                const auto node = arena.find(id);
+                const auto it   = expected.find(id);
+                ASSERT_EQ(node != nullptr, it != expected.end()) << "step " << step;
+                if (node) {
+                    EXPECT_EQ(node->value, it->second);
+                }
+            }
+            if (step % 10000 == 0) {
+                expect_same(arena, expected);
+            }
+        }
+        expect_same(arena, expected);
+        EXPECT_EQ(Tracked::alive, static_cast<int>(expected.size()));
+
+        arena.clear();
+        EXPECT_EQ(Tracked::alive, 0);
+        EXPECT_EQ(arena.size(), 0u);
+        EXPECT_EQ(arena.find(expected.begin()->first), nullptr);
+        ASSERT_NE(arena.insert(5, Tracked(5)), nullptr);
+        EXPECT_EQ(arena.at(5).value, 5);
+    }
+    EXPECT_EQ(Tracked::alive, 0);
+}
+
+}  // namespace test
+}  // namespace tray_menu
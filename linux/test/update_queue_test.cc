@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "update_queue.h"
+
+namespace tray_menu {
+namespace test {
+
+namespace {
+
+struct Node {
+    int producer;
+    int sequence;
+    Node* next = nullptr;
+};
+
+}  // namespace
+
+TEST(MpscQueueTest, TakesNodesOldestFirst) {
+    MpscQueue<Node> queue;
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(queue.take_all(), nullptr);
+
+    std::vector<Node> nodes{{0, 0}, {0, 1}, {0, 2}};
+    EXPECT_TRUE(queue.push(&nodes[0]));
+    EXPECT_FALSE(queue.push(&nodes[1]));
+    EXPECT_FALSE(queue.push(&nodes[2]));
+    EXPECT_FALSE(queue.empty());
+
+    auto node = queue.take_all();
+    EXPECT_TRUE(queue.empty());
+    for (auto& expected : nodes) {
+        ASSERT_EQ(node, &expected);
+        node = node->next;
+    }
+    EXPECT_EQ(node, nullptr);
+
+    // Taking everything empties the queue, so the next push has to wake the consumer again.
+    EXPECT_TRUE(queue.push(&nodes[0]));
+}
+
+// Pushes from every producer have to come out in the order each producer made them, with none lost or repeated,
+// however they interleave with each other and with the consumer taking them.
+TEST(MpscQueueTest, KeepsEachProducersOrderAcrossThreads) {
+    constexpr int producers    = 4;
+    constexpr int per_producer = 50000;
+
+    MpscQueue<Node> queue;
+    std::vector<std::vector<Node>> nodes(producers);
+    for (int producer = 0; producer < producers; ++producer) {
+        nodes[producer].reserve(per_producer);
+        for (int sequence = 0; sequence < per_producer; ++sequence) {
+            nodes[producer].push_back({producer, sequence});
+        }
+    }
+
+    std::atomic<int> started{0};
+    std::atomic<int> finished{0};
+    std::vector<std::thread> threads;
+    for (int producer = 0; producer < producers; ++producer) {
+        threads.emplace_back([&, producer] {
+            ++started;
+            while (started < producers) {
+            }
+            for (auto& node : nodes[producer]) {
+                queue.push(&node);
+            }
+            ++finished;
+        });
+    }
+
+    // Once every producer has finished, one more take gets whatever they pushed last.
+    std::vector<int> next_sequence(producers, 0);
+    for (bool done = false; !done;) {
+        done = finished == producers;
+        for (auto node = queue.take_all(); node; node = node->next) {
+            EXPECT_EQ(node->sequence, next_sequence[node->producer]) << "producer " << node->producer;
+            next_sequence[node->producer] = node->sequence + 1;
+        }
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_TRUE(queue.empty());
+    for (int producer = 0; producer < producers; ++producer) {
+        EXPECT_EQ(next_sequence[producer], per_producer);
+    }
+}
+
+}  // namespace test
+}  // namespace tray_menu
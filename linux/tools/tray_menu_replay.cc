@@ -0,0 +1,1073 @@
+// Replays a call log recorded with TRAY_MENU_RECORD through the plugin's method handlers and reports throughput and
+// per-operation latency. Calls that created items carry the handles they returned, and the handles later calls refer
+// to are mapped to the ones the replay allocated for the same items, so a log replays against the right items even when
+// it was recorded from several threads adding items through the C ABI at once.
+//
+// The plugin's construction time and the resident set size before and after the replay are reported too.
+//
+// Usage: tray_menu_replay [--backend gtk|dbusmenu] [--max-speed] <log>
+//        tray_menu_replay [--backend gtk|dbusmenu] --startup
+//        tray_menu_replay [--backend gtk|dbusmenu] --soak <cycles>
+//        tray_menu_replay [--backend gtk|dbusmenu] --scale <items>
+//        tray_menu_replay [--backend gtk|dbusmenu] --bus <operations> [--text-rate <hz>]
+//
+// By default calls are issued at their recorded times, with the GTK main loop running in between. With --max-speed
+// they are issued back to back.
+//
+// --startup measures what the plugin costs an app at startup, in two runs of a fresh process each: one that only
+// registers the plugin, as an app that never shows a tray does, and one that then shows the tray and adds its first
+// item. Each run prints one line of JSON with the time gtk_init took, which the app's runner pays before plugins
+// register, the time the plugin's registration took and the resident set growth it caused and, for the run with a
+// tray, the time and resident set growth of the first showTrayIcon and addMenuItem.
+//
+// --soak replays a synthetic workload instead: every cycle calls init, shows the tray, builds a submenu and a few
+// top-level items, updates them, removes half of them and waits for the tray to register with a stand-in
+// StatusNotifierWatcher on a private session bus, so the registration with the desktop and its teardown by the next
+// init are soaked too. It fails if a cycle's tray never registers, if the plugin's live GObjects, the app indicator
+// included, don't drop back to zero after the final init, or if the resident set grows by more than a megabyte
+// between the end of the warm-up and the last cycle. Both backends are soaked in turn unless --backend picks one. It
+// needs dbus-daemon.
+//
+// --scale measures how the menu operations scale with the size of the menu: for menus of 10 up to the given number of
+// items, nested 1, 2 and 4 levels deep, it times adding the items, replacing them one at a time under add/remove churn
+// and removing them, and reports the size of each encoded addMenuItem call, the resident set growth per item and the
+// number of heap allocations each operation makes. Each combination is printed as one line of JSON, so results can be
+// collected and compared across plugin versions.
+//
+// --bus measures what the desktop sees. It starts a private session bus with a stand-in for the desktop on it: a
+// StatusNotifierWatcher and a host that keeps its copy of the menu current the way panels do, fetching the layout
+// again whenever it is announced as changed. It then shows a tray and, one operation at a time, adds the given number
+// of items, renames each of them and sets the tray label as often, timing each call from the handler until the
+// stand-in sees the new text. Each operation is printed as one line of JSON with its latency, the D-Bus messages the
+// plugin sent per call, signals and method replies apart, so an update that turns into a flood of messages shows up as
+// a regression, and the resident set growth per call, which for adds is the memory an item costs. Both backends are
+// measured in turn unless --backend picks one, so the dbusmenu backend is compared against the app indicator on the
+// same workload. Tray labels are rate-limited as the app would see them, at the rate given with --text-rate or the
+// plugin's default. It needs dbus-daemon.
+//
+// --backend overrides TRAY_MENU_BACKEND, so the same log can be compared across backends. Trays shown with the dbusmenu
+// backend talk to the session bus, which can be a private one started with dbus-run-session.
+//
+// Like the app itself, the tool needs a display to initialize GTK.
+
+#include <flutter_linux/flutter_linux.h>
+#include <gtk/gtk.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "call_log.h"
+#include "tray_menu_plugin_private.h"
+
+// Counts the C++ heap allocations of the whole process, including the plugin's and gtkmm's, by replacing the global
+// operator new. Memory GLib allocates itself is not counted.
+static std::atomic<size_t> allocations{0};
+
+void* operator new(size_t size) {
+    ++allocations;
+    if (const auto memory = malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    free(memory);
+}
+
+struct Latencies {
+    std::vector<int64_t> replayed_ns{};
+    int64_t recorded_ns = 0;
+};
+
+static int64_t percentile(const std::vector<int64_t>& sorted, double fraction) {
+    const auto index = static_cast<size_t>(fraction * static_cast<double>(sorted.size() - 1));
+    return sorted[index];
+}
+
+static long resident_kib() {
+    long pages = 0, resident = 0;
+    if (FILE* statm = fopen("/proc/self/statm", "r")) {
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(statm);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int64_t dispatch(TrayMenuPlugin* plugin, const gchar* method, FlValue* args) {
+    g_autoptr(FlValue) owned_args        = args;
+    g_autoptr(FlMethodResponse) response = tray_menu_plugin_dispatch(plugin, method, owned_args);
+    if (!FL_IS_METHOD_SUCCESS_RESPONSE(response)) {
+        return -1;
+    }
+    const auto result = fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(response));
+    return result && fl_value_get_type(result) == FL_VALUE_TYPE_INT ? fl_value_get_int(result) : 0;
+}
+
+static FlValue* new_item_args(const gchar* type, const gchar* label, int64_t submenu = -1) {
+    auto args = fl_value_new_map();
+    fl_value_set_string_take(args, "type", fl_value_new_string(type));
+    fl_value_set_string_take(args, "label", fl_value_new_string(label));
+    fl_value_set_string_take(args, "enabled", fl_value_new_bool(true));
+    fl_value_set_string_take(args, "checked", fl_value_new_bool(false));
+    if (submenu >= 0) {
+        fl_value_set_string_take(args, "submenu", fl_value_new_int(submenu));
+    }
+    return args;
+}
+
+static FlValue* new_update_args(int64_t handle, const gchar* key, FlValue* value) {
+    auto args = fl_value_new_map();
+    fl_value_set_string_take(args, "handle", fl_value_new_int(handle));
+    fl_value_set_string_take(args, key, value);
+    return args;
+}
+
+// The size of a method call as the standard method codec sends it over the channel: the method name followed by the
+// arguments.
+static size_t encoded_size(FlMessageCodec* codec, const gchar* method, FlValue* args) {
+    g_autoptr(FlValue) name    = fl_value_new_string(method);
+    g_autoptr(GBytes) encoded  = fl_message_codec_encode_message(codec, name, nullptr);
+    g_autoptr(GBytes) argument = fl_message_codec_encode_message(codec, args, nullptr);
+    return (encoded ? g_bytes_get_size(encoded) : 0) + (argument ? g_bytes_get_size(argument) : 0);
+}
+
+static int64_t mean(const std::vector<int64_t>& samples) {
+    int64_t total = 0;
+    for (const auto sample : samples) {
+        total += sample;
+    }
+    return samples.empty() ? 0 : total / static_cast<int64_t>(samples.size());
+}
+
+// Times one addMenuItem call, excluding the construction of its arguments.
+static int64_t timed_add(TrayMenuPlugin* plugin, FlValue* args, std::vector<int64_t>& samples) {
+    const auto start  = std::chrono::steady_clock::now();
+    const auto handle = dispatch(plugin, "addMenuItem", args);
+    samples.push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    return handle;
+}
+
+static int64_t timed_remove(TrayMenuPlugin* plugin, int64_t handle, std::vector<int64_t>& samples) {
+    const auto start  = std::chrono::steady_clock::now();
+    const auto result = dispatch(plugin, "removeMenuItem", fl_value_new_int(handle));
+    samples.push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    return result;
+}
+
+static int scale(TrayMenuPlugin* plugin, long max_items) {
+    g_autoptr(FlStandardMessageCodec) codec = fl_standard_message_codec_new();
+    size_t errors                           = 0;
+
+    for (long items = 10; items <= max_items; items = items < 10000 ? items * 10 : items * 5) {
+        for (const int depth : {1, 2, 4}) {
+            dispatch(plugin, "init", nullptr);
+            while (g_main_context_iteration(nullptr, FALSE)) {
+            }
+
+            // The items go into the innermost of depth - 1 nested submenus.
+            int64_t parent = -1;
+            for (int level = 1; level < depth; ++level) {
+                parent = dispatch(plugin, "addMenuItem", new_item_args("_MenuItemSubmenu", "level", parent));
+            }
+
+            std::vector<int64_t> add_ns, churn_ns, remove_ns;
+            std::vector<int64_t> handles;
+            add_ns.reserve(items);
+            handles.reserve(items);
+            size_t add_bytes       = 0;
+            const auto start_kib   = resident_kib();
+            const auto start_count = allocations.load();
+            for (long i = 0; i < items; ++i) {
+                const auto args = new_item_args("_MenuItemLabel", "item", parent);
+                add_bytes += encoded_size(FL_MESSAGE_CODEC(codec), "addMenuItem", args);
+                handles.push_back(timed_add(plugin, args, add_ns));
+            }
+            while (g_main_context_iteration(nullptr, FALSE)) {
+            }
+            const auto built_kib   = resident_kib();
+            const auto built_count = allocations.load();
+
+            // Replaces the oldest item with a new one, so the menu keeps its size while handles move on.
+            churn_ns.reserve(items);
+            for (long i = 0; i < items; ++i) {
+                errors += timed_remove(plugin, handles[i], churn_ns) < 0;
+                handles[i] = timed_add(plugin, new_item_args("_MenuItemLabel", "item", parent), churn_ns);
+            }
+            const auto churned_count = allocations.load();
+            remove_ns.reserve(items);
+            for (const auto handle : handles) {
+                errors += handle < 0 || timed_remove(plugin, handle, remove_ns) < 0;
+            }
+            while (g_main_context_iteration(nullptr, FALSE)) {
+            }
+            const auto removed_count = allocations.load();
+
+            // Churn is reported per replacement, which is a remove and an add.
+            std::sort(add_ns.begin(), add_ns.end());
+            printf("{\"items\": %ld, \"depth\": %d, \"add_mean_ns\": %lld, \"add_p99_ns\": %lld, "
+                   "\"churn_mean_ns\": %lld, \"remove_mean_ns\": %lld, \"add_message_bytes\": %zu, "
+                   "\"rss_bytes_per_item\": %lld, \"add_allocations\": %.1f, \"churn_allocations\": %.1f, "
+                   "\"remove_allocations\": %.1f}\n",
+                   items,
+                   depth,
+                   static_cast<long long>(mean(add_ns)),
+                   static_cast<long long>(percentile(add_ns, 0.99)),
+                   static_cast<long long>(mean(churn_ns) * 2),
+                   static_cast<long long>(mean(remove_ns)),
+                   add_bytes / items,
+                   static_cast<long long>((built_kib - start_kib) * 1024 / items),
+                   static_cast<double>(built_count - start_count) / items,
+                   static_cast<double>(churned_count - built_count) / items,
+                   static_cast<double>(removed_count - churned_count) / items);
+            fflush(stdout);
+        }
+    }
+
+    dispatch(plugin, "init", nullptr);
+    return errors ? 1 : 0;
+}
+
+constexpr const gchar* watcher_xml = R"(
+<node>
+  <interface name="org.kde.StatusNotifierWatcher">
+    <method name="RegisterStatusNotifierItem"><arg type="s" direction="in"/></method>
+    <method name="RegisterStatusNotifierHost"><arg type="s" direction="in"/></method>
+    <property name="RegisteredStatusNotifierItems" type="as" access="read"/>
+    <property name="IsStatusNotifierHostRegistered" type="b" access="read"/>
+    <property name="ProtocolVersion" type="i" access="read"/>
+  </interface>
+</node>)";
+
+// How long an operation may take to reach the stand-in before it counts as lost.
+constexpr guint bus_timeout_ms = 5000;
+
+// The messages the plugin sent on the session bus, counted from GDBus's worker thread.
+static std::atomic<size_t> sent_signals{0};
+static std::atomic<size_t> sent_replies{0};
+
+static GDBusMessage* count_sent_cb(GDBusConnection*, GDBusMessage* message, gboolean incoming, gpointer) {
+    if (!incoming) {
+        switch (g_dbus_message_get_message_type(message)) {
+            case G_DBUS_MESSAGE_TYPE_SIGNAL:
+                ++sent_signals;
+                break;
+            case G_DBUS_MESSAGE_TYPE_METHOD_RETURN:
+            case G_DBUS_MESSAGE_TYPE_ERROR:
+                ++sent_replies;
+                break;
+            default:
+                break;
+        }
+    }
+    return message;
+}
+
+// The desktop side of a tray, on a connection of its own so that its traffic is not counted as the plugin's. The
+// watcher accepts any item and counts its registrations, and the host records when it first saw each label, whether
+// from a layout it fetched, an ItemsPropertiesUpdated signal or the tray label. Like a panel, the host looks the menu
+// up through the item's Menu property, so it serves the gtk backend's app indicator as well as the dbusmenu backend.
+struct DesktopStandIn {
+    GDBusConnection* connection = nullptr;
+    GDBusNodeInfo* watcher_info = nullptr;
+    guint watcher_owner_id      = 0;
+    guint watcher_registration  = 0;
+    guint menu_subscription     = 0;
+    guint item_subscription     = 0;
+    bool owns_watcher           = false;
+    bool fetches_layouts        = true;
+    bool has_layout             = false;
+    int pending_layouts         = 0;
+    int registrations           = 0;
+    std::string item{};
+    std::string item_path{};
+    std::string menu_path{};
+    std::unordered_map<std::string, gint64> seen_at{};
+
+    bool start(const gchar* address);
+
+    void stop();
+
+    bool has_seen(const std::string& text) const { return seen_at.count(text) != 0; }
+
+    void see(const gchar* text) { seen_at.emplace(text, g_get_monotonic_time()); }
+
+    void fetch_menu_path();
+
+    void fetch_layout(gint32 parent_id);
+
+    void walk(GVariant* layout);
+
+    static void watcher_call_cb(GDBusConnection*,
+                                const gchar* sender,
+                                const gchar*,
+                                const gchar*,
+                                const gchar* method,
+                                GVariant* parameters,
+                                GDBusMethodInvocation* invocation,
+                                gpointer user_data);
+
+    static GVariant* watcher_property_cb(
+            GDBusConnection*, const gchar*, const gchar*, const gchar*, const gchar*, GError**, gpointer);
+
+    static void menu_path_cb(GObject* source, GAsyncResult* result, gpointer user_data);
+
+    static void layout_cb(GObject* source, GAsyncResult* result, gpointer user_data);
+
+    static void signal_cb(GDBusConnection*,
+                          const gchar*,
+                          const gchar*,
+                          const gchar*,
+                          const gchar* signal,
+                          GVariant* parameters,
+                          gpointer user_data);
+};
+
+bool DesktopStandIn::start(const gchar* address) {
+    g_autoptr(GError) error = nullptr;
+    connection              = g_dbus_connection_new_for_address_sync(
+            address,
+            static_cast<GDBusConnectionFlags>(G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                              G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+            nullptr,
+            nullptr,
+            &error);
+    if (!connection) {
+        fprintf(stderr, "Cannot connect to the private bus: %s\n", error->message);
+        return false;
+    }
+
+    static const GDBusInterfaceVTable watcher_vtable = {watcher_call_cb, watcher_property_cb, nullptr, {}};
+
+    watcher_info         = g_dbus_node_info_new_for_xml(watcher_xml, nullptr);
+    watcher_registration = g_dbus_connection_register_object(
+            connection, "/StatusNotifierWatcher", watcher_info->interfaces[0], &watcher_vtable, this, nullptr, nullptr);
+    menu_subscription = g_dbus_connection_signal_subscribe(connection,
+                                                           nullptr,
+                                                           "com.canonical.dbusmenu",
+                                                           nullptr,
+                                                           nullptr,
+                                                           nullptr,
+                                                           G_DBUS_SIGNAL_FLAGS_NONE,
+                                                           signal_cb,
+                                                           this,
+                                                           nullptr);
+    item_subscription = g_dbus_connection_signal_subscribe(connection,
+                                                           nullptr,
+                                                           "org.kde.StatusNotifierItem",
+                                                           "XAyatanaNewLabel",
+                                                           nullptr,
+                                                           nullptr,
+                                                           G_DBUS_SIGNAL_FLAGS_NONE,
+                                                           signal_cb,
+                                                           this,
+                                                           nullptr);
+    watcher_owner_id = g_bus_own_name_on_connection(
+            connection,
+            "org.kde.StatusNotifierWatcher",
+            G_BUS_NAME_OWNER_FLAGS_NONE,
+            [](GDBusConnection*, const gchar*, gpointer user_data) {
+                static_cast<DesktopStandIn*>(user_data)->owns_watcher = true;
+            },
+            nullptr,
+            this,
+            nullptr);
+    return true;
+}
+
+void DesktopStandIn::stop() {
+    if (!connection) {
+        return;
+    }
+    g_bus_unown_name(watcher_owner_id);
+    g_dbus_connection_signal_unsubscribe(connection, item_subscription);
+    g_dbus_connection_signal_unsubscribe(connection, menu_subscription);
+    g_dbus_connection_unregister_object(connection, watcher_registration);
+    g_dbus_node_info_unref(watcher_info);
+    g_clear_object(&connection);
+}
+
+// Items may register with an object path instead of a bus name, as app indicators do, in which case they are reached
+// through the sender at that path.
+void DesktopStandIn::watcher_call_cb(GDBusConnection*,
+                                     const gchar* sender,
+                                     const gchar*,
+                                     const gchar*,
+                                     const gchar* method,
+                                     GVariant* parameters,
+                                     GDBusMethodInvocation* invocation,
+                                     gpointer user_data) {
+    auto self = static_cast<DesktopStandIn*>(user_data);
+    if (g_strcmp0(method, "RegisterStatusNotifierItem") == 0) {
+        const gchar* service = nullptr;
+        g_variant_get(parameters, "(&s)", &service);
+        self->item      = service[0] == '/' ? sender : service;
+        self->item_path = service[0] == '/' ? service : "/StatusNotifierItem";
+        ++self->registrations;
+        if (self->fetches_layouts) {
+            self->fetch_menu_path();
+        }
+    }
+    g_dbus_method_invocation_return_value(invocation, nullptr);
+}
+
+GVariant* DesktopStandIn::watcher_property_cb(
+        GDBusConnection*, const gchar*, const gchar*, const gchar*, const gchar* name, GError**, gpointer user_data) {
+    auto self = static_cast<DesktopStandIn*>(user_data);
+    if (g_strcmp0(name, "RegisteredStatusNotifierItems") == 0) {
+        const gchar* items[] = {self->item.c_str(), nullptr};
+        return g_variant_new_strv(items, self->item.empty() ? 0 : 1);
+    }
+    if (g_strcmp0(name, "IsStatusNotifierHostRegistered") == 0) {
+        return g_variant_new_boolean(TRUE);
+    }
+    if (g_strcmp0(name, "ProtocolVersion") == 0) {
+        return g_variant_new_int32(0);
+    }
+    return nullptr;
+}
+
+// Counted as a pending layout, as the layout is fetched as soon as the path is known.
+void DesktopStandIn::fetch_menu_path() {
+    ++pending_layouts;
+    g_dbus_connection_call(connection,
+                           item.c_str(),
+                           item_path.c_str(),
+                           "org.freedesktop.DBus.Properties",
+                           "Get",
+                           g_variant_new("(ss)", "org.kde.StatusNotifierItem", "Menu"),
+                           G_VARIANT_TYPE("(v)"),
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           nullptr,
+                           menu_path_cb,
+                           this);
+}
+
+void DesktopStandIn::menu_path_cb(GObject* source, GAsyncResult* result, gpointer user_data) {
+    auto self                = static_cast<DesktopStandIn*>(user_data);
+    g_autoptr(GError) error  = nullptr;
+    g_autoptr(GVariant) body = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, &error);
+    --self->pending_layouts;
+    if (!body) {
+        fprintf(stderr, "Cannot get the item's menu: %s\n", error->message);
+        return;
+    }
+    g_autoptr(GVariant) path = nullptr;
+    g_variant_get(body, "(v)", &path);
+    self->menu_path = g_variant_get_string(path, nullptr);
+    self->fetch_layout(0);
+}
+
+void DesktopStandIn::fetch_layout(gint32 parent_id) {
+    ++pending_layouts;
+    g_dbus_connection_call(connection,
+                           item.c_str(),
+                           menu_path.c_str(),
+                           "com.canonical.dbusmenu",
+                           "GetLayout",
+                           g_variant_new("(ii@as)", parent_id, -1, g_variant_new_strv(nullptr, 0)),
+                           G_VARIANT_TYPE("(u(ia{sv}av))"),
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           nullptr,
+                           layout_cb,
+                           this);
+}
+
+void DesktopStandIn::layout_cb(GObject* source, GAsyncResult* result, gpointer user_data) {
+    auto self                = static_cast<DesktopStandIn*>(user_data);
+    g_autoptr(GError) error  = nullptr;
+    g_autoptr(GVariant) body = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, &error);
+    --self->pending_layouts;
+    if (!body) {
+        fprintf(stderr, "GetLayout failed: %s\n", error->message);
+        return;
+    }
+    g_autoptr(GVariant) layout = g_variant_get_child_value(body, 1);
+    self->walk(layout);
+    self->has_layout = true;
+}
+
+void DesktopStandIn::walk(GVariant* layout) {
+    g_autoptr(GVariant) properties = g_variant_get_child_value(layout, 1);
+    const gchar* label             = nullptr;
+    if (g_variant_lookup(properties, "label", "&s", &label)) {
+        see(label);
+    }
+    g_autoptr(GVariant) children = g_variant_get_child_value(layout, 2);
+    for (gsize i = 0; i < g_variant_n_children(children); ++i) {
+        g_autoptr(GVariant) boxed = g_variant_get_child_value(children, i);
+        g_autoptr(GVariant) child = g_variant_get_variant(boxed);
+        walk(child);
+    }
+}
+
+void DesktopStandIn::signal_cb(GDBusConnection*,
+                               const gchar*,
+                               const gchar*,
+                               const gchar*,
+                               const gchar* signal,
+                               GVariant* parameters,
+                               gpointer user_data) {
+    auto self = static_cast<DesktopStandIn*>(user_data);
+    if (g_strcmp0(signal, "LayoutUpdated") == 0) {
+        if (self->menu_path.empty()) {
+            return;
+        }
+        guint32 revision = 0;
+        gint32 parent_id = 0;
+        g_variant_get(parameters, "(ui)", &revision, &parent_id);
+        self->fetch_layout(parent_id);
+    } else if (g_strcmp0(signal, "ItemsPropertiesUpdated") == 0) {
+        g_autoptr(GVariant) updated = g_variant_get_child_value(parameters, 0);
+        for (gsize i = 0; i < g_variant_n_children(updated); ++i) {
+            g_autoptr(GVariant) item       = g_variant_get_child_value(updated, i);
+            g_autoptr(GVariant) properties = g_variant_get_child_value(item, 1);
+            const gchar* label             = nullptr;
+            if (g_variant_lookup(properties, "label", "&s", &label)) {
+                self->see(label);
+            }
+        }
+    } else if (g_strcmp0(signal, "XAyatanaNewLabel") == 0) {
+        const gchar* label = nullptr;
+        g_variant_get(parameters, "(&s&s)", &label, nullptr);
+        self->see(label);
+    }
+}
+
+// Runs the main loop until done returns true, or until the timeout passes, in which case it returns false.
+template <typename Done>
+static bool run_until(Done done, guint timeout_ms = bus_timeout_ms) {
+    bool timed_out        = false;
+    const auto timeout_id = g_timeout_add(
+            timeout_ms,
+            [](gpointer user_data) {
+                *static_cast<bool*>(user_data) = true;
+                return G_SOURCE_REMOVE;
+            },
+            &timed_out);
+    while (!done() && !timed_out) {
+        g_main_context_iteration(nullptr, TRUE);
+    }
+    if (!timed_out) {
+        g_source_remove(timeout_id);
+    }
+    return !timed_out;
+}
+
+struct BusSamples {
+    std::vector<int64_t> latency_us{};
+    size_t signals  = 0;
+    size_t replies  = 0;
+    size_t timeouts = 0;
+    // How much the resident set grew over all the calls, which for adds is what the items cost the backend.
+    long rss_kib = 0;
+};
+
+// Issues one call and times it until the stand-in sees text, then lets the exchange it set off finish before counting
+// the messages the plugin sent for it, replies to the host's GetLayout calls included.
+static int64_t timed_until_seen(TrayMenuPlugin* plugin,
+                                DesktopStandIn& desktop,
+                                const gchar* method,
+                                FlValue* args,
+                                const std::string& text,
+                                BusSamples& samples) {
+    const auto signals = sent_signals.load();
+    const auto replies = sent_replies.load();
+    const auto start   = g_get_monotonic_time();
+    const auto result  = dispatch(plugin, method, args);
+    if (run_until([&] { return desktop.has_seen(text); })) {
+        samples.latency_us.push_back(desktop.seen_at.at(text) - start);
+    } else {
+        ++samples.timeouts;
+    }
+    run_until([&] { return desktop.pending_layouts == 0 && !g_main_context_pending(nullptr); });
+    samples.signals += sent_signals.load() - signals;
+    samples.replies += sent_replies.load() - replies;
+    return result;
+}
+
+static void print_bus_samples(const gchar* backend, const gchar* operation, BusSamples& samples) {
+    auto& latencies  = samples.latency_us;
+    const auto calls = static_cast<double>(latencies.size() + samples.timeouts);
+    std::sort(latencies.begin(), latencies.end());
+    printf("{\"backend\": \"%s\", \"operation\": \"%s\", \"calls\": %.0f, \"timeouts\": %zu, \"mean_us\": %lld, "
+           "\"p50_us\": %lld, \"p99_us\": %lld, \"max_us\": %lld, \"signals_per_call\": %.2f, "
+           "\"replies_per_call\": %.2f, \"rss_bytes_per_call\": %.0f}\n",
+           backend,
+           operation,
+           calls,
+           samples.timeouts,
+           static_cast<long long>(mean(latencies)),
+           static_cast<long long>(latencies.empty() ? 0 : percentile(latencies, 0.5)),
+           static_cast<long long>(latencies.empty() ? 0 : percentile(latencies, 0.99)),
+           static_cast<long long>(latencies.empty() ? 0 : latencies.back()),
+           samples.signals / calls,
+           samples.replies / calls,
+           samples.rss_kib * 1024 / calls);
+    fflush(stdout);
+}
+
+static int bus_latency(TrayMenuPlugin* plugin, const gchar* backend, long operations, double text_rate_hz) {
+    g_autoptr(GError) error        = nullptr;
+    g_autoptr(GDBusConnection) bus = g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, &error);
+    if (!bus) {
+        fprintf(stderr, "Cannot connect to the private bus: %s\n", error->message);
+        return 1;
+    }
+    // The plugin shares this connection, as GDBus hands out one per bus.
+    const auto filter_id = g_dbus_connection_add_filter(bus, count_sent_cb, nullptr, nullptr);
+
+    DesktopStandIn desktop;
+    int status = 1;
+    if (desktop.start(g_getenv("DBUS_SESSION_BUS_ADDRESS")) && run_until([&] { return desktop.owns_watcher; })) {
+        dispatch(plugin, "init", nullptr);
+        if (text_rate_hz >= 0) {
+            auto args = fl_value_new_map();
+            fl_value_set_string_take(args, "hz", fl_value_new_float(text_rate_hz));
+            dispatch(plugin, "setTrayTextRate", args);
+        }
+        dispatch(plugin, "showTrayIcon", fl_value_new_string("application-x-executable"));
+        if (!run_until([&] { return desktop.has_layout; })) {
+            fprintf(stderr, "The tray never registered with the stand-in watcher\n");
+        } else {
+            BusSamples adds, renames, labels;
+            std::vector<int64_t> handles;
+            auto start_kib = resident_kib();
+            for (long i = 0; i < operations; ++i) {
+                const auto text = "Item " + std::to_string(i);
+                handles.push_back(timed_until_seen(
+                        plugin, desktop, "addMenuItem", new_item_args("_MenuItemLabel", text.c_str()), text, adds));
+            }
+            adds.rss_kib = resident_kib() - start_kib;
+            start_kib    = resident_kib();
+            for (long i = 0; i < operations; ++i) {
+                const auto text = "Renamed " + std::to_string(i);
+                const auto args = new_update_args(handles[i], "label", fl_value_new_string(text.c_str()));
+                timed_until_seen(plugin, desktop, "setMenuItemLabel", args, text, renames);
+            }
+            renames.rss_kib = resident_kib() - start_kib;
+            start_kib       = resident_kib();
+            for (long i = 0; i < operations; ++i) {
+                const auto text = "Label " + std::to_string(i);
+                auto args       = fl_value_new_map();
+                fl_value_set_string_take(args, "label", fl_value_new_string(text.c_str()));
+                timed_until_seen(plugin, desktop, "setTrayLabel", args, text, labels);
+            }
+            labels.rss_kib = resident_kib() - start_kib;
+            print_bus_samples(backend, "addMenuItem", adds);
+            print_bus_samples(backend, "setMenuItemLabel", renames);
+            print_bus_samples(backend, "setTrayLabel", labels);
+            status = adds.timeouts || renames.timeouts || labels.timeouts ? 1 : 0;
+        }
+        dispatch(plugin, "init", nullptr);
+    }
+
+    desktop.stop();
+    g_dbus_connection_remove_filter(bus, filter_id);
+    return status;
+}
+
+// Every cycle shows the tray and waits for it to register with the stand-in watcher, so that the backend's D-Bus
+// registration and its teardown by the next init, the app indicator's included, are soaked along with the menu.
+static int soak(TrayMenuPlugin* plugin, long cycles, const gchar* backend) {
+    DesktopStandIn desktop;
+    desktop.fetches_layouts = false;
+    if (!desktop.start(g_getenv("DBUS_SESSION_BUS_ADDRESS")) || !run_until([&] { return desktop.owns_watcher; })) {
+        desktop.stop();
+        return 1;
+    }
+
+    const long warm_up  = std::max(1L, cycles / 100);
+    long warm_kib       = 0;
+    size_t errors       = 0;
+    size_t unregistered = 0;
+    const auto start    = std::chrono::steady_clock::now();
+
+    for (long cycle = 0; cycle < cycles; ++cycle) {
+        dispatch(plugin, "init", nullptr);
+        const auto registrations = desktop.registrations;
+        dispatch(plugin, "showTrayIcon", fl_value_new_string("application-x-executable"));
+
+        std::vector<int64_t> handles;
+        const auto submenu = dispatch(plugin, "addMenuItem", new_item_args("_MenuItemSubmenu", "Hosts"));
+        for (int i = 0; i < 8; ++i) {
+            handles.push_back(dispatch(plugin, "addMenuItem", new_item_args("_MenuItemLabel", "host", submenu)));
+        }
+        handles.push_back(dispatch(plugin, "addMenuItem", new_item_args("_MenuItemSeparator", "")));
+        for (int i = 0; i < 4; ++i) {
+            handles.push_back(dispatch(plugin, "addMenuItem", new_item_args("_MenuItemCheckbox", "option")));
+        }
+        for (const auto handle : handles) {
+            if (handle < 0) {
+                ++errors;
+                continue;
+            }
+            dispatch(plugin, "setMenuItemLabel", new_update_args(handle, "label", fl_value_new_string("updated")));
+            dispatch(plugin, "setMenuItemEnabled", new_update_args(handle, "enabled", fl_value_new_bool(false)));
+        }
+        for (size_t i = 0; i < handles.size(); i += 2) {
+            dispatch(plugin, "removeMenuItem", fl_value_new_int(handles[i]));
+        }
+
+        if (!run_until([&] { return desktop.registrations > registrations; })) {
+            ++unregistered;
+        }
+        while (g_main_context_iteration(nullptr, FALSE)) {
+        }
+        if (cycle + 1 == warm_up) {
+            warm_kib = resident_kib();
+        }
+    }
+
+    // The indicator is released with the final init, but D-Bus calls still in flight may hold it a little longer.
+    dispatch(plugin, "init", nullptr);
+    run_until([] { return tray_menu_plugin_get_live_objects() == 0; }, 1000);
+    while (g_main_context_iteration(nullptr, FALSE)) {
+    }
+    desktop.stop();
+
+    const auto elapsed      = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const auto growth_kib   = resident_kib() - warm_kib;
+    const auto live_objects = tray_menu_plugin_get_live_objects();
+    printf("%s: %ld cycles in %.3f s (%zu failed adds, %zu never registered), %zu live objects, RSS %+ld KiB since "
+           "warm-up\n",
+           backend,
+           cycles,
+           elapsed,
+           errors,
+           unregistered,
+           live_objects,
+           growth_kib);
+
+    return errors || unregistered || live_objects || growth_kib > 1024 ? 1 : 0;
+}
+
+using HandleMap = std::unordered_map<int64_t, int64_t>;
+
+static int64_t map_handle(const HandleMap& handles, int64_t handle) {
+    const auto it = handles.find(handle);
+    return it != handles.end() ? it->second : handle;
+}
+
+static bool returns_handles(const std::string& method) {
+    return method == "addMenuItem" || method == "replaceChildren";
+}
+
+// The methods whose only argument is a handle.
+static bool takes_handle(const std::string& method) {
+    return method == "removeMenuItem" || method == "getMenuItemLabel" || method == "getMenuItemEnabled" ||
+           method == "getMenuItemChecked";
+}
+
+// Returns the recorded arguments with the handles they refer to replaced by the replayed ones. The handles recorded as
+// the result of a call are left alone; the plugin ignores them.
+static FlValue* new_mapped_args(const std::string& method, FlValue* args, const HandleMap& handles) {
+    if (!args || handles.empty()) {
+        return args ? fl_value_ref(args) : nullptr;
+    }
+    if (fl_value_get_type(args) == FL_VALUE_TYPE_INT && takes_handle(method)) {
+        return fl_value_new_int(map_handle(handles, fl_value_get_int(args)));
+    }
+    if (fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+        return fl_value_ref(args);
+    }
+    const auto mapped = fl_value_new_map();
+    for (size_t i = 0; i < fl_value_get_length(args); ++i) {
+        const auto key   = fl_value_get_map_key(args, i);
+        const auto value = fl_value_get_map_value(args, i);
+        const auto name  = fl_value_get_type(key) == FL_VALUE_TYPE_STRING ? fl_value_get_string(key) : "";
+        const auto type  = fl_value_get_type(value);
+        if (type == FL_VALUE_TYPE_INT &&
+            (strcmp(name, "submenu") == 0 || strcmp(name, "before") == 0 ||
+             (strcmp(name, "handle") == 0 && !returns_handles(method)))) {
+            const auto handle = map_handle(handles, fl_value_get_int(value));
+            fl_value_set_take(mapped, fl_value_ref(key), fl_value_new_int(handle));
+        } else if (type == FL_VALUE_TYPE_INT64_LIST && strcmp(name, "handles") == 0 && !returns_handles(method)) {
+            std::vector<int64_t> list(fl_value_get_int64_list(value),
+                                      fl_value_get_int64_list(value) + fl_value_get_length(value));
+            for (auto& handle : list) {
+                handle = map_handle(handles, handle);
+            }
+            fl_value_set_take(mapped, fl_value_ref(key), fl_value_new_int64_list(list.data(), list.size()));
+        } else {
+            fl_value_set(mapped, key, value);
+        }
+    }
+    return mapped;
+}
+
+// Maps the handles a call returned when it was recorded to the ones it returned now.
+static void map_returned_handles(const std::string& method,
+                                 FlValue* recorded_args,
+                                 FlMethodResponse* response,
+                                 HandleMap& handles) {
+    if (!returns_handles(method) || !recorded_args || fl_value_get_type(recorded_args) != FL_VALUE_TYPE_MAP ||
+        !FL_IS_METHOD_SUCCESS_RESPONSE(response)) {
+        return;
+    }
+    const auto result   = fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(response));
+    const auto recorded = fl_value_lookup_string(recorded_args, method == "addMenuItem" ? "handle" : "handles");
+    if (!result || !recorded || fl_value_get_type(result) != fl_value_get_type(recorded)) {
+        return;
+    }
+    if (fl_value_get_type(result) == FL_VALUE_TYPE_INT) {
+        handles[fl_value_get_int(recorded)] = fl_value_get_int(result);
+    } else if (fl_value_get_type(result) == FL_VALUE_TYPE_INT64_LIST) {
+        const auto count = std::min(fl_value_get_length(result), fl_value_get_length(recorded));
+        for (size_t i = 0; i < count; ++i) {
+            handles[fl_value_get_int64_list(recorded)[i]] = fl_value_get_int64_list(result)[i];
+        }
+    }
+}
+
+static int64_t elapsed_us(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// One run of --startup, in a process that has initialized nothing yet.
+static int startup(int& argc, char**& argv, bool with_tray) {
+    const auto initial_kib = resident_kib();
+    auto start             = std::chrono::steady_clock::now();
+    gtk_init(&argc, &argv);
+    const auto gtk_init_us = elapsed_us(start);
+    const auto gtk_kib     = resident_kib();
+
+    start                     = std::chrono::steady_clock::now();
+    auto plugin               = static_cast<TrayMenuPlugin*>(g_object_new(tray_menu_plugin_get_type(), nullptr));
+    const auto register_us    = elapsed_us(start);
+    const auto registered_kib = resident_kib();
+
+    int64_t tray_us = 0;
+    size_t errors   = 0;
+    if (with_tray) {
+        start = std::chrono::steady_clock::now();
+        errors += dispatch(plugin, "showTrayIcon", fl_value_new_string("application-x-executable")) < 0;
+        errors += dispatch(plugin, "addMenuItem", new_item_args("_MenuItemLabel", "Quit")) < 0;
+        while (g_main_context_iteration(nullptr, FALSE)) {
+        }
+        tray_us = elapsed_us(start);
+    }
+
+    printf("{\"run\": \"%s\", \"gtk_init_us\": %lld, \"gtk_init_rss_kib\": %ld, \"register_us\": %lld, "
+           "\"register_rss_kib\": %ld, \"first_tray_us\": %lld, \"first_tray_rss_kib\": %ld}\n",
+           with_tray ? "tray" : "headless",
+           static_cast<long long>(gtk_init_us),
+           gtk_kib - initial_kib,
+           static_cast<long long>(register_us),
+           registered_kib - gtk_kib,
+           static_cast<long long>(tray_us),
+           with_tray ? resident_kib() - registered_kib : 0);
+    fflush(stdout);
+
+    g_object_unref(plugin);
+    return errors ? 1 : 0;
+}
+
+static void wait_until(gint64 deadline_us) {
+    while (g_get_monotonic_time() < deadline_us) {
+        if (!g_main_context_iteration(nullptr, FALSE)) {
+            g_usleep(std::min<gint64>(1000, deadline_us - g_get_monotonic_time()));
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    bool max_speed      = false;
+    long soak_cycles    = 0;
+    long scale_items    = 0;
+    long bus_ops        = 0;
+    bool startup_runs   = false;
+    double text_rate    = -1;
+    const char* backend = nullptr;
+    const char* path    = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--max-speed") == 0) {
+            max_speed = true;
+        } else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+            backend = argv[++i];
+            g_setenv("TRAY_MENU_BACKEND", backend, TRUE);
+        } else if (strcmp(argv[i], "--startup") == 0) {
+            startup_runs = true;
+        } else if (strcmp(argv[i], "--soak") == 0 && i + 1 < argc) {
+            soak_cycles = strtol(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            scale_items = strtol(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--bus") == 0 && i + 1 < argc) {
+            bus_ops = strtol(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--text-rate") == 0 && i + 1 < argc) {
+            text_rate = strtod(argv[++i], nullptr);
+        } else {
+            path = argv[i];
+        }
+    }
+    if (bus_ops > 0) {
+        // The private bus has to be up before anything connects to the session bus, GTK included. Each backend gets a
+        // plugin of its own, so that its tray is created anew once the previous plugin is gone.
+        g_autoptr(GTestDBus) private_bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+        g_test_dbus_up(private_bus);
+        gtk_init(&argc, &argv);
+        int status = 0;
+        for (const auto measured : {"gtk", "dbusmenu"}) {
+            if (backend && g_strcmp0(backend, measured) != 0) {
+                continue;
+            }
+            g_setenv("TRAY_MENU_BACKEND", measured, TRUE);
+            auto plugin = static_cast<TrayMenuPlugin*>(g_object_new(tray_menu_plugin_get_type(), nullptr));
+            status |= bus_latency(plugin, measured, bus_ops, text_rate);
+            g_object_unref(plugin);
+        }
+        // Connections outlive the trays, so the bus is stopped without waiting for them to go.
+        g_test_dbus_stop(private_bus);
+        return status;
+    }
+    if (startup_runs) {
+        // Each run forks before anything is initialized, so neither sees what the other loaded.
+        int status = 0;
+        for (const auto with_tray : {false, true}) {
+            const auto child = fork();
+            if (child == 0) {
+                return startup(argc, argv, with_tray);
+            }
+            int child_status = 0;
+            if (child < 0 || waitpid(child, &child_status, 0) < 0 || !WIFEXITED(child_status) ||
+                WEXITSTATUS(child_status) != 0) {
+                status = 1;
+            }
+        }
+        return status;
+    }
+    if (soak_cycles > 0) {
+        // Each backend gets a plugin of its own, so that its tray is created anew once the previous plugin is gone.
+        g_autoptr(GTestDBus) private_bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+        g_test_dbus_up(private_bus);
+        gtk_init(&argc, &argv);
+        int status = 0;
+        for (const auto soaked : {"gtk", "dbusmenu"}) {
+            if (backend && g_strcmp0(backend, soaked) != 0) {
+                continue;
+            }
+            g_setenv("TRAY_MENU_BACKEND", soaked, TRUE);
+            auto plugin = static_cast<TrayMenuPlugin*>(g_object_new(tray_menu_plugin_get_type(), nullptr));
+            status |= soak(plugin, soak_cycles, soaked);
+            g_object_unref(plugin);
+        }
+        g_test_dbus_stop(private_bus);
+        return status;
+    }
+    if (scale_items > 0) {
+        gtk_init(&argc, &argv);
+        auto plugin       = static_cast<TrayMenuPlugin*>(g_object_new(tray_menu_plugin_get_type(), nullptr));
+        const auto status = scale(plugin, scale_items);
+        g_object_unref(plugin);
+        return status;
+    }
+    if (!path) {
+        fprintf(stderr,
+                "Usage: %s [--backend gtk|dbusmenu] [--max-speed] <log>\n"
+                "       %s [--backend gtk|dbusmenu] --startup\n"
+                "       %s [--backend gtk|dbusmenu] --soak <cycles>\n"
+                "       %s [--backend gtk|dbusmenu] --scale <items>\n"
+                "       %s [--backend gtk|dbusmenu] --bus <operations> [--text-rate <hz>]\n",
+                argv[0],
+                argv[0],
+                argv[0],
+                argv[0],
+                argv[0]);
+        return 2;
+    }
+
+    call_log::Reader reader(path);
+    if (!reader.is_open()) {
+        fprintf(stderr, "Cannot read call log %s\n", path);
+        return 1;
+    }
+
+    gtk_init(&argc, &argv);
+    const auto initial_kib    = resident_kib();
+    const auto register_start = std::chrono::steady_clock::now();
+    auto plugin               = static_cast<TrayMenuPlugin*>(g_object_new(tray_menu_plugin_get_type(), nullptr));
+    const auto register_us    = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - register_start);
+    const auto registered_kib = resident_kib();
+
+    std::map<std::string, Latencies> latencies;
+    HandleMap handles;
+    size_t calls               = 0, errors = 0;
+    int64_t first_timestamp_us = -1;
+    const auto start_us        = g_get_monotonic_time();
+    const auto start           = std::chrono::steady_clock::now();
+
+    call_log::Record record;
+    while (reader.next(record)) {
+        if (first_timestamp_us < 0) {
+            first_timestamp_us = record.timestamp_us;
+        }
+        if (!max_speed) {
+            wait_until(start_us + record.timestamp_us - first_timestamp_us);
+        }
+
+        g_autoptr(FlValue) recorded_args     = record.decode_args();
+        g_autoptr(FlValue) args              = new_mapped_args(record.method, recorded_args, handles);
+        const auto call_start                = std::chrono::steady_clock::now();
+        g_autoptr(FlMethodResponse) response = tray_menu_plugin_dispatch(plugin, record.method.c_str(), args);
+        const auto call_duration = std::chrono::steady_clock::now() - call_start;
+        map_returned_handles(record.method, recorded_args, response, handles);
+
+        auto& entry = latencies[record.method];
+        entry.replayed_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(call_duration).count());
+        entry.recorded_ns += record.duration_ns;
+        ++calls;
+        if (!FL_IS_METHOD_SUCCESS_RESPONSE(response)) {
+            ++errors;
+        }
+    }
+
+    while (g_main_context_iteration(nullptr, FALSE)) {
+    }
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("plugin construction: %lld us, RSS %+ld KiB\n", static_cast<long long>(register_us.count()),
+           registered_kib - initial_kib);
+    printf("RSS after replay: %+ld KiB\n", resident_kib() - initial_kib);
+    printf("%zu calls (%zu failed) in %.3f s, %.0f calls/s\n", calls, errors, elapsed, calls / elapsed);
+    printf("%-22s %8s %12s %12s %12s %12s %12s\n", "method", "count", "mean ns", "p50 ns", "p99 ns", "max ns",
+           "recorded ns");
+    for (auto& [method, entry] : latencies) {
+        auto& samples = entry.replayed_ns;
+        std::sort(samples.begin(), samples.end());
+        int64_t total = 0;
+        for (const auto sample : samples) {
+            total += sample;
+        }
+        const auto count = static_cast<int64_t>(samples.size());
+        printf("%-22s %8zu %12lld %12lld %12lld %12lld %12lld\n", method.c_str(), samples.size(),
+               static_cast<long long>(total / count), static_cast<long long>(percentile(samples, 0.5)),
+               static_cast<long long>(percentile(samples, 0.99)), static_cast<long long>(samples.back()),
+               static_cast<long long>(entry.recorded_ns / count));
+    }
+
+    g_object_unref(plugin);
+    return errors ? 1 : 0;
+}
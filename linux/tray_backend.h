@@ -0,0 +1,164 @@
+#ifndef FLUTTER_PLUGIN_TRAY_MENU_TRAY_BACKEND_H_
+#define FLUTTER_PLUGIN_TRAY_MENU_TRAY_BACKEND_H_
+
+#include <glib.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "include/tray_menu/tray_menu_plugin.h"
+
+// Handles carry the index of their tray in the upper bits, so every tray has its own handle space and a handle alone is
+// enough to route a call to its tray without looking at the others. Handles of the default tray 0 are plain indices.
+constexpr int tray_handle_shift = 32;
+
+enum class MenuItemType : gint32 {
+    label     = TRAY_MENU_ITEM_LABEL,
+    separator = TRAY_MENU_ITEM_SEPARATOR,
+    checkbox  = TRAY_MENU_ITEM_CHECKBOX,
+    submenu   = TRAY_MENU_ITEM_SUBMENU,
+    radio     = TRAY_MENU_ITEM_RADIO,
+};
+
+// The text of an entry of the string table, shared by every item bound to it instead of each holding its own copy.
+using SharedString = std::shared_ptr<const std::string>;
+
+// A decoded image shown by items, defined in icon_cache.h.
+struct Icon;
+using SharedIcon = std::shared_ptr<const Icon>;
+
+// The description of an item to add. A label bound to an entry of the string table has string_id set, and the entry's
+// current text in text instead of label. The key is the one Dart gave the item within its menu, if any. An item with
+// an icon has the id it was registered under in icon, and the decoded image in image if there is one.
+struct ItemSpec {
+    MenuItemType type = MenuItemType::label;
+    std::string key{};
+    std::string label{};
+    bool enabled      = true;
+    bool checked      = false;
+    int64_t group     = -1;
+    int64_t string_id = -1;
+    SharedString text{};
+    std::string icon{};
+    SharedIcon image{};
+};
+
+// The native side of one tray icon: its registration with the desktop and its menu tree. Handles are allocated by the
+// caller and owners are the ids of the engines that added the items. A parent or before of -1 means the top-level menu
+// or appending. Everything returning bool returns false if a handle doesn't name a suitable item.
+//
+// Radio items belong to the group given when they are added, scoped to their owner. One item of a group is selected at
+// a time: the first one added, or the last one added checked, clicked or passed to select_radio. Clicking a radio item
+// only reports the activation of the newly selected one.
+struct TrayBackend {
+    struct Listener {
+        virtual ~Listener() = default;
+
+        // Called with "trayReady" or "trayUnavailable" as the desktop's tray host comes and goes.
+        virtual void on_status(const gchar* method) = 0;
+
+        // Called once a click has been handled, with the monotonic time the backend started handling it at.
+        virtual void on_activate(int64_t handle, int64_t owner, gint64 started_at_us) = 0;
+
+        // Called as the desktop shows and hides the menu, with a submenu of -1, and its submenus, by backends that
+        // track it.
+        virtual void on_menu_visible(int64_t submenu, bool visible) = 0;
+    };
+
+    virtual ~TrayBackend() = default;
+
+    // Registers the icon with the desktop asynchronously; the outcome is reported through the listener.
+    virtual void show(const gchar* icon_path) = 0;
+
+    // Whether the backend reports when the menu is shown and hidden. If not, the menu has to be treated as always
+    // visible.
+    virtual bool tracks_visibility() const = 0;
+
+    // Sets the text shown next to the icon, with a guide as wide as the text can get so the panel doesn't shift as it
+    // changes. Empty text removes it. Hosts that don't show labels ignore it.
+    virtual void set_indicator_label(const gchar* label, const gchar* guide) = 0;
+
+    // Sets the name hosts give the icon, such as to screen readers. Empty falls back to the tray id.
+    virtual void set_title(const gchar* title) = 0;
+
+    // Unregisters the icon and removes every item, label and title.
+    virtual void clear() = 0;
+
+    virtual bool add_item(int64_t handle, int64_t owner, const ItemSpec& spec, int64_t parent, int64_t before) = 0;
+
+    virtual bool remove_item(int64_t handle) = 0;
+
+    // Removes every item added by owner, along with everything nested under it.
+    virtual void remove_owned_by(int64_t owner) = 0;
+
+    // Removes every child of parent, whoever added it, along with everything nested under them.
+    virtual bool clear_children(int64_t parent) = 0;
+
+    // Moves an item in front of before under parent, or to its end, keeping its handle, state and activation handling.
+    // Fails if that would move a submenu into itself.
+    virtual bool move_item(int64_t handle, int64_t parent, int64_t before) = 0;
+
+    // Moves the given children of parent to its front in that order; the other children keep their order after them.
+    virtual bool reorder_children(int64_t parent, const std::vector<int64_t>& handles) = 0;
+
+    virtual bool get_label(int64_t handle, std::string& label) = 0;
+
+    // Setting the label unbinds it from the string table.
+    virtual bool set_label(int64_t handle, const gchar* label) = 0;
+
+    // Updates the label of every item bound to one of the given entries of the string table, by string id.
+    virtual void relabel(const std::unordered_map<int64_t, SharedString>& strings) = 0;
+
+    virtual bool get_enabled(int64_t handle, bool& enabled) = 0;
+
+    virtual bool set_enabled(int64_t handle, bool enabled) = 0;
+
+    // Shows icon next to the label, or removes it if icon is null. Separators have no icon, and the gtk backend can
+    // only show icons on labels and submenus.
+    virtual bool set_icon(int64_t handle, const SharedIcon& icon) = 0;
+
+    // Checkbox and radio items have a checked state, but only checkboxes can be set; radio items are selected instead.
+    virtual bool get_checked(int64_t handle, bool& checked) = 0;
+
+    virtual bool set_checked(int64_t handle, bool checked) = 0;
+
+    virtual bool select_radio(int64_t group, int64_t handle) = 0;
+
+    // Sets the label, icon, enabled and checked state of an item to those of spec, or selects it if it is a radio item
+    // and spec is checked. Fails if spec describes another type of item, or a radio item of another group.
+    virtual bool update_item(int64_t handle, const ItemSpec& spec) = 0;
+
+    // Hands every item added by from over to to, along with their radio groups.
+    virtual void reassign(int64_t from, int64_t to) = 0;
+
+    // Called for every item with its parent (-1 for the top-level menu), owner and current state, parents before their
+    // children and children in menu order.
+    using Visitor = std::function<void(int64_t handle, int64_t parent, int64_t owner, const ItemSpec& item)>;
+
+    virtual void walk(const Visitor& visit) = 0;
+
+    // The native memory taken up by one item, not counting its children, or by the tray itself apart from its items.
+    // Texts several items share, such as the entries of the string table, are not counted per item.
+    struct Footprint {
+        // The backend's own bookkeeping, including the C++ objects it allocates.
+        size_t model_bytes = 0;
+        // Keys and labels.
+        size_t string_bytes = 0;
+        // The instances of GObjects, such as GTK widgets, estimated from their types' instance sizes.
+        size_t object_bytes    = 0;
+        size_t signal_handlers = 0;
+    };
+
+    // Called for every item with its parent and type, in the same order as walk.
+    using FootprintVisitor =
+            std::function<void(int64_t handle, int64_t parent, MenuItemType type, const Footprint& footprint)>;
+
+    // Reports the footprint of every item, and returns that of the tray itself.
+    virtual Footprint measure(const FootprintVisitor& visit) = 0;
+};
+
+#endif  // FLUTTER_PLUGIN_TRAY_MENU_TRAY_BACKEND_H_
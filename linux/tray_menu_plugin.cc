@@ -2,57 +2,200 @@
 
 #include <flutter_linux/flutter_linux.h>
 #include <gtk/gtk.h>
+#include <glib/gstdio.h>
 #include <gtkmm.h>
 #include <libayatana-appindicator/app-indicator.h>
+#include <malloc.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "call_log.h"
+#include "dbus_menu.h"
+#include "icon_cache.h"
+#include "label_template.h"
+#include "menu_snapshot.h"
+#include "tray_backend.h"
 #include "tray_menu_plugin_private.h"
+#include "update_queue.h"
 
 #define TRAY_MENU_PLUGIN(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), tray_menu_plugin_get_type(), TrayMenuPlugin))
 
+#ifndef TRAY_MENU_DEFAULT_BACKEND
+#define TRAY_MENU_DEFAULT_BACKEND "gtk"
+#endif
+
+// Selects the backend of trays created from then on: "gtk" builds a gtkmm menu that libayatana-appindicator exports,
+// "dbusmenu" exports the menu itself from a compact model (see dbus_menu.h). Defaults to the TRAY_MENU_BACKEND CMake
+// option.
+constexpr const gchar* backend_env_var = "TRAY_MENU_BACKEND";
+
+// Every GObject the plugin creates is counted until it is finalized, so that leaks show up as a count that doesn't
+// return to zero after init or dispose.
+static std::atomic<gsize> live_objects{0};
+static std::atomic<gsize> live_object_bytes{0};
+
+// The size of an instance of the type of instance, which is what GObject allocates for it.
+static gsize instance_size(gpointer instance) {
+    GTypeQuery query;
+    g_type_query(G_TYPE_FROM_INSTANCE(instance), &query);
+    return query.instance_size;
+}
+
+static void track_object(GObject* object) {
+    const auto size = instance_size(object);
+    ++live_objects;
+    live_object_bytes += size;
+    g_object_weak_ref(
+            object,
+            [](gpointer size, GObject*) {
+                --live_objects;
+                live_object_bytes -= GPOINTER_TO_SIZE(size);
+            },
+            GSIZE_TO_POINTER(size));
+}
+
+// Counts the handlers connected to instance, by anyone, for the signals of its type and its ancestors. GLib has no call
+// to list them, but blocking reports how many handlers it matched, and unblocking them again leaves them as they were.
+static gsize count_signal_handlers(gpointer instance) {
+    gsize count = 0;
+    for (auto type = G_TYPE_FROM_INSTANCE(instance); type; type = g_type_parent(type)) {
+        guint length          = 0;
+        g_autofree guint* ids = g_signal_list_ids(type, &length);
+        for (guint i = 0; i < length; ++i) {
+            const auto matched = g_signal_handlers_block_matched(
+                    instance, G_SIGNAL_MATCH_ID, ids[i], 0, nullptr, nullptr, nullptr);
+            g_signal_handlers_unblock_matched(instance, G_SIGNAL_MATCH_ID, ids[i], 0, nullptr, nullptr, nullptr);
+            count += matched;
+        }
+    }
+    return count;
+}
+
+// Adds a widget and its child, such as the label of a menu item, to footprint.
+static void measure_widget(GtkWidget* widget, TrayBackend::Footprint& footprint) {
+    footprint.object_bytes += instance_size(widget);
+    footprint.signal_handlers += count_signal_handlers(widget);
+    if (GTK_IS_BIN(widget)) {
+        if (const auto child = gtk_bin_get_child(GTK_BIN(widget))) {
+            measure_widget(child, footprint);
+        }
+    }
+}
+
+// Adds a menu and the window GTK pops it up in, but not its items, to footprint.
+static void measure_menu(GtkWidget* menu, TrayBackend::Footprint& footprint) {
+    footprint.object_bytes += instance_size(menu);
+    footprint.signal_handlers += count_signal_handlers(menu);
+    if (const auto window = gtk_widget_get_parent(menu)) {
+        footprint.object_bytes += instance_size(window);
+        footprint.signal_handlers += count_signal_handlers(window);
+    }
+}
+
+// Menus exported by libayatana-appindicator only carry the images of image menu items, which GTK deprecated along with
+// menu icons in general. Images are shown whatever the gtk-menu-images setting says, as the host decides. Returns false
+// if the item can't show icon.
+static bool set_item_icon(Gtk::MenuItem& item, const SharedIcon& icon) {
+    G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+    if (!GTK_IS_IMAGE_MENU_ITEM(item.gobj())) {
+        return !icon;
+    }
+    const auto image_item = GTK_IMAGE_MENU_ITEM(item.gobj());
+    GtkWidget* image      = nullptr;
+    if (icon) {
+        image = gtk_image_new_from_pixbuf(icon->pixbuf);
+        track_object(G_OBJECT(image));
+    }
+    gtk_image_menu_item_set_image(image_item, image);
+    gtk_image_menu_item_set_always_show_image(image_item, icon != nullptr);
+    G_GNUC_END_IGNORE_DEPRECATIONS
+    return true;
+}
+
+gsize tray_menu_plugin_get_live_objects() {
+    return live_objects;
+}
+
+gsize tray_menu_plugin_get_live_object_bytes() {
+    return live_object_bytes;
+}
+
+// Ownership is strictly top-down: the tray owns the root menu, each menu owns its items and each submenu item owns
+// its submenu. Removing an item or resetting the root therefore destroys the whole subtree deterministically.
 struct IndexedMenu : public Gtk::Menu {
-    void add_item(int64_t handle, std::unique_ptr<Gtk::MenuItem> item, int64_t before = -1) {
+    struct Entry {
+        std::unique_ptr<Gtk::MenuItem> item;
+        MenuItemType type;
+        int64_t owner;
+        // The entry of the string table the label is bound to, or -1.
+        int64_t string_id;
+        std::string key;
+        // Kept for the id it was registered under; the image holds its own reference to the pixbuf.
+        SharedIcon icon;
+    };
+
+    bool add_item(int64_t handle,
+                  int64_t owner,
+                  const ItemSpec& spec,
+                  std::unique_ptr<Gtk::MenuItem> item,
+                  int64_t before = -1) {
         if (before >= 0) {
-            const auto& children = get_children();
-            const auto& child    = std::find(children.begin(), children.end(), items.at(before).get());
-            const auto position  = static_cast<int>(child - children.begin());
-            insert(*item, position);
+            const auto next = items.find(before);
+            if (next == items.end()) {
+                return false;
+            }
+            insert(*item, position_of(*next->second.item));
         } else {
             append(*item);
         }
         item->show();
-        items.insert({handle, std::move(item)});
+        auto icon = spec.image && set_item_icon(*item, spec.image) ? spec.image : nullptr;
+        items.insert({handle, {std::move(item), spec.type, owner, spec.string_id, spec.key, std::move(icon)}});
+        return true;
     }
 
-    template<typename T = Gtk::MenuItem, typename = std::enable_if_t<std::is_base_of<Gtk::MenuItem, T>::value>>
-    T* get_item(int64_t handle) {
+    Entry* find_entry(int64_t handle) {
         auto it = items.find(handle);
         if (it != items.end()) {
-            return dynamic_cast<T*>(it->second.get());
+            return &it->second;
         }
         for (const auto& it2 : items) {
-            const auto& item = it2.second;
+            const auto& item = it2.second.item;
             auto submenu     = dynamic_cast<IndexedMenu*>(item->get_submenu());
             if (submenu) {
-                auto foundItem = submenu->get_item<T>(handle);
-                if (foundItem) {
-                    return foundItem;
+                auto found = submenu->find_entry(handle);
+                if (found) {
+                    return found;
                 }
             }
         }
         return nullptr;
     }
 
+    template<typename T = Gtk::MenuItem, typename = std::enable_if_t<std::is_base_of<Gtk::MenuItem, T>::value>>
+    T* get_item(int64_t handle) {
+        const auto entry = find_entry(handle);
+        return entry ? dynamic_cast<T*>(entry->item.get()) : nullptr;
+    }
+
     bool remove_item(int64_t handle) {
         if (items.erase(handle)) {
             return true;
         }
         for (const auto& it : items) {
-            const auto& item = it.second;
+            const auto& item = it.second.item;
             auto submenu     = dynamic_cast<IndexedMenu*>(item->get_submenu());
             if (submenu) {
                 if (submenu->remove_item(handle)) {
@@ -63,28 +206,555 @@ struct IndexedMenu : public Gtk::Menu {
         return false;
     }
 
+    void remove_owned_by(int64_t owner) {
+        for (auto it = items.begin(); it != items.end();) {
+            if (it->second.owner == owner) {
+                it = items.erase(it);
+                continue;
+            }
+            if (auto submenu = dynamic_cast<IndexedMenu*>(it->second.item->get_submenu())) {
+                submenu->remove_owned_by(owner);
+            }
+            ++it;
+        }
+    }
+
+    void clear_items() {
+        items.clear();
+    }
+
+    void reassign(int64_t from, int64_t to) {
+        for (auto& it : items) {
+            auto& entry = it.second;
+            if (entry.owner == from) {
+                entry.owner = to;
+            }
+            if (auto submenu = dynamic_cast<IndexedMenu*>(entry.item->get_submenu())) {
+                submenu->reassign(from, to);
+            }
+        }
+    }
+
+    // Visits the items in menu order, each before its submenu's items. parent is this menu's handle, or -1.
+    void walk(int64_t parent, const TrayBackend::Visitor& visit);
+
+    // Reports the footprint of the items like walk, in no particular order among siblings.
+    void measure(int64_t parent, const TrayBackend::FootprintVisitor& visit);
+
+    // The menu itself along with its index, apart from its items.
+    TrayBackend::Footprint own_footprint() {
+        TrayBackend::Footprint footprint;
+        footprint.model_bytes = items.bucket_count() * sizeof(void*);
+        measure_menu(GTK_WIDGET(gobj()), footprint);
+        return footprint;
+    }
+
+    // Returns the menu directly holding handle, searching the submenus as well.
+    IndexedMenu* find_menu_of(int64_t handle) {
+        if (items.count(handle)) {
+            return this;
+        }
+        for (const auto& it : items) {
+            if (auto submenu = dynamic_cast<IndexedMenu*>(it.second.item->get_submenu())) {
+                if (auto found = submenu->find_menu_of(handle)) {
+                    return found;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    // Whether menu is this menu or nested in one of its submenus.
+    bool contains(const IndexedMenu& menu) {
+        if (&menu == this) {
+            return true;
+        }
+        for (const auto& it : items) {
+            auto submenu = dynamic_cast<IndexedMenu*>(it.second.item->get_submenu());
+            if (submenu && submenu->contains(menu)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Moves one of this menu's items in front of before in target, which may be this menu, or to the end of target. The
+    // widget itself moves, so its state and signal handlers are kept.
+    bool move_item(int64_t handle, IndexedMenu& target, int64_t before) {
+        const auto it = items.find(handle);
+        if (it == items.end() || before == handle) {
+            return false;
+        }
+        Gtk::MenuItem* next = nullptr;
+        if (before >= 0) {
+            const auto next_it = target.items.find(before);
+            if (next_it == target.items.end()) {
+                return false;
+            }
+            next = next_it->second.item.get();
+        }
+
+        auto& item = *it->second.item;
+        if (&target == this) {
+            auto position = next ? position_of(*next) : -1;
+            if (next && position_of(item) < position) {
+                --position;
+            }
+            reorder_child(item, position);
+            return true;
+        }
+        remove(item);
+        target.insert(item, next ? target.position_of(*next) : -1);
+        target.items.insert({handle, std::move(it->second)});
+        items.erase(it);
+        return true;
+    }
+
+    // Moves the given items to the front in that order, leaving the others in their current order after them.
+    bool reorder_items(const std::vector<int64_t>& handles) {
+        std::set<int64_t> moved;
+        for (const auto handle : handles) {
+            if (!items.count(handle) || !moved.insert(handle).second) {
+                return false;
+            }
+        }
+        for (size_t i = 0; i < handles.size(); ++i) {
+            reorder_child(*items.at(handles[i]).item, static_cast<int>(i));
+        }
+        return true;
+    }
+
+    // Updates the items bound to the given strings in one pass over the menu and its submenus.
+    void relabel(const std::unordered_map<int64_t, SharedString>& strings) {
+        for (const auto& it : items) {
+            const auto& entry = it.second;
+            if (entry.string_id >= 0) {
+                const auto text = strings.find(entry.string_id);
+                if (text != strings.end()) {
+                    entry.item->set_label(*text->second);
+                }
+            }
+            if (auto submenu = dynamic_cast<IndexedMenu*>(entry.item->get_submenu())) {
+                submenu->relabel(strings);
+            }
+        }
+    }
+
 private:
-    std::unordered_map<int64_t, std::unique_ptr<Gtk::MenuItem>> items{};
+    std::unordered_map<int64_t, Entry> items{};
+
+    int position_of(const Gtk::Widget& widget) {
+        const auto& children = get_children();
+        return static_cast<int>(std::find(children.begin(), children.end(), &widget) - children.begin());
+    }
 };
 
-struct MenuItemSubmenu : public Gtk::MenuItem {
+struct MenuItemSubmenu : public Gtk::ImageMenuItem {
+    explicit MenuItemSubmenu(const gchar* label) : Gtk::ImageMenuItem(label) {
+        set_submenu(menu);
+    }
+
+    ~MenuItemSubmenu() override {
+        unset_submenu();
+    }
+
     IndexedMenu menu{};
 };
 
+struct MenuItemRadio;
+
+// The live radio items of one group. Members leave it as they are destroyed, so new items can always join the group
+// through any remaining member.
+struct RadioGroup {
+    explicit RadioGroup(int64_t id) : id{id} {}
+
+    const int64_t id;
+    std::set<MenuItemRadio*> members{};
+
+    bool has_selection() const;
+};
+
+struct MenuItemRadio : public Gtk::RadioMenuItem {
+    MenuItemRadio(std::shared_ptr<RadioGroup> radio_group, const gchar* label) : radio_group{std::move(radio_group)} {
+        set_label(label);
+        auto& members = this->radio_group->members;
+        if (!members.empty()) {
+            auto group = (*members.begin())->get_group();
+            set_group(group);
+        }
+        members.insert(this);
+    }
+
+    ~MenuItemRadio() override {
+        radio_group->members.erase(this);
+    }
+
+    const std::shared_ptr<RadioGroup> radio_group;
+};
+
+bool RadioGroup::has_selection() const {
+    return std::any_of(members.begin(), members.end(), [](MenuItemRadio* member) { return member->get_active(); });
+}
+
+void IndexedMenu::walk(int64_t parent, const TrayBackend::Visitor& visit) {
+    std::unordered_map<const Gtk::Widget*, int64_t> handles;
+    for (const auto& it : items) {
+        handles.insert({it.second.item.get(), it.first});
+    }
+    for (const auto child : get_children()) {
+        const auto handle = handles.find(child);
+        if (handle == handles.end()) {
+            continue;
+        }
+        const auto& entry = items.at(handle->second);
+        ItemSpec item;
+        item.type      = entry.type;
+        item.key       = entry.key;
+        item.enabled   = entry.item->get_sensitive();
+        item.string_id = entry.string_id;
+        if (entry.type != MenuItemType::separator) {
+            item.label = entry.item->get_label();
+        }
+        if (entry.icon) {
+            item.icon = entry.icon->id;
+        }
+        if (const auto check = dynamic_cast<Gtk::CheckMenuItem*>(entry.item.get())) {
+            item.checked = check->get_active();
+        }
+        if (const auto radio = dynamic_cast<MenuItemRadio*>(entry.item.get())) {
+            item.group = radio->radio_group->id;
+        }
+        visit(handle->second, parent, entry.owner, item);
+        if (const auto submenu = dynamic_cast<IndexedMenu*>(entry.item->get_submenu())) {
+            submenu->walk(handle->second, visit);
+        }
+    }
+}
+
+// An item's model bytes are its entry in the index, with the allocator's overhead for the node, and its C++ wrapper,
+// which for submenus includes their IndexedMenu.
+void IndexedMenu::measure(int64_t parent, const TrayBackend::FootprintVisitor& visit) {
+    for (const auto& it : items) {
+        const auto& entry = it.second;
+        const auto widget = entry.item->gobj();
+        TrayBackend::Footprint footprint;
+        footprint.model_bytes = sizeof(it) + 3 * sizeof(void*);
+        footprint.model_bytes += malloc_usable_size(dynamic_cast<void*>(entry.item.get()));
+        if (dynamic_cast<MenuItemRadio*>(entry.item.get())) {
+            // Its node in the group's set of members.
+            footprint.model_bytes += 5 * sizeof(void*);
+        }
+        footprint.string_bytes = entry.key.size();
+        if (const auto label = gtk_menu_item_get_label(GTK_MENU_ITEM(widget))) {
+            footprint.string_bytes += strlen(label) + 1;
+        }
+        measure_widget(GTK_WIDGET(widget), footprint);
+        const auto submenu = dynamic_cast<IndexedMenu*>(entry.item->get_submenu());
+        if (submenu) {
+            const auto own = submenu->own_footprint();
+            footprint.model_bytes += own.model_bytes;
+            footprint.object_bytes += own.object_bytes;
+            footprint.signal_handlers += own.signal_handlers;
+        }
+        visit(it.first, parent, entry.type, footprint);
+        if (submenu) {
+            submenu->measure(it.first, visit);
+        }
+    }
+}
+
+// The default backend: a gtkmm menu handed to libayatana-appindicator, which registers the icon and exports the menu.
+struct AppIndicatorTray : TrayBackend {
+    AppIndicatorTray(std::string id, Listener& listener) : id{std::move(id)}, listener{listener} {}
+
+    ~AppIndicatorTray() override { clear(); }
+
+    AppIndicatorTray(const AppIndicatorTray&)            = delete;
+    AppIndicatorTray& operator=(const AppIndicatorTray&) = delete;
+
+    const std::string id;
+    Listener& listener;
+    std::shared_ptr<Gtk::Main> gtkmm{};
+    std::unique_ptr<IndexedMenu> menu{};
+    AppIndicator* app_indicator = nullptr;
+    gchar* icon                 = nullptr;
+    guint watcher_id            = 0;
+    guint fallback_source_id    = 0;
+    bool ready                  = false;
+    // Kept for the indicator, which is only created once the icon is shown.
+    std::string label{};
+    std::string label_guide{};
+    std::string title{};
+    // Radio groups by owner and group id. Groups are kept alive by their members only.
+    std::map<std::pair<int64_t, int64_t>, std::weak_ptr<RadioGroup>> radio_groups{};
+    // Set while selecting a radio item programmatically, as GTK activates it like a click would.
+    bool selecting = false;
+
+    IndexedMenu& ensure_menu();
+
+    template<typename T = Gtk::MenuItem>
+    T* get_item(int64_t handle) {
+        return menu ? menu->get_item<T>(handle) : nullptr;
+    }
+
+    IndexedMenu* get_parent_menu(int64_t submenu_handle);
+
+    void create_app_indicator();
+
+    std::shared_ptr<RadioGroup> ensure_radio_group(int64_t owner, int64_t group);
+
+    void select(MenuItemRadio& item);
+
+    // Reports a click on an item to the owner it currently has.
+    void activate(int64_t handle, Gtk::MenuItem& item, gint64 started_at_us);
+
+    void show(const gchar* icon_path) override;
+
+    // libayatana-appindicator exports the menu itself and doesn't tell when the host shows it.
+    bool tracks_visibility() const override { return false; }
+
+    void set_indicator_label(const gchar* label, const gchar* guide) override;
+
+    void set_title(const gchar* title) override;
+
+    void clear() override;
+
+    bool add_item(int64_t handle, int64_t owner, const ItemSpec& spec, int64_t parent, int64_t before) override;
+
+    bool remove_item(int64_t handle) override { return menu && menu->remove_item(handle); }
+
+    void remove_owned_by(int64_t owner) override {
+        if (menu) {
+            menu->remove_owned_by(owner);
+        }
+    }
+
+    bool clear_children(int64_t parent) override;
+
+    bool move_item(int64_t handle, int64_t parent, int64_t before) override;
+
+    bool reorder_children(int64_t parent, const std::vector<int64_t>& handles) override;
+
+    bool get_label(int64_t handle, std::string& label) override;
+
+    bool set_label(int64_t handle, const gchar* label) override;
+
+    void relabel(const std::unordered_map<int64_t, SharedString>& strings) override {
+        if (menu) {
+            menu->relabel(strings);
+        }
+    }
+
+    bool get_enabled(int64_t handle, bool& enabled) override;
+
+    bool set_enabled(int64_t handle, bool enabled) override;
+
+    bool set_icon(int64_t handle, const SharedIcon& icon) override;
+
+    bool get_checked(int64_t handle, bool& checked) override;
+
+    bool set_checked(int64_t handle, bool checked) override;
+
+    bool select_radio(int64_t group, int64_t handle) override;
+
+    bool update_item(int64_t handle, const ItemSpec& spec) override;
+
+    void reassign(int64_t from, int64_t to) override;
+
+    void walk(const Visitor& visit) override {
+        if (menu) {
+            menu->walk(-1, visit);
+        }
+    }
+
+    Footprint measure(const FootprintVisitor& visit) override;
+};
+
+// How many times a second the label and title of a tray change at most, unless set otherwise.
+constexpr double default_text_rate_hz = 4;
+
+// One tray icon with its own backend and handle space. A tray is shared by every engine that calls init on it; each
+// engine's items are tracked so that its init or shutdown only removes what it added.
+struct Tray : TrayBackend::Listener {
+    Tray(int64_t index, std::string id);
+
+    ~Tray() override;
+
+    Tray(const Tray&)            = delete;
+    Tray& operator=(const Tray&) = delete;
+
+    const int64_t index;
+    const std::string id;
+    std::set<int64_t> users{};
+    const std::unique_ptr<TrayBackend> backend;
+    // Whether the menu was restored from a snapshot and no engine has claimed its items yet.
+    bool restored = false;
+    // The path of the icon last shown, saved along with the menu.
+    std::string icon{};
+    // The status last reported by the backend since the icon was shown, or null.
+    const gchar* status = nullptr;
+    // The CRC-32 of the snapshot last written, so committing an unchanged menu doesn't write it again.
+    uint32_t saved_checksum = 0;
+    // Whether the desktop is showing the menu, as far as the backend tracks it.
+    bool menu_visible = false;
+    // The label and title last set. Each change is announced to the host over D-Bus, so they are passed to the backend
+    // at most text_rate_hz times a second, with whatever was set last; anything set in between is never shown.
+    std::string label{};
+    std::string label_guide{};
+    std::string title{};
+    bool label_pending     = false;
+    bool title_pending     = false;
+    double text_rate_hz    = default_text_rate_hz;
+    gint64 text_applied_at = 0;
+    guint text_source_id   = 0;
+
+    void set_label(const gchar* label, const gchar* guide);
+
+    void set_title(const gchar* title);
+
+    void set_text_rate(double hz);
+
+    void schedule_text();
+
+    void apply_text();
+
+    void clear_text();
+
+    void on_status(const gchar* method) override;
+
+    void on_activate(int64_t handle, int64_t owner, gint64 started_at_us) override;
+
+    void on_menu_visible(int64_t submenu, bool visible) override;
+};
+
+// Process-wide state shared by every plugin instance, one of which is registered per Flutter engine. All engines see
+// the same trays; activations are routed back to the engine that added the item.
+struct TrayService {
+    static TrayService& get();
+
+    std::unordered_map<int64_t, TrayMenuPlugin*> plugins{};
+    std::unordered_map<int64_t, std::unique_ptr<Tray>> trays{};
+    std::unique_ptr<call_log::Writer> recorder{};
+    // The string table labels can be bound to, shared by every engine and tray.
+    std::unordered_map<int64_t, SharedString> strings{};
+    // The entries of the string table rendered from label templates, and the sources they read.
+    std::unordered_map<int64_t, label_template::Template> templates{};
+    label_template::Sources sources{};
+    // The images items can show, shared by every engine and tray.
+    IconCache icons{};
+    int64_t next_plugin_id  = 1;
+    bool snapshots_restored = false;
+    // Set when a source changed since the templates were last rendered.
+    bool templates_stale   = false;
+    guint render_source_id = 0;
+    guint clock_source_id  = 0;
+    // Operations that take longer than the threshold, and stalls of the main loop as long, are logged and reported to
+    // Dart. 0 turns the watchdog off.
+    gint64 stall_threshold_us = 0;
+    gint64 heartbeat_due_at   = 0;
+    guint heartbeat_source_id = 0;
+
+    int64_t attach(TrayMenuPlugin* plugin);
+
+    void detach(int64_t plugin_id);
+
+    Tray& ensure_tray(int64_t index, const gchar* id = nullptr);
+
+    int64_t tray_index_for(const std::string& id) const;
+
+    void init_tray(int64_t owner, int64_t index, const gchar* id, bool reattach);
+
+    TrayBackend* backend_for_handle(int64_t handle);
+
+    void resolve(ItemSpec& spec);
+
+    bool add_item(int64_t owner, int64_t handle, ItemSpec spec, int64_t tray_index, int64_t submenu, int64_t before);
+
+    bool clear_children(int64_t tray_index, int64_t submenu);
+
+    bool replace_children(int64_t owner,
+                          int64_t tray_index,
+                          int64_t submenu,
+                          std::vector<ItemSpec> specs,
+                          std::vector<int64_t>& handles);
+
+    void set_strings(const std::vector<std::pair<int64_t, std::string>>& entries);
+
+    void update_strings(const std::vector<std::pair<int64_t, std::string>>& entries);
+
+    void set_templates(const std::vector<std::pair<int64_t, std::string>>& entries);
+
+    void set_counter(const std::string& name, int64_t value, bool add);
+
+    void start_clock(const std::string& name, gint64 elapsed_us);
+
+    bool any_menu_visible() const;
+
+    void render_templates();
+
+    void schedule_templates();
+
+    bool move_item(int64_t handle, int64_t tray_index, int64_t submenu, int64_t before);
+
+    bool reorder_children(int64_t submenu, const std::vector<int64_t>& handles);
+
+    void post_event(int64_t plugin_id, FlValue* event);
+
+    void post_to_users(const Tray& tray, FlValue* event);
+
+    void set_stall_threshold(gint64 threshold_us);
+
+    void schedule_heartbeat();
+
+    FlValue* new_slow_event(const gchar* operation, int64_t tray_index, FlValue* args, gint64 duration_us);
+
+    void restore_snapshots();
+
+    void restore(const menu_snapshot::Snapshot& snapshot);
+
+    bool save_snapshot(int64_t tray_index);
+
+    void discard_snapshot(int64_t tray_index);
+};
+
 struct _TrayMenuPlugin {
     GObject parent_instance;
     FlMethodChannel* channel;
-    AppIndicator* app_indicator;
-    IndexedMenu menu;
+    int64_t id;
+    // Events go out on their own channel in batches, one per main loop iteration, numbered consecutively. Events are
+    // dropped while Dart doesn't listen, and don't take up numbers then.
+    FlEventChannel* event_channel;
+    bool listening;
+    FlValue* pending_events;
+    int64_t next_sequence;
+    guint flush_source_id;
+
+    void post_event(FlValue* event);
+
+    void flush_events();
 
     FlMethodResponse* init(FlValue* args);
 
     FlMethodResponse* show_tray_icon(FlValue* args);
 
+    FlMethodResponse* set_tray_label(FlValue* args);
+
+    FlMethodResponse* set_tray_title(FlValue* args);
+
+    FlMethodResponse* set_tray_text_rate(FlValue* args);
+
     FlMethodResponse* add_menu_item(FlValue* args);
 
     FlMethodResponse* remove_menu_item(FlValue* args);
 
+    FlMethodResponse* clear_children(FlValue* args);
+
+    FlMethodResponse* replace_children(FlValue* args);
+
+    FlMethodResponse* move_menu_item(FlValue* args);
+
+    FlMethodResponse* reorder_children(FlValue* args);
+
     FlMethodResponse* get_menu_item_label(FlValue* args);
 
     FlMethodResponse* set_menu_item_label(FlValue* args);
@@ -93,136 +763,1369 @@ struct _TrayMenuPlugin {
 
     FlMethodResponse* set_menu_item_enabled(FlValue* args);
 
+    FlMethodResponse* set_menu_item_icon(FlValue* args);
+
     FlMethodResponse* get_menu_item_checked(FlValue* args);
 
     FlMethodResponse* set_menu_item_checked(FlValue* args);
+
+    FlMethodResponse* select_radio(FlValue* args);
+
+    FlMethodResponse* set_strings(FlValue* args);
+
+    FlMethodResponse* set_label_templates(FlValue* args);
+
+    FlMethodResponse* set_counter(FlValue* args);
+
+    FlMethodResponse* add_to_counter(FlValue* args);
+
+    FlMethodResponse* start_clock(FlValue* args);
+
+    FlMethodResponse* register_icon(FlValue* args);
+
+    FlMethodResponse* set_icon_cache_capacity(FlValue* args);
+
+    FlMethodResponse* set_stall_threshold(FlValue* args);
+
+    FlMethodResponse* get_manifest(FlValue* args);
+
+    FlMethodResponse* update_menu_item(FlValue* args);
+
+    FlMethodResponse* commit_menu(FlValue* args);
+
+    FlMethodResponse* discard_snapshot(FlValue* args);
+
+    FlMethodResponse* get_memory_report(FlValue* args);
 };
 
 G_DEFINE_TYPE(TrayMenuPlugin, tray_menu_plugin, g_object_get_type())
 
-FlMethodResponse* TrayMenuPlugin::init(FlValue* args) {
-    g_clear_object(&app_indicator);
-    menu = IndexedMenu{};
-    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+// The owner of the items restored from a snapshot until an engine claims them with getManifest.
+constexpr int64_t restored_owner = -1;
+
+// The names of the Dart classes describing each MenuItemType, in order.
+static const gchar* const menu_item_type_names[] = {
+        "_MenuItemLabel", "_MenuItemSeparator", "_MenuItemCheckbox", "_MenuItemSubmenu", "_MenuItemRadio"};
+
+// Allocated under a lock because the exported C ABI may allocate handles off the main thread, where the trays themselves
+// must not be touched.
+static int64_t allocate_handle(int64_t tray_index) {
+    static std::mutex mutex;
+    static std::unordered_map<int64_t, int64_t> next_handles;
+    std::lock_guard<std::mutex> lock(mutex);
+    return (tray_index << tray_handle_shift) | next_handles[tray_index]++;
 }
 
-FlMethodResponse* TrayMenuPlugin::show_tray_icon(FlValue* args) {
-    if (app_indicator) {
-        return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+// gtkmm needs exactly one Gtk::Main per process. It is only created once a tray first needs widgets, so that apps which
+// never show a tray, or only use the dbusmenu backend, don't pay for it, and is destroyed along with the last tray
+// holding it.
+static std::shared_ptr<Gtk::Main> acquire_gtkmm() {
+    static std::weak_ptr<Gtk::Main> instance;
+    auto gtkmm = instance.lock();
+    if (!gtkmm) {
+        Glib::init();
+        gtkmm    = std::make_shared<Gtk::Main>();
+        instance = gtkmm;
     }
-    const auto icon = fl_value_get_string(args);
-    app_indicator   = app_indicator_new("tray-icon", icon, APP_INDICATOR_CATEGORY_APPLICATION_STATUS);
-    app_indicator_set_status(app_indicator, APP_INDICATOR_STATUS_ACTIVE);
-    app_indicator_set_menu(app_indicator, menu.gobj());
-    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+    return gtkmm;
 }
 
-std::unique_ptr<Gtk::MenuItem> create_label_menu_item(FlValue* args) {
-    const gchar* label = fl_value_get_string(fl_value_lookup_string(args, "label"));
-    const bool enabled = fl_value_get_bool(fl_value_lookup_string(args, "enabled"));
-    auto item          = std::make_unique<Gtk::MenuItem>(label);
-    item->set_sensitive(enabled);
-    return item;
+IndexedMenu& AppIndicatorTray::ensure_menu() {
+    if (!menu) {
+        if (!gtkmm) {
+            gtkmm = acquire_gtkmm();
+        }
+        menu = std::make_unique<IndexedMenu>();
+        track_object(G_OBJECT(menu->gobj()));
+    }
+    return *menu;
 }
 
-std::unique_ptr<Gtk::MenuItem> create_separator_menu_item(FlValue*) {
-    return std::make_unique<Gtk::SeparatorMenuItem>();
-}
+IndexedMenu* AppIndicatorTray::get_parent_menu(int64_t submenu_handle) {
+    if (submenu_handle < 0) {
+        return &ensure_menu();
+    }
+    auto submenu_item = get_item(submenu_handle);
+    if (!submenu_item || !submenu_item->has_submenu()) {
+        return nullptr;
+    }
+    return dynamic_cast<IndexedMenu*>(submenu_item->get_submenu());
+}
 
-std::unique_ptr<Gtk::MenuItem> create_checkbox_menu_item(FlValue* args) {
-    const gchar* label = fl_value_get_string(fl_value_lookup_string(args, "label"));
-    const bool enabled = fl_value_get_bool(fl_value_lookup_string(args, "enabled"));
-    const bool checked = fl_value_get_bool(fl_value_lookup_string(args, "checked"));
-    auto item          = std::make_unique<Gtk::CheckMenuItem>(label);
+// How long to wait for a StatusNotifierWatcher before falling back to AppIndicator's own XEmbed tray icon.
+constexpr guint status_notifier_watcher_timeout_ms = 3000;
+
+// The menu is only handed to the indicator here, so everything added before the tray is ready is built locally and
+// exported over D-Bus in a single layout update.
+void AppIndicatorTray::create_app_indicator() {
+    if (app_indicator) {
+        return;
+    }
+    app_indicator = app_indicator_new(id.c_str(), icon, APP_INDICATOR_CATEGORY_APPLICATION_STATUS);
+    track_object(G_OBJECT(app_indicator));
+    app_indicator_set_status(app_indicator, APP_INDICATOR_STATUS_ACTIVE);
+    if (!label.empty()) {
+        app_indicator_set_label(app_indicator, label.c_str(), label_guide.c_str());
+    }
+    if (!title.empty()) {
+        app_indicator_set_title(app_indicator, title.c_str());
+    }
+    app_indicator_set_menu(app_indicator, ensure_menu().gobj());
+}
+
+void AppIndicatorTray::set_indicator_label(const gchar* label, const gchar* guide) {
+    this->label = label;
+    label_guide = guide;
+    if (app_indicator) {
+        app_indicator_set_label(app_indicator, label, guide);
+    }
+}
+
+void AppIndicatorTray::set_title(const gchar* title) {
+    this->title = title;
+    if (app_indicator) {
+        app_indicator_set_title(app_indicator, title[0] ? title : id.c_str());
+    }
+}
+
+void AppIndicatorTray::clear() {
+    if (watcher_id) {
+        g_bus_unwatch_name(watcher_id);
+        watcher_id = 0;
+    }
+    if (fallback_source_id) {
+        g_source_remove(fallback_source_id);
+        fallback_source_id = 0;
+    }
+    g_clear_object(&app_indicator);
+    g_clear_pointer(&icon, g_free);
+    label.clear();
+    label_guide.clear();
+    title.clear();
+    ready = false;
+    menu.reset();
+    radio_groups.clear();
+}
+
+static void status_notifier_watcher_appeared_cb(GDBusConnection*, const gchar*, const gchar*, gpointer user_data) {
+    auto tray = static_cast<AppIndicatorTray*>(user_data);
+    if (tray->fallback_source_id) {
+        g_source_remove(tray->fallback_source_id);
+        tray->fallback_source_id = 0;
+    }
+    tray->create_app_indicator();
+    if (!tray->ready) {
+        tray->ready = true;
+        tray->listener.on_status("trayReady");
+    }
+}
+
+static gboolean status_notifier_watcher_timeout_cb(gpointer user_data) {
+    auto tray                = static_cast<AppIndicatorTray*>(user_data);
+    tray->fallback_source_id = 0;
+    tray->create_app_indicator();
+    tray->listener.on_status("trayUnavailable");
+    return G_SOURCE_REMOVE;
+}
+
+static void status_notifier_watcher_vanished_cb(GDBusConnection*, const gchar*, gpointer user_data) {
+    auto tray = static_cast<AppIndicatorTray*>(user_data);
+    if (tray->ready) {
+        tray->ready = false;
+        tray->listener.on_status("trayUnavailable");
+    } else if (!tray->fallback_source_id && !tray->app_indicator) {
+        tray->fallback_source_id =
+                g_timeout_add(status_notifier_watcher_timeout_ms, status_notifier_watcher_timeout_cb, tray);
+    }
+}
+
+// Registration with the StatusNotifierWatcher happens asynchronously: the call returns right away and Dart is told
+// through trayReady or trayUnavailable once the outcome is known.
+void AppIndicatorTray::show(const gchar* icon_path) {
+    if (icon) {
+        return;
+    }
+    ensure_menu();
+    icon       = g_strdup(icon_path);
+    watcher_id = g_bus_watch_name(G_BUS_TYPE_SESSION,
+                                  "org.kde.StatusNotifierWatcher",
+                                  G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                  status_notifier_watcher_appeared_cb,
+                                  status_notifier_watcher_vanished_cb,
+                                  this,
+                                  nullptr);
+}
+
+// An item that hands its activations to the tray's dispatcher instead of each item connecting a closure of its own.
+template<typename Base>
+struct TrayItem : Base {
+    template<typename... Args>
+    TrayItem(AppIndicatorTray& tray, int64_t handle, Args&&... args)
+        : Base(std::forward<Args>(args)...), tray{tray}, handle{handle} {}
+
+    AppIndicatorTray& tray;
+    const int64_t handle;
+
+protected:
+    void on_activate() override {
+        const auto started_at_us = g_get_monotonic_time();
+        Base::on_activate();
+        tray.activate(handle, *this, started_at_us);
+    }
+};
+
+std::unique_ptr<Gtk::MenuItem> create_label_menu_item(AppIndicatorTray& tray,
+                                                      int64_t handle,
+                                                      const gchar* label,
+                                                      bool enabled,
+                                                      bool) {
+    auto item = std::make_unique<TrayItem<Gtk::ImageMenuItem>>(tray, handle, label);
+    item->set_sensitive(enabled);
+    return item;
+}
+
+std::unique_ptr<Gtk::MenuItem> create_separator_menu_item(AppIndicatorTray& tray,
+                                                          int64_t handle,
+                                                          const gchar*,
+                                                          bool,
+                                                          bool) {
+    return std::make_unique<TrayItem<Gtk::SeparatorMenuItem>>(tray, handle);
+}
+
+std::unique_ptr<Gtk::MenuItem> create_checkbox_menu_item(AppIndicatorTray& tray,
+                                                         int64_t handle,
+                                                         const gchar* label,
+                                                         bool enabled,
+                                                         bool checked) {
+    auto item = std::make_unique<TrayItem<Gtk::CheckMenuItem>>(tray, handle, label);
     item->set_sensitive(enabled);
     item->set_active(checked);
     return item;
 }
 
-std::unique_ptr<Gtk::MenuItem> create_submenu_menu_item(FlValue* args) {
-    const gchar* label = fl_value_get_string(fl_value_lookup_string(args, "label"));
-    const bool enabled = fl_value_get_bool(fl_value_lookup_string(args, "enabled"));
-    auto item          = std::make_unique<Gtk::MenuItem>(label);
-    auto submenu       = Gtk::make_managed<IndexedMenu>();
-    item->set_submenu(*submenu);
+std::unique_ptr<Gtk::MenuItem> create_submenu_menu_item(AppIndicatorTray& tray,
+                                                        int64_t handle,
+                                                        const gchar* label,
+                                                        bool enabled,
+                                                        bool) {
+    auto item = std::make_unique<TrayItem<MenuItemSubmenu>>(tray, handle, label);
+    item->set_sensitive(enabled);
+    track_object(G_OBJECT(item->menu.gobj()));
+    return item;
+}
+
+std::unique_ptr<Gtk::MenuItem> create_radio_menu_item(AppIndicatorTray& tray,
+                                                      int64_t handle,
+                                                      std::shared_ptr<RadioGroup> radio_group,
+                                                      const gchar* label,
+                                                      bool enabled) {
+    auto item = std::make_unique<TrayItem<MenuItemRadio>>(tray, handle, std::move(radio_group), label);
     item->set_sensitive(enabled);
     return item;
 }
 
+std::unique_ptr<Gtk::MenuItem> create_menu_item(AppIndicatorTray& tray,
+                                                int64_t handle,
+                                                MenuItemType type,
+                                                const gchar* label,
+                                                bool enabled,
+                                                bool checked,
+                                                std::shared_ptr<RadioGroup> radio_group) {
+    std::unique_ptr<Gtk::MenuItem> item;
+    switch (type) {
+        case MenuItemType::label:
+            item = create_label_menu_item(tray, handle, label, enabled, checked);
+            break;
+        case MenuItemType::separator:
+            item = create_separator_menu_item(tray, handle, label, enabled, checked);
+            break;
+        case MenuItemType::checkbox:
+            item = create_checkbox_menu_item(tray, handle, label, enabled, checked);
+            break;
+        case MenuItemType::submenu:
+            item = create_submenu_menu_item(tray, handle, label, enabled, checked);
+            break;
+        case MenuItemType::radio:
+            item = create_radio_menu_item(tray, handle, std::move(radio_group), label, enabled);
+            break;
+    }
+    track_object(G_OBJECT(item->gobj()));
+    return item;
+}
+
+// Widgets hold their own copy of the label, so only the binding to the string table is kept here.
+bool AppIndicatorTray::add_item(int64_t handle, int64_t owner, const ItemSpec& spec, int64_t parent, int64_t before) {
+    const auto parent_menu = get_parent_menu(parent);
+    if (!parent_menu) {
+        return false;
+    }
+    const auto label = spec.text ? spec.text->c_str() : spec.label.c_str();
+    if (spec.type != MenuItemType::radio) {
+        auto item = create_menu_item(*this, handle, spec.type, label, spec.enabled, spec.checked, nullptr);
+        return parent_menu->add_item(handle, owner, spec, std::move(item), before);
+    }
+
+    auto item  = create_menu_item(
+            *this, handle, spec.type, label, spec.enabled, spec.checked, ensure_radio_group(owner, spec.group));
+    auto radio = static_cast<MenuItemRadio*>(item.get());
+    if (!parent_menu->add_item(handle, owner, spec, std::move(item), before)) {
+        return false;
+    }
+    if (spec.checked || !radio->radio_group->has_selection()) {
+        select(*radio);
+    }
+    return true;
+}
+
+std::shared_ptr<RadioGroup> AppIndicatorTray::ensure_radio_group(int64_t owner, int64_t group) {
+    auto& entry      = radio_groups[{owner, group}];
+    auto radio_group = entry.lock();
+    if (!radio_group) {
+        radio_group = std::make_shared<RadioGroup>(group);
+        entry       = radio_group;
+    }
+    return radio_group;
+}
+
+// GTK deselects the rest of the group as part of activating the item.
+void AppIndicatorTray::select(MenuItemRadio& item) {
+    selecting = true;
+    item.set_active(true);
+    selecting = false;
+}
+
+// Selecting a radio item also activates the one it deselects, which is not reported. The owner is looked up rather than
+// kept by the item, as it changes when restored items are claimed.
+void AppIndicatorTray::activate(int64_t handle, Gtk::MenuItem& item, gint64 started_at_us) {
+    const auto radio = dynamic_cast<MenuItemRadio*>(&item);
+    if (radio && (selecting || !radio->get_active())) {
+        return;
+    }
+    const auto entry = menu ? menu->find_entry(handle) : nullptr;
+    if (entry) {
+        listener.on_activate(handle, entry->owner, started_at_us);
+    }
+}
+
+AppIndicatorTray::Footprint AppIndicatorTray::measure(const FootprintVisitor& visit) {
+    Footprint footprint;
+    if (menu) {
+        menu->measure(-1, visit);
+        footprint = menu->own_footprint();
+        footprint.model_bytes += malloc_usable_size(menu.get());
+    }
+    footprint.model_bytes += sizeof(*this) + radio_groups.size() * (sizeof(*radio_groups.begin()) + 4 * sizeof(void*));
+    footprint.string_bytes += id.capacity() + label.capacity() + label_guide.capacity() + title.capacity() +
+                              (icon ? strlen(icon) + 1 : 0);
+    if (app_indicator) {
+        footprint.object_bytes += instance_size(app_indicator);
+        footprint.signal_handlers += count_signal_handlers(app_indicator);
+    }
+    return footprint;
+}
+
+// Clearing the top-level menu doesn't create it, or gtkmm, if nothing was ever added.
+bool AppIndicatorTray::clear_children(int64_t parent) {
+    if (parent < 0 && !menu) {
+        return true;
+    }
+    const auto parent_menu = get_parent_menu(parent);
+    if (!parent_menu) {
+        return false;
+    }
+    parent_menu->clear_items();
+    return true;
+}
+
+bool AppIndicatorTray::move_item(int64_t handle, int64_t parent, int64_t before) {
+    const auto source = menu ? menu->find_menu_of(handle) : nullptr;
+    const auto target = get_parent_menu(parent);
+    if (!source || !target) {
+        return false;
+    }
+    const auto submenu = dynamic_cast<IndexedMenu*>(source->get_item(handle)->get_submenu());
+    if (submenu && submenu->contains(*target)) {
+        return false;
+    }
+    return source->move_item(handle, *target, before);
+}
+
+bool AppIndicatorTray::reorder_children(int64_t parent, const std::vector<int64_t>& handles) {
+    const auto parent_menu = get_parent_menu(parent);
+    return parent_menu && parent_menu->reorder_items(handles);
+}
+
+bool AppIndicatorTray::get_label(int64_t handle, std::string& label) {
+    auto item = get_item(handle);
+    if (!item) {
+        return false;
+    }
+    label = item->get_label();
+    return true;
+}
+
+bool AppIndicatorTray::set_label(int64_t handle, const gchar* label) {
+    const auto entry = menu ? menu->find_entry(handle) : nullptr;
+    if (!entry) {
+        return false;
+    }
+    entry->item->set_label(label);
+    entry->string_id = -1;
+    return true;
+}
+
+bool AppIndicatorTray::get_enabled(int64_t handle, bool& enabled) {
+    auto item = get_item(handle);
+    if (!item) {
+        return false;
+    }
+    enabled = item->get_sensitive();
+    return true;
+}
+
+bool AppIndicatorTray::set_enabled(int64_t handle, bool enabled) {
+    auto item = get_item(handle);
+    if (!item) {
+        return false;
+    }
+    item->set_sensitive(enabled);
+    return true;
+}
+
+bool AppIndicatorTray::set_icon(int64_t handle, const SharedIcon& icon) {
+    const auto entry = menu ? menu->find_entry(handle) : nullptr;
+    if (!entry || !set_item_icon(*entry->item, icon)) {
+        return false;
+    }
+    entry->icon = icon;
+    return true;
+}
+
+bool AppIndicatorTray::get_checked(int64_t handle, bool& checked) {
+    auto item = get_item<Gtk::CheckMenuItem>(handle);
+    if (!item) {
+        return false;
+    }
+    checked = item->get_active();
+    return true;
+}
+
+bool AppIndicatorTray::set_checked(int64_t handle, bool checked) {
+    auto item = get_item<Gtk::CheckMenuItem>(handle);
+    if (!item || dynamic_cast<MenuItemRadio*>(item)) {
+        return false;
+    }
+    item->set_active(checked);
+    return true;
+}
+
+bool AppIndicatorTray::select_radio(int64_t group, int64_t handle) {
+    auto item = get_item<MenuItemRadio>(handle);
+    if (!item || item->radio_group->id != group) {
+        return false;
+    }
+    select(*item);
+    return true;
+}
+
+bool AppIndicatorTray::update_item(int64_t handle, const ItemSpec& spec) {
+    const auto entry = menu ? menu->find_entry(handle) : nullptr;
+    if (!entry || entry->type != spec.type) {
+        return false;
+    }
+    const auto radio = dynamic_cast<MenuItemRadio*>(entry->item.get());
+    if (radio && radio->radio_group->id != spec.group) {
+        return false;
+    }
+    auto& item        = *entry->item;
+    const auto& label = spec.text ? *spec.text : spec.label;
+    if (spec.type != MenuItemType::separator && item.get_label() != label) {
+        item.set_label(label);
+    }
+    if (entry->icon != spec.image) {
+        entry->icon = set_item_icon(item, spec.image) ? spec.image : nullptr;
+    }
+    entry->string_id = spec.string_id;
+    item.set_sensitive(spec.enabled);
+    if (radio) {
+        if (spec.checked) {
+            select(*radio);
+        }
+    } else if (spec.type == MenuItemType::checkbox) {
+        static_cast<Gtk::CheckMenuItem&>(item).set_active(spec.checked);
+    }
+    return true;
+}
+
+// A group the new owner already has keeps its members apart from the one handed over.
+void AppIndicatorTray::reassign(int64_t from, int64_t to) {
+    if (menu) {
+        menu->reassign(from, to);
+    }
+    for (auto it = radio_groups.begin(); it != radio_groups.end();) {
+        if (it->first.first == from) {
+            radio_groups.insert({{to, it->first.second}, it->second});
+            it = radio_groups.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+static std::unique_ptr<TrayBackend> create_backend(int64_t index, std::string id, TrayBackend::Listener& listener) {
+    const auto backend = g_getenv(backend_env_var);
+    if (g_strcmp0(backend ? backend : TRAY_MENU_DEFAULT_BACKEND, "dbusmenu") == 0) {
+        return std::make_unique<DBusMenuTray>(index, std::move(id), listener);
+    }
+    return std::make_unique<AppIndicatorTray>(std::move(id), listener);
+}
+
+Tray::Tray(int64_t index, std::string id)
+    : index{index}, id{std::move(id)}, backend{create_backend(index, this->id, *this)} {}
+
+Tray::~Tray() {
+    g_clear_handle_id(&text_source_id, g_source_remove);
+}
+
+void Tray::set_label(const gchar* label, const gchar* guide) {
+    if (this->label == label && label_guide == guide) {
+        return;
+    }
+    this->label   = label;
+    label_guide   = guide;
+    label_pending = true;
+    schedule_text();
+}
+
+void Tray::set_title(const gchar* title) {
+    if (this->title == title) {
+        return;
+    }
+    this->title   = title;
+    title_pending = true;
+    schedule_text();
+}
+
+// Takes effect for text already waiting, which may then be applied sooner or later than it would have been.
+void Tray::set_text_rate(double hz) {
+    text_rate_hz = hz;
+    if (text_source_id) {
+        g_clear_handle_id(&text_source_id, g_source_remove);
+        schedule_text();
+    }
+}
+
+// Text set once the interval since the last change has passed is applied at the end of the main loop iteration, so
+// setting the label and title together still takes a single turn. A rate of zero or less applies every change.
+void Tray::schedule_text() {
+    if (text_source_id) {
+        return;
+    }
+    const auto apply_cb = [](gpointer tray) {
+        static_cast<Tray*>(tray)->text_source_id = 0;
+        static_cast<Tray*>(tray)->apply_text();
+        return G_SOURCE_REMOVE;
+    };
+    const gint64 interval_us = text_rate_hz > 0 ? static_cast<gint64>(G_USEC_PER_SEC / text_rate_hz) : 0;
+    const auto wait_us       = text_applied_at + interval_us - g_get_monotonic_time();
+    if (wait_us <= 0) {
+        text_source_id = g_idle_add(apply_cb, this);
+    } else {
+        text_source_id = g_timeout_add((wait_us + 999) / 1000, apply_cb, this);
+    }
+}
+
+void Tray::apply_text() {
+    text_applied_at = g_get_monotonic_time();
+    if (label_pending) {
+        backend->set_indicator_label(label.c_str(), label_guide.c_str());
+        label_pending = false;
+    }
+    if (title_pending) {
+        backend->set_title(title.c_str());
+        title_pending = false;
+    }
+}
+
+// For when the backend was cleared, which drops its label and title.
+void Tray::clear_text() {
+    g_clear_handle_id(&text_source_id, g_source_remove);
+    label.clear();
+    label_guide.clear();
+    title.clear();
+    label_pending = false;
+    title_pending = false;
+}
+
+// Starts an event of a tray, stamped with the monotonic time it happened at.
+static FlValue* new_event(const gchar* type, int64_t tray_index) {
+    const auto event = fl_value_new_map();
+    fl_value_set_string_take(event, "type", fl_value_new_string(type));
+    fl_value_set_string_take(event, "time", fl_value_new_int(g_get_monotonic_time()));
+    fl_value_set_string_take(event, "tray", fl_value_new_int(tray_index));
+    return event;
+}
+
+// A host that goes away can't be showing the menu anymore.
+void Tray::on_status(const gchar* method) {
+    status                   = method;
+    g_autoptr(FlValue) event = new_event(method, index);
+    TrayService::get().post_to_users(*this, event);
+    if (menu_visible && g_strcmp0(method, "trayUnavailable") == 0) {
+        on_menu_visible(-1, false);
+    }
+}
+
+// The templates are rendered before the menu shows, so it never opens with stale labels. A submenu opening means the
+// menu is showing, even if the host didn't say so for the root.
+void Tray::on_menu_visible(int64_t submenu, bool visible) {
+    if (submenu >= 0) {
+        if (visible) {
+            on_menu_visible(-1, true);
+        }
+        g_autoptr(FlValue) event = new_event(visible ? "opened" : "closed", index);
+        fl_value_set_string_take(event, "handle", fl_value_new_int(submenu));
+        TrayService::get().post_to_users(*this, event);
+        return;
+    }
+    if (menu_visible == visible) {
+        return;
+    }
+    menu_visible  = visible;
+    auto& service = TrayService::get();
+    if (visible && (service.templates_stale || service.clock_source_id)) {
+        service.render_templates();
+    }
+    service.schedule_templates();
+    g_autoptr(FlValue) event = new_event(visible ? "opened" : "closed", index);
+    service.post_to_users(*this, event);
+}
+
+// Items added without a known owner (owner 0) report their activations to every engine using the tray; only the one
+// that holds the handle will act on it. So do restored items, which are dropped if no engine uses the tray yet.
+// Checkboxes and radio items carry their state after the click. A click that took longer than the stall threshold to
+// handle, GTK's own handling of the activate signal included, is reported the same way.
+void Tray::on_activate(int64_t handle, int64_t owner, gint64 started_at_us) {
+    auto& service   = TrayService::get();
+    const auto post = [&](FlValue* event) {
+        if (owner > 0) {
+            service.post_event(owner, event);
+        } else {
+            service.post_to_users(*this, event);
+        }
+    };
+    g_autoptr(FlValue) event = new_event("activated", index);
+    fl_value_set_string_take(event, "handle", fl_value_new_int(handle));
+    bool checked;
+    if (backend->get_checked(handle, checked)) {
+        fl_value_set_string_take(event, "checked", fl_value_new_bool(checked));
+    }
+    post(event);
+
+    const auto duration_us = g_get_monotonic_time() - started_at_us;
+    if (service.stall_threshold_us && duration_us > service.stall_threshold_us) {
+        g_autoptr(FlValue) slow = service.new_slow_event("activate", index, nullptr, duration_us);
+        fl_value_set_string_take(slow, "handle", fl_value_new_int(handle));
+        post(slow);
+    }
+}
+
+// Intentionally never destroyed: trays are torn down as the engines using them detach, and nothing else it holds needs
+// cleaning up at exit.
+TrayService& TrayService::get() {
+    static auto service = new TrayService();
+    return *service;
+}
+
+int64_t TrayService::attach(TrayMenuPlugin* plugin) {
+    const auto plugin_id = next_plugin_id++;
+    plugins[plugin_id]   = plugin;
+    return plugin_id;
+}
+
+// Memory doesn't grow with the number of engines: whatever an engine added goes away with it, and so does a tray once
+// no engine uses it anymore.
+void TrayService::detach(int64_t plugin_id) {
+    plugins.erase(plugin_id);
+    for (auto it = trays.begin(); it != trays.end();) {
+        auto& tray = *it->second;
+        if (tray.users.erase(plugin_id) && tray.users.empty()) {
+            it = trays.erase(it);
+            continue;
+        }
+        tray.backend->remove_owned_by(plugin_id);
+        ++it;
+    }
+    if (plugins.empty()) {
+        recorder.reset();
+        set_stall_threshold(0);
+    }
+}
+
+Tray& TrayService::ensure_tray(int64_t index, const gchar* id) {
+    auto& tray = trays[index];
+    if (!tray) {
+        const auto default_id = index ? "tray-icon-" + std::to_string(index) : std::string("tray-icon");
+        tray                  = std::make_unique<Tray>(index, id ? id : default_id);
+    }
+    return *tray;
+}
+
+// Trays created by id get the same index in every engine: that of the tray already using the id, whether another
+// engine created it or it was restored from its snapshot, or else the lowest one not taken. The default tray, index 0,
+// is never matched by id.
+int64_t TrayService::tray_index_for(const std::string& id) const {
+    for (const auto& it : trays) {
+        if (it.first != 0 && it.second->id == id) {
+            return it.first;
+        }
+    }
+    int64_t index = 1;
+    while (trays.count(index)) {
+        ++index;
+    }
+    return index;
+}
+
+// An engine calling init only resets what it added itself, unless it is the tray's only user, in which case the tray is
+// torn down completely as before. A tray restored from a snapshot keeps its menu for the engine to claim, and an engine
+// reattaching after a hot restart keeps its own items and the icon, which it takes over again through getManifest.
+void TrayService::init_tray(int64_t owner, int64_t index, const gchar* id, bool reattach) {
+    auto& tray = ensure_tray(index, id);
+    tray.users.insert(owner);
+    if (reattach) {
+        return;
+    }
+    if (tray.users.size() == 1 && !tray.restored) {
+        tray.backend->clear();
+        tray.clear_text();
+        tray.status = nullptr;
+    } else {
+        tray.backend->remove_owned_by(owner);
+    }
+}
+
+TrayBackend* TrayService::backend_for_handle(int64_t handle) {
+    const auto it = trays.find(handle >> tray_handle_shift);
+    return it != trays.end() ? it->second->backend.get() : nullptr;
+}
+
+// Resolves the entry of the string table and the icon an item refers to. Labels bound to a string that hasn't been set
+// yet start out empty and pick up its text once it is, while icons that aren't registered yet are not shown.
+void TrayService::resolve(ItemSpec& spec) {
+    if (!spec.icon.empty()) {
+        spec.image = icons.get(spec.icon);
+    }
+    if (spec.string_id < 0) {
+        return;
+    }
+    const auto it = strings.find(spec.string_id);
+    spec.text     = it != strings.end() ? it->second : std::make_shared<const std::string>();
+}
+
+// Top-level items create their tray on demand; items added to a submenu need the submenu's tray to exist already.
+bool TrayService::add_item(int64_t owner,
+                           int64_t handle,
+                           ItemSpec spec,
+                           int64_t tray_index,
+                           int64_t submenu,
+                           int64_t before) {
+    const auto backend = submenu >= 0 ? backend_for_handle(submenu) : ensure_tray(tray_index).backend.get();
+    resolve(spec);
+    return backend && backend->add_item(handle, owner, spec, submenu, before);
+}
+
+bool TrayService::clear_children(int64_t tray_index, int64_t submenu) {
+    const auto backend = submenu >= 0 ? backend_for_handle(submenu) : ensure_tray(tray_index).backend.get();
+    return backend && backend->clear_children(submenu);
+}
+
+// Clears the menu and adds the new items in one go, appending the new items' handles to handles. All of it happens
+// within one main loop iteration, so the dbusmenu backend announces it as a single layout update of the menu.
+//
+// The labels are resolved and the submenu checked before anything is cleared. Should an add still fail, the menu is
+// cleared again instead of being left half built, so a failed replace always leaves the menu empty or missing.
+bool TrayService::replace_children(int64_t owner,
+                                   int64_t tray_index,
+                                   int64_t submenu,
+                                   std::vector<ItemSpec> specs,
+                                   std::vector<int64_t>& handles) {
+    const auto backend = submenu >= 0 ? backend_for_handle(submenu) : ensure_tray(tray_index).backend.get();
+    if (!backend) {
+        return false;
+    }
+    for (auto& spec : specs) {
+        resolve(spec);
+    }
+    if (!backend->clear_children(submenu)) {
+        return false;
+    }
+    const auto added = handles.size();
+    handles.reserve(added + specs.size());
+    for (const auto& spec : specs) {
+        const auto handle = allocate_handle(submenu >= 0 ? submenu >> tray_handle_shift : tray_index);
+        if (!backend->add_item(handle, owner, spec, submenu, -1)) {
+            backend->clear_children(submenu);
+            handles.resize(added);
+            return false;
+        }
+        handles.push_back(handle);
+    }
+    return true;
+}
+
+// Setting the text of an entry rendered from a template replaces the template.
+void TrayService::set_strings(const std::vector<std::pair<int64_t, std::string>>& entries) {
+    for (const auto& entry : entries) {
+        templates.erase(entry.first);
+    }
+    update_strings(entries);
+    schedule_templates();
+}
+
+// Entries whose text doesn't change are skipped, and the rest are applied to every tray in one pass over each menu, so
+// switching the language of the whole table costs one call however many items are bound to it.
+void TrayService::update_strings(const std::vector<std::pair<int64_t, std::string>>& entries) {
+    std::unordered_map<int64_t, SharedString> changed;
+    for (const auto& entry : entries) {
+        auto& text = strings[entry.first];
+        if (!text || *text != entry.second) {
+            text                 = std::make_shared<const std::string>(entry.second);
+            changed[entry.first] = text;
+        }
+    }
+    if (changed.empty()) {
+        return;
+    }
+    for (const auto& it : trays) {
+        it.second->backend->relabel(changed);
+    }
+}
+
+// The templates are rendered right away, so items bound to them have a label even while no menu is visible.
+void TrayService::set_templates(const std::vector<std::pair<int64_t, std::string>>& entries) {
+    for (const auto& entry : entries) {
+        templates[entry.first] = label_template::parse(entry.second);
+    }
+    render_templates();
+    schedule_templates();
+}
+
+void TrayService::set_counter(const std::string& name, int64_t value, bool add) {
+    auto& counter = sources.counters[name];
+    counter       = add ? counter + value : value;
+    if (!templates.empty()) {
+        templates_stale = true;
+        schedule_templates();
+    }
+}
+
+void TrayService::start_clock(const std::string& name, gint64 elapsed_us) {
+    sources.clocks[name] = g_get_monotonic_time() - elapsed_us;
+    if (!templates.empty()) {
+        templates_stale = true;
+        schedule_templates();
+    }
+}
+
+// Menus of backends that can't tell are always treated as visible.
+bool TrayService::any_menu_visible() const {
+    return std::any_of(trays.begin(), trays.end(), [](const auto& it) {
+        return it.second->menu_visible || !it.second->backend->tracks_visibility();
+    });
+}
+
+void TrayService::render_templates() {
+    templates_stale = false;
+    if (templates.empty()) {
+        return;
+    }
+    const auto now_us = g_get_monotonic_time();
+    std::vector<std::pair<int64_t, std::string>> entries;
+    entries.reserve(templates.size());
+    for (const auto& it : templates) {
+        entries.emplace_back(it.first, it.second.render(sources, now_us));
+    }
+    update_strings(entries);
+}
+
+// While no menu is visible nothing is rendered: changed sources only mark the templates stale, and clocks don't tick.
+// While one is, changes are rendered once per main loop iteration, and templates showing a clock every second.
+void TrayService::schedule_templates() {
+    const auto visible = any_menu_visible();
+    if (visible && templates_stale && !render_source_id) {
+        render_source_id = g_idle_add(
+                [](gpointer) {
+                    auto& service            = TrayService::get();
+                    service.render_source_id = 0;
+                    service.render_templates();
+                    return G_SOURCE_REMOVE;
+                },
+                nullptr);
+    }
+    const auto ticking = visible && std::any_of(templates.begin(), templates.end(), [](const auto& it) {
+        return it.second.uses_clock();
+    });
+    if (ticking && !clock_source_id) {
+        clock_source_id = g_timeout_add_seconds(
+                1,
+                [](gpointer) {
+                    TrayService::get().render_templates();
+                    return G_SOURCE_CONTINUE;
+                },
+                nullptr);
+    } else if (!ticking && clock_source_id) {
+        g_source_remove(clock_source_id);
+        clock_source_id = 0;
+    }
+}
+
+// Items can only move within their tray. A submenu of -1 means the top-level menu of tray_index.
+bool TrayService::move_item(int64_t handle, int64_t tray_index, int64_t submenu, int64_t before) {
+    if (submenu < 0 && tray_index != handle >> tray_handle_shift) {
+        return false;
+    }
+    const auto backend = backend_for_handle(handle);
+    return backend && backend->move_item(handle, submenu, before);
+}
+
+// The handles themselves name the tray whose top-level menu is reordered, so there is nothing to do without any.
+bool TrayService::reorder_children(int64_t submenu, const std::vector<int64_t>& handles) {
+    if (handles.empty()) {
+        return true;
+    }
+    const auto backend = backend_for_handle(submenu >= 0 ? submenu : handles.front());
+    return backend && backend->reorder_children(submenu, handles);
+}
+
+void TrayService::post_event(int64_t plugin_id, FlValue* event) {
+    const auto it = plugins.find(plugin_id);
+    if (it != plugins.end()) {
+        it->second->post_event(event);
+    }
+}
+
+void TrayService::post_to_users(const Tray& tray, FlValue* event) {
+    for (const auto user : tray.users) {
+        post_event(user, event);
+    }
+}
+
+void TrayService::set_stall_threshold(gint64 threshold_us) {
+    stall_threshold_us = std::max<gint64>(0, threshold_us);
+    g_clear_handle_id(&heartbeat_source_id, g_source_remove);
+    if (stall_threshold_us) {
+        schedule_heartbeat();
+    }
+}
+
+// The heartbeat is due every half threshold. Finding it late by more than the threshold means the main loop was blocked
+// for at least that long, by the plugin or by anything else running on it, such as the engine or other plugins.
+void TrayService::schedule_heartbeat() {
+    const auto interval_ms = std::max<gint64>(1, stall_threshold_us / 2000);
+    heartbeat_due_at       = g_get_monotonic_time() + interval_ms * 1000;
+    heartbeat_source_id    = g_timeout_add(
+            interval_ms,
+            [](gpointer) {
+                auto& service               = TrayService::get();
+                service.heartbeat_source_id = 0;
+                const auto late_us          = g_get_monotonic_time() - service.heartbeat_due_at;
+                if (late_us > service.stall_threshold_us) {
+                    g_message("tray_menu: the main loop stalled for %" G_GINT64_FORMAT " us", late_us);
+                    g_autoptr(FlValue) event = new_event("stall", -1);
+                    fl_value_set_string_take(event, "duration", fl_value_new_int(late_us));
+                    for (const auto& plugin : service.plugins) {
+                        plugin.second->post_event(event);
+                    }
+                }
+                service.schedule_heartbeat();
+                return G_SOURCE_REMOVE;
+            },
+            nullptr);
+}
+
+// Only called once an operation turned out slow, so walking the menu and encoding the arguments again adds nothing to
+// the stall it reports. The items of every engine are counted, and the depth is that of the most deeply nested one.
+FlValue* TrayService::new_slow_event(const gchar* operation, int64_t tray_index, FlValue* args, gint64 duration_us) {
+    int64_t items   = 0, depth = 0;
+    const auto tray = trays.find(tray_index);
+    if (tray != trays.end()) {
+        std::unordered_map<int64_t, int64_t> depths;
+        tray->second->backend->walk([&](int64_t handle, int64_t parent, int64_t, const ItemSpec&) {
+            const auto parent_depth = depths.find(parent);
+            const auto item_depth   = parent_depth != depths.end() ? parent_depth->second + 1 : 1;
+            depths[handle]          = item_depth;
+            depth                   = std::max(depth, item_depth);
+            ++items;
+        });
+    }
+    gsize args_bytes = 0;
+    if (args) {
+        g_autoptr(FlStandardMessageCodec) codec = fl_standard_message_codec_new();
+        g_autoptr(GBytes) encoded = fl_message_codec_encode_message(FL_MESSAGE_CODEC(codec), args, nullptr);
+        args_bytes                = encoded ? g_bytes_get_size(encoded) : 0;
+    }
+    g_message("tray_menu: %s took %" G_GINT64_FORMAT " us (%" G_GSIZE_FORMAT " bytes of arguments, %" G_GINT64_FORMAT
+              " items, %" G_GINT64_FORMAT " levels deep)",
+              operation,
+              duration_us,
+              args_bytes,
+              items,
+              depth);
+
+    const auto event = new_event("slowOperation", tray_index);
+    fl_value_set_string_take(event, "operation", fl_value_new_string(operation));
+    fl_value_set_string_take(event, "duration", fl_value_new_int(duration_us));
+    fl_value_set_string_take(event, "argsBytes", fl_value_new_int(args_bytes));
+    fl_value_set_string_take(event, "items", fl_value_new_int(items));
+    fl_value_set_string_take(event, "depth", fl_value_new_int(depth));
+    return event;
+}
+
+// Restores the snapshot of every tray saved by the previous run of the application, once per process. Snapshots that
+// can't be read are ignored; the next commit replaces them.
+void TrayService::restore_snapshots() {
+    if (snapshots_restored) {
+        return;
+    }
+    snapshots_restored   = true;
+    const auto directory = menu_snapshot::directory();
+    g_autoptr(GDir) dir  = g_dir_open(directory.c_str(), 0, nullptr);
+    if (!dir) {
+        return;
+    }
+    while (const auto name = g_dir_read_name(dir)) {
+        if (!g_str_has_suffix(name, menu_snapshot::suffix)) {
+            continue;
+        }
+        g_autofree gchar* path = g_build_filename(directory.c_str(), name, nullptr);
+        menu_snapshot::Snapshot snapshot;
+        if (!menu_snapshot::read(path, snapshot) || menu_snapshot::path_for(snapshot.tray) != path) {
+            g_warning("tray_menu: ignoring the invalid menu snapshot %s", path);
+            continue;
+        }
+        if (!trays.count(snapshot.tray)) {
+            restore(snapshot);
+        }
+    }
+}
+
+// The restored items belong to restored_owner until an engine claims them.
+void TrayService::restore(const menu_snapshot::Snapshot& snapshot) {
+    auto& tray    = ensure_tray(snapshot.tray, snapshot.id.c_str());
+    tray.restored = true;
+    tray.icon     = snapshot.icon;
+
+    std::vector<int64_t> handles;
+    handles.reserve(snapshot.items.size());
+    for (const auto& item : snapshot.items) {
+        ItemSpec spec;
+        spec.type         = item.type;
+        spec.key          = item.key;
+        spec.label        = item.label;
+        spec.enabled      = item.enabled;
+        spec.checked      = item.checked;
+        spec.group        = item.group;
+        const auto handle = allocate_handle(snapshot.tray);
+        if (!tray.backend->add_item(handle, restored_owner, spec, item.parent >= 0 ? handles[item.parent] : -1, -1)) {
+            tray.backend->clear();
+            return;
+        }
+        handles.push_back(handle);
+    }
+    const auto bytes    = menu_snapshot::encode(snapshot);
+    tray.saved_checksum = menu_snapshot::crc32(bytes.data(), bytes.size());
+    if (!tray.icon.empty()) {
+        tray.backend->show(tray.icon.c_str());
+    }
+}
+
+// Saves the whole menu of the tray, whoever added the items. Labels are saved with their current text, whether or not
+// they are bound to the string table, which Dart sets again at startup anyway.
+bool TrayService::save_snapshot(int64_t tray_index) {
+    auto& tray = ensure_tray(tray_index);
+    menu_snapshot::Snapshot snapshot;
+    snapshot.tray = tray.index;
+    snapshot.id   = tray.id;
+    snapshot.icon = tray.icon;
+    std::unordered_map<int64_t, int32_t> indices;
+    tray.backend->walk([&](int64_t handle, int64_t parent, int64_t, const ItemSpec& item) {
+        const auto parent_index = indices.find(parent);
+        menu_snapshot::Item entry;
+        entry.parent  = parent_index != indices.end() ? parent_index->second : -1;
+        entry.type    = item.type;
+        entry.enabled = item.enabled;
+        entry.checked = item.checked;
+        entry.group   = item.group;
+        entry.key     = item.key;
+        entry.label   = item.label;
+        indices.insert({handle, static_cast<int32_t>(snapshot.items.size())});
+        snapshot.items.push_back(std::move(entry));
+    });
+
+    const auto bytes    = menu_snapshot::encode(snapshot);
+    const auto checksum = menu_snapshot::crc32(bytes.data(), bytes.size());
+    if (checksum == tray.saved_checksum) {
+        return true;
+    }
+    if (!menu_snapshot::write(menu_snapshot::path_for(tray_index), bytes)) {
+        return false;
+    }
+    tray.saved_checksum = checksum;
+    return true;
+}
+
+void TrayService::discard_snapshot(int64_t tray_index) {
+    ensure_tray(tray_index).saved_checksum = 0;
+    g_remove(menu_snapshot::path_for(tray_index).c_str());
+}
+
+void TrayMenuPlugin::post_event(FlValue* event) {
+    if (!listening) {
+        return;
+    }
+    if (!pending_events) {
+        pending_events = fl_value_new_list();
+    }
+    fl_value_append(pending_events, event);
+    if (!flush_source_id) {
+        flush_source_id = g_idle_add(
+                [](gpointer plugin) {
+                    TRAY_MENU_PLUGIN(plugin)->flush_events();
+                    return G_SOURCE_REMOVE;
+                },
+                this);
+    }
+}
+
+// The batch carries the number of its first event and the monotonic time it was sent at, so Dart can tell how long
+// each event took to arrive.
+void TrayMenuPlugin::flush_events() {
+    flush_source_id           = 0;
+    g_autoptr(FlValue) events = pending_events;
+    pending_events            = nullptr;
+    if (!events || !event_channel) {
+        return;
+    }
+    g_autoptr(FlValue) batch = fl_value_new_map();
+    fl_value_set_string_take(batch, "sequence", fl_value_new_int(next_sequence));
+    fl_value_set_string_take(batch, "sent", fl_value_new_int(g_get_monotonic_time()));
+    fl_value_set_string(batch, "events", events);
+    next_sequence += fl_value_get_length(events);
+    fl_event_channel_send(event_channel, batch, nullptr, nullptr);
+}
+
+// The default tray is addressed without arguments (init) or with a bare icon path (showTrayIcon); any other tray is
+// addressed with a map carrying its index.
+static int64_t get_tray_index(FlValue* args) {
+    const auto tray_value = args && fl_value_get_type(args) == FL_VALUE_TYPE_MAP ? fl_value_lookup_string(args, "tray")
+                                                                                 : nullptr;
+    return tray_value ? fl_value_get_int(tray_value) : 0;
+}
+
+// Returns the engine's id, which the FFI fast path passes back so that activations are routed to the right engine, and
+// the index of the tray, which is assigned here for trays created by id so that every engine agrees on it.
+FlMethodResponse* TrayMenuPlugin::init(FlValue* args) {
+    const bool is_map         = args && fl_value_get_type(args) == FL_VALUE_TYPE_MAP;
+    const auto id_value       = is_map ? fl_value_lookup_string(args, "id") : nullptr;
+    const auto reattach_value = is_map ? fl_value_lookup_string(args, "reattach") : nullptr;
+    const gchar* tray_id      = id_value && fl_value_get_type(id_value) == FL_VALUE_TYPE_STRING
+                                        ? fl_value_get_string(id_value)
+                                        : nullptr;
+    auto& service             = TrayService::get();
+    const auto tray_index     = tray_id ? service.tray_index_for(tray_id) : get_tray_index(args);
+    service.init_tray(id, tray_index, tray_id, reattach_value && fl_value_get_bool(reattach_value));
+    g_autoptr(FlValue) result = fl_value_new_map();
+    fl_value_set_string_take(result, "engine", fl_value_new_int(id));
+    fl_value_set_string_take(result, "tray", fl_value_new_int(tray_index));
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* TrayMenuPlugin::show_tray_icon(FlValue* args) {
+    const auto icon = fl_value_get_type(args) == FL_VALUE_TYPE_MAP ? fl_value_lookup_string(args, "icon") : args;
+    auto& tray      = TrayService::get().ensure_tray(get_tray_index(args));
+    tray.icon       = fl_value_get_string(icon);
+    tray.backend->show(tray.icon.c_str());
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Returns before the label is shown, which happens once the rate limit of the tray allows.
+FlMethodResponse* TrayMenuPlugin::set_tray_label(FlValue* args) {
+    const gchar* label = fl_value_get_string(fl_value_lookup_string(args, "label"));
+    const auto guide   = fl_value_lookup_string(args, "guide");
+    auto& tray         = TrayService::get().ensure_tray(get_tray_index(args));
+    tray.set_label(label, guide && fl_value_get_type(guide) == FL_VALUE_TYPE_STRING ? fl_value_get_string(guide) : "");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* TrayMenuPlugin::set_tray_title(FlValue* args) {
+    const gchar* title = fl_value_get_string(fl_value_lookup_string(args, "title"));
+    TrayService::get().ensure_tray(get_tray_index(args)).set_title(title);
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* TrayMenuPlugin::set_tray_text_rate(FlValue* args) {
+    const double hz = fl_value_get_float(fl_value_lookup_string(args, "hz"));
+    TrayService::get().ensure_tray(get_tray_index(args)).set_text_rate(hz);
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Reads an item described by the map produced by the Dart _MenuItem.toMap. Labels bound to the string table come as the
+// id of their string instead of their text.
+static ItemSpec get_item_spec(FlValue* args) {
+    static const std::unordered_map<std::string, MenuItemType> menu_item_types = {
+            {"_MenuItemLabel", MenuItemType::label},
+            {"_MenuItemSeparator", MenuItemType::separator},
+            {"_MenuItemCheckbox", MenuItemType::checkbox},
+            {"_MenuItemSubmenu", MenuItemType::submenu},
+            {"_MenuItemRadio", MenuItemType::radio},
+    };
+
+    ItemSpec spec;
+    spec.type = menu_item_types.at(fl_value_get_string(fl_value_lookup_string(args, "type")));
+
+    const auto label_value   = fl_value_lookup_string(args, "label");
+    const auto enabled_value = fl_value_lookup_string(args, "enabled");
+    const auto checked_value = fl_value_lookup_string(args, "checked");
+    const auto group_value   = fl_value_lookup_string(args, "group");
+    const auto string_value  = fl_value_lookup_string(args, "string");
+    const auto key_value     = fl_value_lookup_string(args, "key");
+    const auto icon_value    = fl_value_lookup_string(args, "icon");
+    if (label_value) {
+        spec.label = fl_value_get_string(label_value);
+    }
+    spec.enabled   = enabled_value ? fl_value_get_bool(enabled_value) : true;
+    spec.checked   = checked_value ? fl_value_get_bool(checked_value) : false;
+    spec.group     = group_value ? fl_value_get_int(group_value) : -1;
+    spec.string_id = string_value ? fl_value_get_int(string_value) : -1;
+    if (key_value) {
+        spec.key = fl_value_get_string(key_value);
+    }
+    if (icon_value && fl_value_get_type(icon_value) == FL_VALUE_TYPE_STRING) {
+        spec.icon = fl_value_get_string(icon_value);
+    }
+    return spec;
+}
+
 FlMethodResponse* TrayMenuPlugin::add_menu_item(FlValue* args) {
-    static int64_t next_handle = 0;
+    auto spec = get_item_spec(args);
 
-    static const std::unordered_map<std::string, std::unique_ptr<Gtk::MenuItem> (*)(FlValue*)> menu_item_constructors =
-            {
-                    {"_MenuItemLabel", create_label_menu_item},
-                    {"_MenuItemSeparator", create_separator_menu_item},
-                    {"_MenuItemCheckbox", create_checkbox_menu_item},
-                    {"_MenuItemSubmenu", create_submenu_menu_item},
-            };
+    const auto submenu_value = fl_value_lookup_string(args, "submenu");
+    const auto submenu       = submenu_value ? fl_value_get_int(submenu_value) : -1;
+    const auto tray_index    = submenu >= 0 ? submenu >> tray_handle_shift : get_tray_index(args);
+    const auto before_value  = fl_value_lookup_string(args, "before");
+    const auto before        = before_value ? fl_value_get_int(before_value) : -1;
 
-    const gchar* type                = fl_value_get_string(fl_value_lookup_string(args, "type"));
-    const auto menu_item_constructor = menu_item_constructors.at(type);
+    const auto handle = allocate_handle(tray_index);
+    if (!TrayService::get().add_item(id, handle, std::move(spec), tray_index, submenu, before)) {
+        return FL_METHOD_RESPONSE(fl_method_error_response_new("Invalid handle", nullptr, nullptr));
+    }
 
-    auto parent_menu         = &menu;
-    const auto submenu_value = fl_value_lookup_string(args, "submenu");
-    if (submenu_value) {
-        const int64_t submenu_handle = fl_value_get_int(submenu_value);
-        auto submenu_item            = menu.get_item(submenu_handle);
-        if (!submenu_item || !submenu_item->has_submenu()) {
-            return FL_METHOD_RESPONSE(fl_method_error_response_new("Invalid handle", nullptr, nullptr));
-        }
-        parent_menu = dynamic_cast<IndexedMenu*>(submenu_item->get_submenu());
+    g_autoptr(FlValue) result = fl_value_new_int(handle);
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* TrayMenuPlugin::clear_children(FlValue* args) {
+    const auto submenu_value = args ? fl_value_lookup_string(args, "submenu") : nullptr;
+    const auto submenu       = submenu_value ? fl_value_get_int(submenu_value) : -1;
+    if (!TrayService::get().clear_children(get_tray_index(args), submenu)) {
+        return FL_METHOD_RESPONSE(fl_method_error_response_new("Invalid handle", nullptr, nullptr));
     }
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
 
-    const auto before_value = fl_value_lookup_string(args, "before");
-    const auto before       = before_value ? fl_value_get_int(before_value) : -1;
+// Returns the new items' handles as an Int64List, in the order the items were given.
+FlMethodResponse* TrayMenuPlugin::replace_children(FlValue* args) {
+    const auto submenu_value = fl_value_lookup_string(args, "submenu");
+    const auto submenu       = submenu_value ? fl_value_get_int(submenu_value) : -1;
+    const auto tray_index    = submenu >= 0 ? submenu >> tray_handle_shift : get_tray_index(args);
+    const auto items         = fl_value_lookup_string(args, "items");
 
-    const auto handle = next_handle++;
-    auto item         = menu_item_constructor(args);
-    item->signal_activate().connect([=] {
-        fl_method_channel_invoke_method(channel, "itemCallback", fl_value_new_int(handle), nullptr, nullptr, nullptr);
-    });
-    parent_menu->add_item(handle, std::move(item), before);
+    std::vector<ItemSpec> specs;
+    specs.reserve(fl_value_get_length(items));
+    for (size_t i = 0; i < fl_value_get_length(items); ++i) {
+        specs.push_back(get_item_spec(fl_value_get_list_value(items, i)));
+    }
+    std::vector<int64_t> handles;
+    if (!TrayService::get().replace_children(id, tray_index, submenu, std::move(specs), handles)) {
+        return FL_METHOD_RESPONSE(fl_method_error_response_new("Invalid handle", nullptr, nullptr));
+    }
 
-    g_autoptr(FlValue) result = fl_value_new_int(handle);
+    g_autoptr(FlValue) result = fl_value_new_int64_list(handles.data(), handles.size());
     return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
 }
 
 FlMethodResponse* TrayMenuPlugin::remove_menu_item(FlValue* args) {
     const int64_t handle = fl_value_get_int(args);
-    menu.remove_item(handle);
+    if (auto backend = TrayService::get().backend_for_handle(handle)) {
+        backend->remove_item(handle);
+    }
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* TrayMenuPlugin::move_menu_item(FlValue* args) {
+    const int64_t handle     = fl_value_get_int(fl_value_lookup_string(args, "handle"));
+    const auto submenu_value = fl_value_lookup_string(args, "submenu");
+    const auto submenu       = submenu_value ? fl_value_get_int(submenu_value) : -1;
+    const auto before_value  = fl_value_lookup_string(args, "before");
+    const auto before        = before_value ? fl_value_get_int(before_value) : -1;
+    if (!TrayService::get().move_item(handle, get_tray_index(args), submenu, before)) {
+        return FL_METHOD_RESPONSE(fl_method_error_response_new("Invalid handle", nullptr, nullptr));
+    }
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Handles are sent as an Int64List, but plain lists of ints are accepted as well.
+static std::vector<int64_t> get_handles(FlValue* value) {
+    if (fl_value_get_type(value) == FL_VALUE_TYPE_INT64_LIST) {
+        const auto handles = fl_value_get_int64_list(value);
+        return {handles, handles + fl_value_get_length(value)};
+    }
+    std::vector<int64_t> handles;
+    for (size_t i = 0; i < fl_value_get_length(value); ++i) {
+        handles.push_back(fl_value_get_int(fl_value_get_list_value(value, i)));
+    }
+    return handles;
+}
+
+FlMethodResponse* TrayMenuPlugin::reorder_children(FlValue* args) {
+    const auto submenu_value = fl_value_lookup_string(args, "submenu");
+    const auto submenu       = submenu_value ? fl_value_get_int(submenu_value) : -1;
+    const auto handles       = get_handles(fl_value_lookup_string(args, "handles"));
+    if (!TrayService::get().reorder_children(submenu, handles)) {
+        return FL_METHOD_RESPONSE(fl_method_error_response_new("Invalid handle", nullptr, nullptr));
+    }
     return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
 }
 
 FlMethodResponse* TrayMenuPlugin::get_menu_item_label(FlValue* args) {
     const int64_t handle = fl_value_get_int(args);
-    auto item            = menu.get_item(handle);
-    if (!item) {
+    auto backend         = TrayService::get().backend_for_handle(handle);
+    std::string label;
+    if (!backend || !backend->get_label(handle, label)) {
         return FL_METHOD_RESPONSE(fl_method_error_response_new("Invalid handle", nullptr, nullptr));
     }
-    const auto label          = item->get_label();
-    g_autoptr(FlValue) result = fl_value_new_string(label.data());
+    g_autoptr(FlValue) result = fl_value_new_string(label.c_str());
     return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
 }
 
 FlMethodResponse* TrayMenuPlugin::set_menu_item_label(FlValue* args) {
     const int64_t handle = fl_value_get_int(fl_value_lookup_string(args, "handle"));
     const gchar* label   = fl_value_get_string(fl_value_lookup_string(args, "label"));
-    auto item            = menu.get_item(handle);
-    if (!item) {
+    auto backend         = TrayService::get().backend_for_handle(handle);
+    if (!backend || !backend->set_label(handle, label)) {
         return FL_METHOD_RESPONSE(fl_method_error_response_new("Invalid handle", nullptr, nullptr));
     }
-    item->set_label(label);
     return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
 }
 
 FlMethodResponse* TrayMenuPlugin::get_menu_item_enabled(FlValue* args) {
     const int64_t handle = fl_value_get_int(args);
-    auto item            = menu.get_item(handle);
-    if (!item) {
+    auto backend         = TrayService::get().backend_for_handle(handle);
+    bool enabled;
+    if (!backend || !backend->get_enabled(handle, enabled)) {
         return FL_METHOD_RESPONSE(fl_method_error_response_new("Invalid handle", nullptr, nullptr));
     }
-    const auto enabled        = item->get_sensitive();
     g_autoptr(FlValue) result = fl_value_new_bool(enabled);
     return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
 }
@@ -230,21 +2133,35 @@ FlMethodResponse* TrayMenuPlugin::get_menu_item_enabled(FlValue* args) {
 FlMethodResponse* TrayMenuPlugin::set_menu_item_enabled(FlValue* args) {
     const int64_t handle = fl_value_get_int(fl_value_lookup_string(args, "handle"));
     const bool enabled   = fl_value_get_bool(fl_value_lookup_string(args, "enabled"));
-    auto item            = menu.get_item(handle);
-    if (!item) {
+    auto backend         = TrayService::get().backend_for_handle(handle);
+    if (!backend || !backend->set_enabled(handle, enabled)) {
+        return FL_METHOD_RESPONSE(fl_method_error_response_new("Invalid handle", nullptr, nullptr));
+    }
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// An icon of null, or one that isn't registered, removes the item's icon.
+FlMethodResponse* TrayMenuPlugin::set_menu_item_icon(FlValue* args) {
+    const int64_t handle = fl_value_get_int(fl_value_lookup_string(args, "handle"));
+    const auto icon      = fl_value_lookup_string(args, "icon");
+    auto& service        = TrayService::get();
+    const auto image     = icon && fl_value_get_type(icon) == FL_VALUE_TYPE_STRING
+                                   ? service.icons.get(fl_value_get_string(icon))
+                                   : nullptr;
+    auto backend = service.backend_for_handle(handle);
+    if (!backend || !backend->set_icon(handle, image)) {
         return FL_METHOD_RESPONSE(fl_method_error_response_new("Invalid handle", nullptr, nullptr));
     }
-    item->set_sensitive(enabled);
     return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
 }
 
 FlMethodResponse* TrayMenuPlugin::get_menu_item_checked(FlValue* args) {
     const int64_t handle = fl_value_get_int(args);
-    auto item            = menu.get_item<Gtk::CheckMenuItem>(handle);
-    if (!item) {
+    auto backend         = TrayService::get().backend_for_handle(handle);
+    bool checked;
+    if (!backend || !backend->get_checked(handle, checked)) {
         return FL_METHOD_RESPONSE(fl_method_error_response_new("Invalid handle", nullptr, nullptr));
     }
-    const auto checked        = item->get_active();
     g_autoptr(FlValue) result = fl_value_new_bool(checked);
     return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
 }
@@ -252,57 +2169,410 @@ FlMethodResponse* TrayMenuPlugin::get_menu_item_checked(FlValue* args) {
 FlMethodResponse* TrayMenuPlugin::set_menu_item_checked(FlValue* args) {
     const int64_t handle = fl_value_get_int(fl_value_lookup_string(args, "handle"));
     const bool checked   = fl_value_get_bool(fl_value_lookup_string(args, "checked"));
-    auto item            = menu.get_item<Gtk::CheckMenuItem>(handle);
-    if (!item) {
+    auto backend         = TrayService::get().backend_for_handle(handle);
+    if (!backend || !backend->set_checked(handle, checked)) {
         return FL_METHOD_RESPONSE(fl_method_error_response_new("Invalid handle", nullptr, nullptr));
     }
-    item->set_active(checked);
     return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
 }
 
-static void tray_menu_plugin_handle_method_call(TrayMenuPlugin* self, FlMethodCall* method_call) {
+FlMethodResponse* TrayMenuPlugin::select_radio(FlValue* args) {
+    const int64_t handle = fl_value_get_int(fl_value_lookup_string(args, "handle"));
+    const int64_t group  = fl_value_get_int(fl_value_lookup_string(args, "group"));
+    auto backend         = TrayService::get().backend_for_handle(handle);
+    if (!backend || !backend->select_radio(group, handle)) {
+        return FL_METHOD_RESPONSE(fl_method_error_response_new("Invalid handle", nullptr, nullptr));
+    }
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Takes a map from string ids to their text, which replaces the text of those entries of the string table.
+FlMethodResponse* TrayMenuPlugin::set_strings(FlValue* args) {
+    std::vector<std::pair<int64_t, std::string>> entries;
+    entries.reserve(fl_value_get_length(args));
+    for (size_t i = 0; i < fl_value_get_length(args); ++i) {
+        entries.emplace_back(fl_value_get_int(fl_value_get_map_key(args, i)),
+                             fl_value_get_string(fl_value_get_map_value(args, i)));
+    }
+    TrayService::get().set_strings(entries);
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Takes a map from string ids to label templates (see label_template.h), which the text of those entries of the string
+// table is rendered from from then on.
+FlMethodResponse* TrayMenuPlugin::set_label_templates(FlValue* args) {
+    std::vector<std::pair<int64_t, std::string>> entries;
+    entries.reserve(fl_value_get_length(args));
+    for (size_t i = 0; i < fl_value_get_length(args); ++i) {
+        entries.emplace_back(fl_value_get_int(fl_value_get_map_key(args, i)),
+                             fl_value_get_string(fl_value_get_map_value(args, i)));
+    }
+    TrayService::get().set_templates(entries);
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* TrayMenuPlugin::set_counter(FlValue* args) {
+    const gchar* name   = fl_value_get_string(fl_value_lookup_string(args, "counter"));
+    const int64_t value = fl_value_get_int(fl_value_lookup_string(args, "value"));
+    TrayService::get().set_counter(name, value, false);
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* TrayMenuPlugin::add_to_counter(FlValue* args) {
+    const gchar* name   = fl_value_get_string(fl_value_lookup_string(args, "counter"));
+    const int64_t delta = fl_value_get_int(fl_value_lookup_string(args, "delta"));
+    TrayService::get().set_counter(name, delta, true);
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Restarts the clock, as if it had been started the given number of milliseconds ago.
+FlMethodResponse* TrayMenuPlugin::start_clock(FlValue* args) {
+    const gchar* name       = fl_value_get_string(fl_value_lookup_string(args, "clock"));
+    const auto elapsed      = fl_value_lookup_string(args, "elapsed");
+    const gint64 elapsed_ms = elapsed ? fl_value_get_int(elapsed) : 0;
+    TrayService::get().start_clock(name, elapsed_ms * 1000);
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Takes the id of the icon and either its encoded bytes, in any format gdk-pixbuf reads, or the path of a file holding
+// them. Nothing is decoded until an item shows the icon.
+FlMethodResponse* TrayMenuPlugin::register_icon(FlValue* args) {
+    const std::string icon = fl_value_get_string(fl_value_lookup_string(args, "icon"));
+    const auto bytes       = fl_value_lookup_string(args, "bytes");
+    const auto path        = fl_value_lookup_string(args, "path");
+    auto& icons            = TrayService::get().icons;
+    if (bytes && fl_value_get_type(bytes) == FL_VALUE_TYPE_UINT8_LIST) {
+        icons.set_bytes(icon, fl_value_get_uint8_list(bytes), fl_value_get_length(bytes));
+    } else if (path && fl_value_get_type(path) == FL_VALUE_TYPE_STRING) {
+        icons.set_file(icon, fl_value_get_string(path));
+    } else {
+        icons.remove(icon);
+    }
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* TrayMenuPlugin::set_icon_cache_capacity(FlValue* args) {
+    TrayService::get().icons.set_capacity(std::max<int64_t>(0, fl_value_get_int(args)));
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Takes the threshold in microseconds, shared by every engine; 0 turns the watchdog off.
+FlMethodResponse* TrayMenuPlugin::set_stall_threshold(FlValue* args) {
+    TrayService::get().set_stall_threshold(fl_value_get_int(args));
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Hands the items restored from a snapshot over to the calling engine, then lists every item it owns in the tray with
+// its parent, key and state, parents before their children and children in menu order, along with the status of the
+// icon if it was shown.
+FlMethodResponse* TrayMenuPlugin::get_manifest(FlValue* args) {
+    auto& tray = TrayService::get().ensure_tray(get_tray_index(args));
+    if (tray.restored) {
+        tray.backend->reassign(restored_owner, id);
+        tray.restored = false;
+    }
+    std::set<int64_t> listed;
+    const auto items = fl_value_new_list();
+    tray.backend->walk([&](int64_t handle, int64_t parent, int64_t owner, const ItemSpec& item) {
+        if (owner != id || (parent >= 0 && !listed.count(parent))) {
+            return;
+        }
+        listed.insert(handle);
+        auto entry = fl_value_new_map();
+        fl_value_set_string_take(entry, "handle", fl_value_new_int(handle));
+        if (parent >= 0) {
+            fl_value_set_string_take(entry, "parent", fl_value_new_int(parent));
+        }
+        fl_value_set_string_take(entry, "key", fl_value_new_string(item.key.c_str()));
+        fl_value_set_string_take(
+                entry, "type", fl_value_new_string(menu_item_type_names[static_cast<gint32>(item.type)]));
+        fl_value_set_string_take(entry, "label", fl_value_new_string(item.label.c_str()));
+        fl_value_set_string_take(entry, "enabled", fl_value_new_bool(item.enabled));
+        fl_value_set_string_take(entry, "checked", fl_value_new_bool(item.checked));
+        fl_value_set_string_take(entry, "group", fl_value_new_int(item.group));
+        if (!item.icon.empty()) {
+            fl_value_set_string_take(entry, "icon", fl_value_new_string(item.icon.c_str()));
+        }
+        fl_value_append_take(items, entry);
+    });
+    g_autoptr(FlValue) result = fl_value_new_map();
+    fl_value_set_string_take(result, "items", items);
+    if (tray.status) {
+        fl_value_set_string_take(result, "status", fl_value_new_string(tray.status));
+    }
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* TrayMenuPlugin::update_menu_item(FlValue* args) {
+    const int64_t handle = fl_value_get_int(fl_value_lookup_string(args, "handle"));
+    auto spec            = get_item_spec(args);
+    auto& service        = TrayService::get();
+    service.resolve(spec);
+    auto backend = service.backend_for_handle(handle);
+    if (!backend || !backend->update_item(handle, spec)) {
+        return FL_METHOD_RESPONSE(fl_method_error_response_new("Invalid handle", nullptr, nullptr));
+    }
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Called by Dart once it has built its menu, to have it shown from the snapshot at the next launch.
+FlMethodResponse* TrayMenuPlugin::commit_menu(FlValue* args) {
+    if (!TrayService::get().save_snapshot(get_tray_index(args))) {
+        return FL_METHOD_RESPONSE(fl_method_error_response_new("Snapshot not saved", nullptr, nullptr));
+    }
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+FlMethodResponse* TrayMenuPlugin::discard_snapshot(FlValue* args) {
+    TrayService::get().discard_snapshot(get_tray_index(args));
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// The items of each type in part of a menu and the memory they take up.
+struct MemoryUsage {
+    size_t counts[G_N_ELEMENTS(menu_item_type_names)] = {};
+    TrayBackend::Footprint footprint{};
+
+    void add(const TrayBackend::Footprint& other) {
+        footprint.model_bytes += other.model_bytes;
+        footprint.string_bytes += other.string_bytes;
+        footprint.object_bytes += other.object_bytes;
+        footprint.signal_handlers += other.signal_handlers;
+    }
+
+    void add(const MemoryUsage& other) {
+        for (size_t i = 0; i < G_N_ELEMENTS(counts); ++i) {
+            counts[i] += other.counts[i];
+        }
+        add(other.footprint);
+    }
+
+    FlValue* to_value() const {
+        auto items = fl_value_new_map();
+        for (size_t i = 0; i < G_N_ELEMENTS(counts); ++i) {
+            fl_value_set_string_take(items, menu_item_type_names[i], fl_value_new_int(counts[i]));
+        }
+        auto value = fl_value_new_map();
+        fl_value_set_string_take(value, "items", items);
+        fl_value_set_string_take(value, "modelBytes", fl_value_new_int(footprint.model_bytes));
+        fl_value_set_string_take(value, "stringBytes", fl_value_new_int(footprint.string_bytes));
+        fl_value_set_string_take(value, "objectBytes", fl_value_new_int(footprint.object_bytes));
+        fl_value_set_string_take(value, "signalHandlers", fl_value_new_int(footprint.signal_handlers));
+        return value;
+    }
+};
+
+// Reports the native memory taken up by the tray: every item's own, every submenu's along with everything nested in
+// it, and the total, which includes what the tray takes up apart from its items. Items of every engine are counted.
+// The string table and the GObjects alive across all trays are reported as well. Visits every item, so it is meant
+// for diagnostics rather than frequent polling.
+FlMethodResponse* TrayMenuPlugin::get_memory_report(FlValue* args) {
+    auto& service = TrayService::get();
+    auto& tray    = service.ensure_tray(get_tray_index(args));
+
+    struct Item {
+        int64_t handle;
+        int64_t parent;
+        MenuItemType type;
+        MemoryUsage usage;
+    };
+    std::vector<Item> items;
+    MemoryUsage total;
+    total.footprint = tray.backend->measure(
+            [&](int64_t handle, int64_t parent, MenuItemType type, const TrayBackend::Footprint& footprint) {
+                MemoryUsage usage;
+                usage.counts[static_cast<gint32>(type)] = 1;
+                usage.footprint                         = footprint;
+                items.push_back({handle, parent, type, usage});
+            });
+
+    // Children are visited after their parents, so going backwards every subtree is complete by the time it is added
+    // to its parent's.
+    std::unordered_map<int64_t, MemoryUsage> subtrees;
+    for (auto it = items.rbegin(); it != items.rend(); ++it) {
+        auto& subtree = subtrees[it->handle];
+        subtree.add(it->usage);
+        if (it->parent >= 0) {
+            subtrees[it->parent].add(subtree);
+        } else {
+            total.add(subtree);
+        }
+    }
+
+    const auto entries = fl_value_new_list();
+    for (const auto& item : items) {
+        auto entry = fl_value_new_map();
+        fl_value_set_string_take(entry, "handle", fl_value_new_int(item.handle));
+        fl_value_set_string_take(entry, "own", item.usage.to_value());
+        if (item.type == MenuItemType::submenu) {
+            fl_value_set_string_take(entry, "subtree", subtrees.at(item.handle).to_value());
+        }
+        fl_value_append_take(entries, entry);
+    }
+    size_t string_table_bytes = service.strings.bucket_count() * sizeof(void*);
+    for (const auto& it : service.strings) {
+        string_table_bytes += sizeof(it) + sizeof(std::string) + it.second->size() + 4 * sizeof(void*);
+    }
+
+    g_autoptr(FlValue) result = fl_value_new_map();
+    fl_value_set_string_take(result, "total", total.to_value());
+    fl_value_set_string_take(result, "items", entries);
+    fl_value_set_string_take(result, "stringTableBytes", fl_value_new_int(string_table_bytes));
+    fl_value_set_string_take(result, "liveObjects", fl_value_new_int(live_objects));
+    fl_value_set_string_take(result, "liveObjectBytes", fl_value_new_int(live_object_bytes));
+    fl_value_set_string_take(result, "iconBytes", fl_value_new_int(service.icons.memory_bytes()));
+    fl_value_set_string_take(result, "iconDecodes", fl_value_new_int(service.icons.decodes()));
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* tray_menu_plugin_dispatch(TrayMenuPlugin* self, const gchar* method, FlValue* args) {
     static const std::unordered_map<std::string, FlMethodResponse* (TrayMenuPlugin::*) (FlValue*)> handlers = {
             {"init", &TrayMenuPlugin::init},
             {"showTrayIcon", &TrayMenuPlugin::show_tray_icon},
+            {"setTrayLabel", &TrayMenuPlugin::set_tray_label},
+            {"setTrayTitle", &TrayMenuPlugin::set_tray_title},
+            {"setTrayTextRate", &TrayMenuPlugin::set_tray_text_rate},
             {"addMenuItem", &TrayMenuPlugin::add_menu_item},
             {"removeMenuItem", &TrayMenuPlugin::remove_menu_item},
+            {"clearChildren", &TrayMenuPlugin::clear_children},
+            {"replaceChildren", &TrayMenuPlugin::replace_children},
+            {"moveMenuItem", &TrayMenuPlugin::move_menu_item},
+            {"reorderChildren", &TrayMenuPlugin::reorder_children},
             {"getMenuItemLabel", &TrayMenuPlugin::get_menu_item_label},
             {"setMenuItemLabel", &TrayMenuPlugin::set_menu_item_label},
             {"getMenuItemEnabled", &TrayMenuPlugin::get_menu_item_enabled},
             {"setMenuItemEnabled", &TrayMenuPlugin::set_menu_item_enabled},
+            {"setMenuItemIcon", &TrayMenuPlugin::set_menu_item_icon},
             {"getMenuItemChecked", &TrayMenuPlugin::get_menu_item_checked},
             {"setMenuItemChecked", &TrayMenuPlugin::set_menu_item_checked},
+            {"selectRadio", &TrayMenuPlugin::select_radio},
+            {"setStrings", &TrayMenuPlugin::set_strings},
+            {"setLabelTemplates", &TrayMenuPlugin::set_label_templates},
+            {"setCounter", &TrayMenuPlugin::set_counter},
+            {"addToCounter", &TrayMenuPlugin::add_to_counter},
+            {"startClock", &TrayMenuPlugin::start_clock},
+            {"registerIcon", &TrayMenuPlugin::register_icon},
+            {"setIconCacheCapacity", &TrayMenuPlugin::set_icon_cache_capacity},
+            {"setStallThreshold", &TrayMenuPlugin::set_stall_threshold},
+            {"getManifest", &TrayMenuPlugin::get_manifest},
+            {"updateMenuItem", &TrayMenuPlugin::update_menu_item},
+            {"commitMenu", &TrayMenuPlugin::commit_menu},
+            {"discardSnapshot", &TrayMenuPlugin::discard_snapshot},
+            {"getMemoryReport", &TrayMenuPlugin::get_memory_report},
     };
 
-    auto it = handlers.find(fl_method_call_get_name(method_call));
+    auto it = handlers.find(method);
+
+    return it != handlers.end() ? (self->*it->second)(args)
+                                : FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
+}
+
+// The tray a call acts on: the one the item or submenu it names belongs to, or else the one it addresses.
+static int64_t get_call_tray_index(FlValue* args) {
+    if (args && fl_value_get_type(args) == FL_VALUE_TYPE_INT) {
+        return fl_value_get_int(args) >> tray_handle_shift;
+    }
+    if (args && fl_value_get_type(args) == FL_VALUE_TYPE_MAP) {
+        for (const auto name : {"handle", "submenu"}) {
+            const auto value = fl_value_lookup_string(args, name);
+            if (value && fl_value_get_type(value) == FL_VALUE_TYPE_INT && fl_value_get_int(value) >= 0) {
+                return fl_value_get_int(value) >> tray_handle_shift;
+            }
+        }
+    }
+    return get_tray_index(args);
+}
+
+// Handles are allocated in the order calls are made, but calls made off the main thread through the C ABI are only
+// recorded once the main loop applies them, so the handles a call returned are recorded along with its arguments, for
+// the replay tool to map them to the ones it allocates.
+static FlValue* new_recorded_args(const gchar* method, FlValue* args, FlMethodResponse* response) {
+    const bool returns_handles = g_strcmp0(method, "addMenuItem") == 0 || g_strcmp0(method, "replaceChildren") == 0;
+    if (!returns_handles || !args || fl_value_get_type(args) != FL_VALUE_TYPE_MAP ||
+        !FL_IS_METHOD_SUCCESS_RESPONSE(response)) {
+        return args ? fl_value_ref(args) : nullptr;
+    }
+    const auto recorded = fl_value_new_map();
+    for (size_t i = 0; i < fl_value_get_length(args); ++i) {
+        fl_value_set(recorded, fl_value_get_map_key(args, i), fl_value_get_map_value(args, i));
+    }
+    fl_value_set_string(recorded,
+                        g_strcmp0(method, "addMenuItem") == 0 ? "handle" : "handles",
+                        fl_method_success_response_get_result(FL_METHOD_SUCCESS_RESPONSE(response)));
+    return recorded;
+}
+
+static void tray_menu_plugin_handle_method_call(TrayMenuPlugin* self, FlMethodCall* method_call) {
+    const auto method = fl_method_call_get_name(method_call);
+    const auto args   = fl_method_call_get_args(method_call);
+    auto& service     = TrayService::get();
+    auto& recorder    = service.recorder;
+
+    if (!recorder && !service.stall_threshold_us) {
+        g_autoptr(FlMethodResponse) response = tray_menu_plugin_dispatch(self, method, args);
+        fl_method_call_respond(method_call, response, nullptr);
+        return;
+    }
 
-    g_autoptr(FlMethodResponse) response = it != handlers.end()
-                                                   ? (self->*it->second)(fl_method_call_get_args(method_call))
-                                                   : FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
+    const auto timestamp_us              = g_get_monotonic_time();
+    const auto start                     = std::chrono::steady_clock::now();
+    g_autoptr(FlMethodResponse) response = tray_menu_plugin_dispatch(self, method, args);
+    const auto duration                  = std::chrono::steady_clock::now() - start;
+    if (recorder) {
+        g_autoptr(FlValue) recorded_args = new_recorded_args(method, args, response);
+        recorder->append(method,
+                         recorded_args,
+                         timestamp_us,
+                         std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+    }
+    const auto duration_us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    if (service.stall_threshold_us && duration_us > service.stall_threshold_us) {
+        g_autoptr(FlValue) event = service.new_slow_event(method, get_call_tray_index(args), args, duration_us);
+        self->post_event(event);
+    }
 
     fl_method_call_respond(method_call, response, nullptr);
 }
 
 static void tray_menu_plugin_dispose(GObject* object) {
     TrayMenuPlugin* self = TRAY_MENU_PLUGIN(object);
+    if (self->id) {
+        TrayService::get().detach(self->id);
+        self->id = 0;
+    }
+    g_clear_handle_id(&self->flush_source_id, g_source_remove);
+    g_clear_pointer(&self->pending_events, fl_value_unref);
     G_OBJECT_CLASS(tray_menu_plugin_parent_class)->dispose(object);
     g_clear_object(&self->channel);
+    g_clear_object(&self->event_channel);
 }
 
 static void tray_menu_plugin_class_init(TrayMenuPluginClass* klass) {
     G_OBJECT_CLASS(klass)->dispose = tray_menu_plugin_dispose;
 }
 
+// Deliberately cheap: gtkmm and the menu widgets are only created by the first showTrayIcon or addMenuItem.
 static void tray_menu_plugin_init(TrayMenuPlugin* self) {
-    new Gtk::Main();
-    Glib::init();
-    new (&self->menu) IndexedMenu{};
+    self->id = TrayService::get().attach(self);
 }
 
 static void method_call_cb(FlMethodChannel*, FlMethodCall* method_call, gpointer user_data) {
     tray_menu_plugin_handle_method_call(TRAY_MENU_PLUGIN(user_data), method_call);
 }
 
+static FlMethodErrorResponse* listen_cb(FlEventChannel*, FlValue*, gpointer user_data) {
+    TRAY_MENU_PLUGIN(user_data)->listening = true;
+    return nullptr;
+}
+
+static FlMethodErrorResponse* cancel_cb(FlEventChannel*, FlValue*, gpointer user_data) {
+    const auto plugin = TRAY_MENU_PLUGIN(user_data);
+    plugin->listening = false;
+    g_clear_handle_id(&plugin->flush_source_id, g_source_remove);
+    g_clear_pointer(&plugin->pending_events, fl_value_unref);
+    return nullptr;
+}
+
 void tray_menu_plugin_register_with_registrar(FlPluginRegistrar* registrar) {
     TrayMenuPlugin* plugin = TRAY_MENU_PLUGIN(g_object_new(tray_menu_plugin_get_type(), nullptr));
 
@@ -310,6 +2580,474 @@ void tray_menu_plugin_register_with_registrar(FlPluginRegistrar* registrar) {
     plugin->channel =
             fl_method_channel_new(fl_plugin_registrar_get_messenger(registrar), "tray_menu", FL_METHOD_CODEC(codec));
     fl_method_channel_set_method_call_handler(plugin->channel, method_call_cb, g_object_ref(plugin), g_object_unref);
+    plugin->event_channel = fl_event_channel_new(
+            fl_plugin_registrar_get_messenger(registrar), "tray_menu/events", FL_METHOD_CODEC(codec));
+    fl_event_channel_set_stream_handlers(
+            plugin->event_channel, listen_cb, cancel_cb, g_object_ref(plugin), g_object_unref);
+
+    auto& service = TrayService::get();
+    if (!service.recorder) {
+        if (const auto record_path = g_getenv(call_log::env_var)) {
+            service.recorder = std::make_unique<call_log::Writer>(record_path);
+        }
+    }
+    service.restore_snapshots();
 
     g_object_unref(plugin);
 }
+
+// A menu operation issued through the exported C ABI below.
+struct Update {
+    enum class Kind : uint8_t {
+        add,
+        remove,
+        clear,
+        move,
+        reorder,
+        label,
+        enabled,
+        checked,
+        select_radio,
+        strings,
+        set_counter,
+        add_to_counter,
+    };
+
+    Update* next = nullptr;
+    Kind kind;
+    // The item to add, or the property to set.
+    ItemSpec item{};
+    int64_t engine  = 0;
+    int64_t tray    = 0;
+    int64_t handle  = -1;
+    int64_t submenu = -1;
+    int64_t before  = -1;
+    std::vector<int64_t> handles{};
+    std::vector<std::pair<int64_t, std::string>> strings{};
+    // The value or delta of a counter, which item.key names.
+    int64_t value = 0;
+
+    // Repeated property updates of an item can be collapsed into the last one; structural changes cannot.
+    bool coalescable() const {
+        return kind == Kind::label || kind == Kind::enabled || kind == Kind::checked || kind == Kind::select_radio;
+    }
+};
+
+static bool apply_update(TrayService& service, const Update& update) {
+    if (update.kind == Update::Kind::add) {
+        return service.add_item(update.engine, update.handle, update.item, update.tray, update.submenu, update.before);
+    }
+    if (update.kind == Update::Kind::clear) {
+        return service.clear_children(update.tray, update.submenu);
+    }
+    if (update.kind == Update::Kind::move) {
+        return service.move_item(update.handle, update.tray, update.submenu, update.before);
+    }
+    if (update.kind == Update::Kind::reorder) {
+        return service.reorder_children(update.submenu, update.handles);
+    }
+    if (update.kind == Update::Kind::strings) {
+        service.set_strings(update.strings);
+        return true;
+    }
+    if (update.kind == Update::Kind::set_counter || update.kind == Update::Kind::add_to_counter) {
+        service.set_counter(update.item.key, update.value, update.kind == Update::Kind::add_to_counter);
+        return true;
+    }
+    auto backend = service.backend_for_handle(update.handle);
+    if (!backend) {
+        return false;
+    }
+    switch (update.kind) {
+        case Update::Kind::remove:
+            return backend->remove_item(update.handle);
+        case Update::Kind::label:
+            return backend->set_label(update.handle, update.item.label.c_str());
+        case Update::Kind::enabled:
+            return backend->set_enabled(update.handle, update.item.enabled);
+        case Update::Kind::checked:
+            return backend->set_checked(update.handle, update.item.checked);
+        case Update::Kind::select_radio:
+            return backend->select_radio(update.item.group, update.handle);
+        default:
+            return false;
+    }
+}
+
+// The method channel call equivalent to an update.
+static const gchar* update_method(Update::Kind kind) {
+    switch (kind) {
+        case Update::Kind::add:
+            return "addMenuItem";
+        case Update::Kind::remove:
+            return "removeMenuItem";
+        case Update::Kind::clear:
+            return "clearChildren";
+        case Update::Kind::move:
+            return "moveMenuItem";
+        case Update::Kind::reorder:
+            return "reorderChildren";
+        case Update::Kind::label:
+            return "setMenuItemLabel";
+        case Update::Kind::enabled:
+            return "setMenuItemEnabled";
+        case Update::Kind::checked:
+            return "setMenuItemChecked";
+        case Update::Kind::select_radio:
+            return "selectRadio";
+        case Update::Kind::strings:
+            return "setStrings";
+        case Update::Kind::set_counter:
+            return "setCounter";
+        case Update::Kind::add_to_counter:
+            return "addToCounter";
+    }
+    return nullptr;
+}
+
+static FlValue* new_handle_args(int64_t handle, const gchar* key, FlValue* value) {
+    auto args = fl_value_new_map();
+    fl_value_set_string_take(args, "handle", fl_value_new_int(handle));
+    fl_value_set_string_take(args, key, value);
+    return args;
+}
+
+// Calls made through the exported C ABI are recorded as the equivalent method channel call, so that traces replay
+// the same way regardless of which path the app used.
+static void record_update(call_log::Writer& recorder, const Update& update, int64_t timestamp_us, int64_t duration_ns) {
+    const auto& item        = update.item;
+    g_autoptr(FlValue) args = nullptr;
+    switch (update.kind) {
+        case Update::Kind::add:
+            args = fl_value_new_map();
+            fl_value_set_string_take(
+                    args, "type", fl_value_new_string(menu_item_type_names[static_cast<gint32>(item.type)]));
+            if (update.tray) {
+                fl_value_set_string_take(args, "tray", fl_value_new_int(update.tray));
+            }
+            if (!item.key.empty()) {
+                fl_value_set_string_take(args, "key", fl_value_new_string(item.key.c_str()));
+            }
+            if (item.type != MenuItemType::separator) {
+                fl_value_set_string_take(args,
+                                         item.string_id >= 0 ? "string" : "label",
+                                         item.string_id >= 0 ? fl_value_new_int(item.string_id)
+                                                             : fl_value_new_string(item.label.c_str()));
+                fl_value_set_string_take(args, "enabled", fl_value_new_bool(item.enabled));
+            }
+            if (item.type == MenuItemType::checkbox || item.type == MenuItemType::radio) {
+                fl_value_set_string_take(args, "checked", fl_value_new_bool(item.checked));
+            }
+            if (item.type == MenuItemType::radio) {
+                fl_value_set_string_take(args, "group", fl_value_new_int(item.group));
+            }
+            if (update.submenu >= 0) {
+                fl_value_set_string_take(args, "submenu", fl_value_new_int(update.submenu));
+            }
+            if (update.before >= 0) {
+                fl_value_set_string_take(args, "before", fl_value_new_int(update.before));
+            }
+            fl_value_set_string_take(args, "handle", fl_value_new_int(update.handle));
+            break;
+        case Update::Kind::remove:
+            args = fl_value_new_int(update.handle);
+            break;
+        case Update::Kind::clear:
+            args = fl_value_new_map();
+            if (update.tray) {
+                fl_value_set_string_take(args, "tray", fl_value_new_int(update.tray));
+            }
+            if (update.submenu >= 0) {
+                fl_value_set_string_take(args, "submenu", fl_value_new_int(update.submenu));
+            }
+            break;
+        case Update::Kind::move:
+            args = new_handle_args(update.handle, "tray", fl_value_new_int(update.tray));
+            if (update.submenu >= 0) {
+                fl_value_set_string_take(args, "submenu", fl_value_new_int(update.submenu));
+            }
+            if (update.before >= 0) {
+                fl_value_set_string_take(args, "before", fl_value_new_int(update.before));
+            }
+            break;
+        case Update::Kind::reorder:
+            args = fl_value_new_map();
+            if (update.submenu >= 0) {
+                fl_value_set_string_take(args, "submenu", fl_value_new_int(update.submenu));
+            }
+            fl_value_set_string_take(
+                    args, "handles", fl_value_new_int64_list(update.handles.data(), update.handles.size()));
+            break;
+        case Update::Kind::label:
+            args = new_handle_args(update.handle, "label", fl_value_new_string(item.label.c_str()));
+            break;
+        case Update::Kind::enabled:
+            args = new_handle_args(update.handle, "enabled", fl_value_new_bool(item.enabled));
+            break;
+        case Update::Kind::checked:
+            args = new_handle_args(update.handle, "checked", fl_value_new_bool(item.checked));
+            break;
+        case Update::Kind::select_radio:
+            args = new_handle_args(update.handle, "group", fl_value_new_int(item.group));
+            break;
+        case Update::Kind::strings:
+            args = fl_value_new_map();
+            for (const auto& entry : update.strings) {
+                fl_value_set_take(args, fl_value_new_int(entry.first), fl_value_new_string(entry.second.c_str()));
+            }
+            break;
+        case Update::Kind::set_counter:
+        case Update::Kind::add_to_counter:
+            args = fl_value_new_map();
+            fl_value_set_string_take(args, "counter", fl_value_new_string(item.key.c_str()));
+            fl_value_set_string_take(
+                    args, update.kind == Update::Kind::set_counter ? "value" : "delta", fl_value_new_int(update.value));
+            break;
+    }
+    recorder.append(update_method(update.kind), args, timestamp_us, duration_ns);
+}
+
+static bool run_update(const Update& update) {
+    auto& service = TrayService::get();
+    if (!service.recorder) {
+        return apply_update(service, update);
+    }
+    const auto timestamp_us = g_get_monotonic_time();
+    const auto start        = std::chrono::steady_clock::now();
+    const bool success      = apply_update(service, update);
+    const auto duration     = std::chrono::steady_clock::now() - start;
+    record_update(*service.recorder,
+                  update,
+                  timestamp_us,
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+    return success;
+}
+
+// The tray an update acts on, or -1 for updates of the string table and counters, which are shared by every tray.
+static int64_t update_tray_index(const Update& update) {
+    switch (update.kind) {
+        case Update::Kind::add:
+        case Update::Kind::clear:
+        case Update::Kind::move:
+            return update.tray;
+        case Update::Kind::reorder:
+            if (update.submenu >= 0) {
+                return update.submenu >> tray_handle_shift;
+            }
+            return update.handles.empty() ? -1 : update.handles.front() >> tray_handle_shift;
+        case Update::Kind::strings:
+        case Update::Kind::set_counter:
+        case Update::Kind::add_to_counter:
+            return -1;
+        default:
+            return update.handle >> tray_handle_shift;
+    }
+}
+
+// A deferred update already reported success to its caller, who holds on to the handle it was given, so its failure is
+// reported as an event instead: to the engine that added the item, or to every engine using the tray for the calls
+// that don't say which engine made them.
+static void report_failed_update(TrayService& service, const Update& update) {
+    const auto method     = update_method(update.kind);
+    const auto tray_index = update_tray_index(update);
+    g_warning("tray_menu: deferred %s failed", method);
+    g_autoptr(FlValue) event = new_event("operationFailed", tray_index);
+    fl_value_set_string_take(event, "operation", fl_value_new_string(method));
+    if (update.handle >= 0) {
+        fl_value_set_string_take(event, "handle", fl_value_new_int(update.handle));
+    }
+    if (update.engine > 0) {
+        service.post_event(update.engine, event);
+        return;
+    }
+    const auto tray = service.trays.find(tray_index);
+    if (tray != service.trays.end()) {
+        service.post_to_users(*tray->second, event);
+    }
+}
+
+// Updates issued off the main thread wait here until the main loop drains them.
+static MpscQueue<Update> pending_updates;
+
+// Applies the pending updates in the order they were issued. Setting the same property of the same item more than once
+// in a batch only applies the last value, so a producer updating faster than the main loop runs costs one widget
+// update per main loop iteration. Structural changes are never coalesced.
+static void drain_pending_updates() {
+    std::vector<std::unique_ptr<Update>> batch;
+    for (auto update = pending_updates.take_all(); update;) {
+        const auto next = update->next;
+        batch.emplace_back(update);
+        update = next;
+    }
+    if (batch.empty()) {
+        return;
+    }
+
+    std::set<std::pair<int64_t, Update::Kind>> latest;
+    for (auto it = batch.rbegin(); it != batch.rend(); ++it) {
+        if ((*it)->coalescable() && !latest.insert({(*it)->handle, (*it)->kind}).second) {
+            it->reset();
+        }
+    }
+    for (const auto& update : batch) {
+        if (update && !run_update(*update)) {
+            report_failed_update(TrayService::get(), *update);
+        }
+    }
+}
+
+static gboolean dispatch_pending_updates(GSource* source, GSourceFunc, gpointer) {
+    // Re-armed by the first push that finds the queue empty again, which can only happen after take_all.
+    g_source_set_ready_time(source, -1);
+    drain_pending_updates();
+    return G_SOURCE_CONTINUE;
+}
+
+// Created by the first update issued off the main thread and kept for the lifetime of the process. Waking it only takes
+// g_source_set_ready_time, which is safe to call from any thread.
+static GSource* pending_updates_source() {
+    static GSourceFuncs funcs = {nullptr, nullptr, dispatch_pending_updates, nullptr, nullptr, nullptr};
+    static GSource* source    = [] {
+        auto created = g_source_new(&funcs, sizeof(GSource));
+        g_source_set_name(created, "tray_menu pending updates");
+        g_source_set_ready_time(created, -1);
+        g_source_attach(created, nullptr);
+        return created;
+    }();
+    return source;
+}
+
+// The exported C ABI below is the synchronous fast path used by the Dart FFI platform implementation, and can be called
+// from any thread. When called on the GTK main thread the operation is applied immediately, after any still queued
+// ones, and its result is exact. When called from any other thread the operation is pushed onto a lock-free queue that
+// the main loop drains in batches, and the call optimistically reports success; failures are reported as events.
+static gboolean submit(std::unique_ptr<Update> update) {
+    if (g_main_context_is_owner(g_main_context_default())) {
+        if (!pending_updates.empty()) {
+            drain_pending_updates();
+        }
+        return run_update(*update);
+    }
+    const auto source = pending_updates_source();
+    if (pending_updates.push(update.release())) {
+        g_source_set_ready_time(source, 0);
+    }
+    return TRUE;
+}
+
+static std::unique_ptr<Update> new_update(Update::Kind kind, int64_t handle) {
+    auto update    = std::make_unique<Update>();
+    update->kind   = kind;
+    update->handle = handle;
+    return update;
+}
+
+gint64 tray_menu_add_item(gint64 engine,
+                          gint64 tray,
+                          gint32 type,
+                          const gchar* label,
+                          gsize label_length,
+                          const gchar* key,
+                          gsize key_length,
+                          gboolean enabled,
+                          gboolean checked,
+                          gint64 group,
+                          gint64 string_id,
+                          gint64 submenu,
+                          gint64 before) {
+    if (type < TRAY_MENU_ITEM_LABEL || type > TRAY_MENU_ITEM_RADIO) {
+        return -1;
+    }
+    const auto tray_index  = submenu >= 0 ? submenu >> tray_handle_shift : tray;
+    const auto handle      = allocate_handle(tray_index);
+    auto update            = new_update(Update::Kind::add, handle);
+    update->item.type      = static_cast<MenuItemType>(type);
+    update->item.enabled   = enabled;
+    update->item.checked   = checked;
+    update->item.group     = group;
+    update->item.string_id = string_id;
+    update->engine         = engine;
+    update->tray           = tray_index;
+    update->submenu        = submenu;
+    update->before         = before;
+    if (string_id < 0) {
+        update->item.label.assign(label ? label : "", label_length);
+    }
+    update->item.key.assign(key ? key : "", key_length);
+    return submit(std::move(update)) ? handle : -1;
+}
+
+gboolean tray_menu_remove_item(gint64 handle) {
+    return submit(new_update(Update::Kind::remove, handle));
+}
+
+gboolean tray_menu_clear_children(gint64 tray, gint64 submenu) {
+    auto update     = new_update(Update::Kind::clear, -1);
+    update->tray    = submenu >= 0 ? submenu >> tray_handle_shift : tray;
+    update->submenu = submenu;
+    return submit(std::move(update));
+}
+
+gboolean tray_menu_move_item(gint64 handle, gint64 tray, gint64 submenu, gint64 before) {
+    auto update     = new_update(Update::Kind::move, handle);
+    update->tray    = tray;
+    update->submenu = submenu;
+    update->before  = before;
+    return submit(std::move(update));
+}
+
+gboolean tray_menu_reorder_children(gint64 submenu, const gint64* handles, gsize count) {
+    auto update     = new_update(Update::Kind::reorder, -1);
+    update->submenu = submenu;
+    update->handles.assign(handles, handles + count);
+    return submit(std::move(update));
+}
+
+gboolean tray_menu_set_label(gint64 handle, const gchar* label, gsize label_length) {
+    auto update = new_update(Update::Kind::label, handle);
+    update->item.label.assign(label ? label : "", label_length);
+    return submit(std::move(update));
+}
+
+gboolean tray_menu_set_enabled(gint64 handle, gboolean enabled) {
+    auto update          = new_update(Update::Kind::enabled, handle);
+    update->item.enabled = enabled;
+    return submit(std::move(update));
+}
+
+gboolean tray_menu_set_checked(gint64 handle, gboolean checked) {
+    auto update          = new_update(Update::Kind::checked, handle);
+    update->item.checked = checked;
+    return submit(std::move(update));
+}
+
+gboolean tray_menu_select_radio(gint64 group, gint64 handle) {
+    auto update        = new_update(Update::Kind::select_radio, handle);
+    update->item.group = group;
+    return submit(std::move(update));
+}
+
+gboolean tray_menu_set_strings(const gint64* ids, const gchar* texts, const gsize* lengths, gsize count) {
+    auto update = new_update(Update::Kind::strings, -1);
+    update->strings.reserve(count);
+    gsize offset = 0;
+    for (gsize i = 0; i < count; ++i) {
+        update->strings.emplace_back(ids[i], std::string(texts + offset, lengths[i]));
+        offset += lengths[i];
+    }
+    return submit(std::move(update));
+}
+
+gboolean tray_menu_set_counter(const gchar* name, gsize name_length, gint64 value) {
+    auto update   = new_update(Update::Kind::set_counter, -1);
+    update->value = value;
+    update->item.key.assign(name ? name : "", name_length);
+    return submit(std::move(update));
+}
+
+gboolean tray_menu_add_to_counter(const gchar* name, gsize name_length, gint64 delta) {
+    auto update   = new_update(Update::Kind::add_to_counter, -1);
+    update->value = delta;
+    update->item.key.assign(name ? name : "", name_length);
+    return submit(std::move(update));
+}
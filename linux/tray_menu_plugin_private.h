@@ -5,3 +5,17 @@
 // This file exposes some plugin internals for unit testing. See
 // https://github.com/flutter/flutter/issues/88724 for current limitations
 // in the unit-testable API.
+
+// Runs the handler for method with args and returns its response, exactly as a
+// call arriving on the method channel would. Used by the replay tool.
+FlMethodResponse* tray_menu_plugin_dispatch(TrayMenuPlugin* self,
+                                            const gchar* method,
+                                            FlValue* args);
+
+// Returns the number of GObjects created by the plugin that have not been
+// finalized yet, across all plugin instances.
+gsize tray_menu_plugin_get_live_objects();
+
+// Returns the instance size of those GObjects, which is what GObject allocated
+// for them, excluding any memory they allocated themselves.
+gsize tray_menu_plugin_get_live_object_bytes();
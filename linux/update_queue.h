@@ -0,0 +1,40 @@
+#ifndef FLUTTER_PLUGIN_TRAY_MENU_UPDATE_QUEUE_H_
+#define FLUTTER_PLUGIN_TRAY_MENU_UPDATE_QUEUE_H_
+
+#include <atomic>
+
+// A lock-free multi-producer, single-consumer queue of intrusively linked nodes, which need a T* next member.
+//
+// Producers on any thread push with a single compare-and-swap. The consumer takes everything pushed so far with one
+// exchange and gets it back oldest first, so there is no per-node synchronization and no ABA problem.
+template<typename T>
+struct MpscQueue {
+    // Returns true if the queue was empty, meaning the consumer has to be woken up.
+    bool push(T* node) {
+        auto first = head.load(std::memory_order_relaxed);
+        do {
+            node->next = first;
+        } while (!head.compare_exchange_weak(first, node, std::memory_order_release, std::memory_order_relaxed));
+        return first == nullptr;
+    }
+
+    bool empty() const { return head.load(std::memory_order_relaxed) == nullptr; }
+
+    // Returns the nodes pushed so far as a list linked through next, oldest first, and leaves the queue empty.
+    T* take_all() {
+        auto node   = head.exchange(nullptr, std::memory_order_acquire);
+        T* reversed = nullptr;
+        while (node) {
+            const auto next = node->next;
+            node->next      = reversed;
+            reversed        = node;
+            node            = next;
+        }
+        return reversed;
+    }
+
+private:
+    std::atomic<T*> head{nullptr};
+};
+
+#endif  // FLUTTER_PLUGIN_TRAY_MENU_UPDATE_QUEUE_H_
@@ -0,0 +1,316 @@
+import 'dart:async';
+import 'dart:math';
+import 'dart:typed_data';
+
+import 'package:flutter/services.dart';
+import 'package:flutter_test/flutter_test.dart';
+import 'package:tray_menu/tray_menu.dart';
+
+// Hands out handles and records the reorders sent, without doing anything
+// natively.
+class _FakeTrayMenuPlatform extends TrayMenuPlatform {
+  final reorders = <List<int>>[];
+  final addedTo = <int>[];
+  int _nextTray = 0;
+  int _nextHandle = 0;
+
+  // When set, reorders only finish once it completes, so tests can look at
+  // the menu while one is underway.
+  Completer<void>? reorderCall;
+
+  // Makes moves and replaces fail natively.
+  bool failMoves = false;
+  bool failReplaces = false;
+
+  @override
+  Stream<Object?> get events => const Stream.empty();
+
+  @override
+  void setCallbackHandler(Future<dynamic> Function(MethodCall) callback) {}
+
+  @override
+  Future<int> init({String? id, bool reattach = false}) async =>
+      id == null ? 0 : ++_nextTray;
+
+  @override
+  Future<Map<Object?, Object?>> getManifest({int tray = 0}) async => const {};
+
+  @override
+  Future<int> add(
+    Object item, {
+    int tray = 0,
+    int? submenu,
+    int? before,
+  }) async {
+    addedTo.add(tray);
+    final index = submenu != null ? submenu >> _trayHandleShift : tray;
+    return index << _trayHandleShift | _nextHandle++;
+  }
+
+  @override
+  Future<void> remove(int handle) async {}
+
+  @override
+  Future<void> moveMenuItem(
+    int handle, {
+    int tray = 0,
+    int? submenu,
+    int? before,
+  }) async {
+    if (failMoves) throw PlatformException(code: 'error');
+  }
+
+  @override
+  Future<List<int>> replaceChildren(
+    List<Object> items, {
+    int tray = 0,
+    int? submenu,
+  }) async {
+    if (failReplaces) throw PlatformException(code: 'Invalid handle');
+    return [for (final _ in items) tray << _trayHandleShift | _nextHandle++];
+  }
+
+  @override
+  Future<void> reorderChildren(Int64List handles, {int? submenu}) {
+    reorders.add([...handles]);
+    return reorderCall?.future ?? Future.value();
+  }
+}
+
+// Mirrors the native side, where a handle's upper bits name its tray.
+const _trayHandleShift = 32;
+
+var _trays = 0;
+
+TrayMenu _newTray() => TrayMenu.create('menu-order-${_trays++}');
+
+// Checks every way of reading the order of menu against expected.
+void _expectOrder(Menu menu, List<String> expected) {
+  expect(menu.keys, expected);
+  expect(menu.length, expected.length);
+  for (var i = 0; i < expected.length; i++) {
+    expect(menu.indexOf(expected[i]), i);
+    expect(menu.elementAt(i), same(menu.get(expected[i])));
+  }
+}
+
+void main() {
+  late _FakeTrayMenuPlatform platform;
+
+  setUpAll(() {
+    platform = _FakeTrayMenuPlatform();
+    TrayMenuPlatform.instance = platform;
+  });
+
+  setUp(() {
+    platform.reorders.clear();
+    platform.addedTo.clear();
+    platform.failMoves = false;
+    platform.failReplaces = false;
+    platform.reorderCall = null;
+  });
+
+  test('the default tray takes adds', () async {
+    final tray = TrayMenu.instance;
+    await tray.addLabel('a', label: 'A');
+    await tray.addLabel('b', label: 'B', before: 'a');
+    _expectOrder(tray, ['b', 'a']);
+    expect(platform.addedTo, [0, 0]);
+  });
+
+  test('adds go in front of before, or at the end', () async {
+    final tray = _newTray();
+    await tray.addLabel('b', label: 'B');
+    await tray.addLabel('d', label: 'D');
+    await tray.addLabel('a', label: 'A', before: 'b');
+    await tray.addLabel('c', label: 'C', before: 'd');
+    await tray.addLabel('e', label: 'E', before: 'missing');
+    _expectOrder(tray, ['a', 'b', 'c', 'd', 'e']);
+  });
+
+  test('removes close the gap and ignore missing keys', () async {
+    final tray = _newTray();
+    for (final key in ['a', 'b', 'c', 'd']) {
+      await tray.addLabel(key, label: key);
+    }
+    await tray.remove('a');
+    await tray.remove('c');
+    await tray.remove('missing');
+    _expectOrder(tray, ['b', 'd']);
+    await tray.remove('b');
+    await tray.remove('d');
+    _expectOrder(tray, []);
+    expect(tray.indexOf('b'), -1);
+  });
+
+  test('reorder moves keys to the front in order', () async {
+    final tray = _newTray();
+    for (final key in ['a', 'b', 'c', 'd', 'e']) {
+      await tray.addLabel(key, label: key);
+    }
+    await tray.reorder(['d', 'b']);
+    _expectOrder(tray, ['d', 'b', 'a', 'c', 'e']);
+    await tray.reorder(['d', 'b']);
+    _expectOrder(tray, ['d', 'b', 'a', 'c', 'e']);
+    await tray.reorder([]);
+    _expectOrder(tray, ['d', 'b', 'a', 'c', 'e']);
+    await tray.reorder(['e', 'c', 'a', 'b', 'd']);
+    _expectOrder(tray, ['e', 'c', 'a', 'b', 'd']);
+  });
+
+  test('reorder rejects repeated and missing keys', () async {
+    final tray = _newTray();
+    for (final key in ['a', 'b', 'c']) {
+      await tray.addLabel(key, label: key);
+    }
+    await expectLater(tray.reorder(['c', 'a', 'c']), throwsArgumentError);
+    await expectLater(tray.reorder(['b', 'missing']), throwsArgumentError);
+    _expectOrder(tray, ['a', 'b', 'c']);
+    expect(platform.reorders, isEmpty);
+  });
+
+  test('reorder updates the order before the native call finishes', () async {
+    final tray = _newTray();
+    for (final key in ['a', 'b', 'c']) {
+      await tray.addLabel(key, label: key);
+    }
+    platform.reorderCall = Completer();
+    final reordered = tray.reorder(['c']);
+    await Future<void>.delayed(Duration.zero);
+    expect(platform.reorders, hasLength(1));
+    _expectOrder(tray, ['c', 'a', 'b']);
+    platform.reorderCall!.complete();
+    await reordered;
+    _expectOrder(tray, ['c', 'a', 'b']);
+  });
+
+  test('moves between submenus of a tray', () async {
+    final tray = _newTray();
+    final first = await tray.addSubmenu('first', label: 'First');
+    final second = await tray.addSubmenu('second', label: 'Second');
+    await first.addLabel('a', label: 'A');
+    await first.addLabel('b', label: 'B');
+    await second.addLabel('c', label: 'C');
+    await first.move('a', to: second, before: 'c');
+    _expectOrder(first, ['b']);
+    _expectOrder(second, ['a', 'c']);
+    await tray.move('second', to: first);
+    _expectOrder(tray, ['first']);
+    _expectOrder(first, ['b', 'second']);
+  });
+
+  test('moves fail without changing the menus', () async {
+    final tray = _newTray();
+    final other = _newTray();
+    final outer = await tray.addSubmenu('outer', label: 'Outer');
+    final inner = await outer.addSubmenu('inner', label: 'Inner');
+    await tray.addLabel('a', label: 'A');
+    await other.addLabel('b', label: 'B');
+    await expectLater(tray.move('outer', to: outer), throwsArgumentError);
+    await expectLater(tray.move('outer', to: inner), throwsArgumentError);
+    await expectLater(tray.move('a', to: other), throwsArgumentError);
+    await expectLater(other.move('b', to: inner), throwsArgumentError);
+    _expectOrder(tray, ['outer', 'a']);
+    _expectOrder(outer, ['inner']);
+    _expectOrder(other, ['b']);
+
+    platform.failMoves = true;
+    await expectLater(
+      tray.move('outer', to: tray),
+      throwsA(isA<PlatformException>()),
+    );
+    await expectLater(
+      tray.move('a', to: inner),
+      throwsA(isA<PlatformException>()),
+    );
+    _expectOrder(tray, ['outer', 'a']);
+    _expectOrder(inner, []);
+    expect(tray.get<MenuItemLabel>('a'), isNotNull);
+  });
+
+  test('a failed replace leaves the menu empty', () async {
+    final tray = _newTray();
+    await tray.addLabel('a', label: 'A');
+    await tray.addLabel('b', label: 'B');
+    platform.failReplaces = true;
+    await expectLater(
+      tray.replaceChildren([MenuEntry.label('c', label: 'C')]),
+      throwsA(isA<PlatformException>()),
+    );
+    _expectOrder(tray, []);
+    expect(tray.get<MenuItem>('a'), isNull);
+
+    platform.failReplaces = false;
+    await tray.replaceChildren([
+      MenuEntry.label('c', label: 'C'),
+      MenuEntry.label('a', label: 'A'),
+    ]);
+    _expectOrder(tray, ['c', 'a']);
+  });
+
+  test('keysInRange checks its bounds', () async {
+    final tray = _newTray();
+    expect(tray.keysInRange(0), isEmpty);
+    for (final key in ['a', 'b', 'c', 'd']) {
+      await tray.addLabel(key, label: key);
+    }
+    expect(tray.keysInRange(0), ['a', 'b', 'c', 'd']);
+    expect(tray.keysInRange(1, 3), ['b', 'c']);
+    expect(tray.keysInRange(3), ['d']);
+    expect(tray.keysInRange(4), isEmpty);
+    expect(tray.keysInRange(2, 2), isEmpty);
+    expect(() => tray.keysInRange(-1), throwsRangeError);
+    expect(() => tray.keysInRange(5), throwsRangeError);
+    expect(() => tray.keysInRange(3, 2), throwsRangeError);
+    expect(() => tray.keysInRange(0, 5), throwsRangeError);
+    expect(() => tray.elementAt(4), throwsRangeError);
+    expect(() => tray.elementAt(-1), throwsRangeError);
+  });
+
+  test('matches a list after many random operations', () async {
+    final random = Random(42);
+    final tray = _newTray();
+    final expected = <String>[];
+    var nextKey = 0;
+    for (var step = 0; step < 2000; step++) {
+      final operation = expected.isEmpty ? 0 : random.nextInt(4);
+      switch (operation) {
+        case 0:
+          final key = 'k${nextKey++}';
+          final at = random.nextInt(expected.length + 1);
+          final before = at < expected.length ? expected[at] : null;
+          await tray.addLabel(key, label: key, before: before);
+          expected.insert(at, key);
+        case 1:
+          final key = expected.removeAt(random.nextInt(expected.length));
+          await tray.remove(key);
+        case 2:
+          final keys = {
+            for (var i = random.nextInt(4); i > 0; i--)
+              expected[random.nextInt(expected.length)],
+          }.toList();
+          await tray.reorder(keys);
+          expected
+            ..removeWhere(keys.contains)
+            ..insertAll(0, keys);
+        case 3:
+          final key = expected.removeAt(random.nextInt(expected.length));
+          final at = random.nextInt(expected.length + 1);
+          final before = at < expected.length ? expected[at] : null;
+          await tray.move(key, before: before);
+          expected.insert(at, key);
+      }
+
+      expect(tray.keys, expected);
+      for (var i = 0; i < 5 && expected.isNotEmpty; i++) {
+        final index = random.nextInt(expected.length);
+        expect(tray.indexOf(expected[index]), index);
+        expect(tray.elementAt(index), same(tray.get(expected[index])));
+      }
+      final start = random.nextInt(expected.length + 1);
+      final end = start + random.nextInt(expected.length - start + 1);
+      expect(tray.keysInRange(start, end), expected.sublist(start, end));
+    }
+    _expectOrder(tray, expected);
+  });
+}